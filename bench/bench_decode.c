@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+/* bench_decode.c
+ *
+ * Encodes synthetic posting lists (ascending record offsets with random gaps,
+ * like the rows of one author in the CSV) as raw uint64 and as delta + varint
+ * nodes, and measures size and decode speed of both through the same
+ * arrays_offset_iter_t the lookup path uses.
+ *
+ * usage: build/bench_decode [list_len] [avg_gap] [rounds]
+ */
+#include "malloc_count.h"
+#include "arrays.h"
+#include "varint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* xorshift, enough for gap sizes */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void run_decode(const char *name, const arrays_node_view_t *view, uint64_t rounds) {
+    uint64_t batch[64];
+    uint64_t sink = 0;
+    uint64_t mallocs_before = bench_malloc_calls;
+    double t0 = now_sec();
+    for (uint64_t r = 0; r < rounds; ++r) {
+        arrays_offset_iter_t it;
+        int n;
+        arrays_offset_iter_init(&it, view);
+        while ((n = arrays_offset_iter_next(&it, batch, 64)) > 0) {
+            for (int i = 0; i < n; ++i) sink += batch[i];
+        }
+    }
+    double dt = now_sec() - t0;
+    double total = (double)rounds * (double)view->list_len;
+    printf("%-24s %8.2f ns/offset  %8.0f Moffsets/s  %6.3f mallocs/round  (sum %llx)\n", name,
+           dt * 1e9 / total, total / dt / 1e6,
+           (double)(bench_malloc_calls - mallocs_before) / (double)rounds,
+           (unsigned long long)(sink & 0xffff));
+}
+
+int main(int argc, char **argv) {
+    uint32_t list_len = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 100000;
+    uint64_t avg_gap = argc > 2 ? strtoull(argv[2], NULL, 10) : 4000;
+    uint64_t rounds = argc > 3 ? strtoull(argv[3], NULL, 10) : 200;
+    if (list_len == 0 || avg_gap == 0 || rounds == 0) return 1;
+
+    off_t *offsets = malloc((size_t)list_len * sizeof(off_t));
+    if (!offsets) return 1;
+    uint64_t pos = 4096;
+    for (uint32_t i = 0; i < list_len; ++i) {
+        pos += 1 + rng_next() % (2 * avg_gap);
+        offsets[i] = (off_t)pos;
+    }
+
+    const char key[] = "stephen king";
+    uint16_t key_len = (uint16_t)strlen(key);
+    size_t raw_size = arrays_calc_tagged_node_size(key_len, list_len);
+    size_t list_bytes = varint_delta_size(offsets, list_len);
+    size_t var_size = arrays_calc_varint_node_size(key_len, (uint32_t)list_bytes);
+    unsigned char *raw = malloc(raw_size);
+    unsigned char *var = malloc(var_size);
+    if (!raw || !var) return 1;
+    arrays_encode_tagged_node(raw, 1, key, key_len, offsets, list_len, 0);
+    arrays_encode_varint_node(var, 1, key, key_len, offsets, list_len, 0);
+
+    arrays_node_view_t raw_view, var_view;
+    if (arrays_view_decode_tagged(raw, raw_size, &raw_view) != 0 ||
+        arrays_view_decode_varint(var, var_size, &var_view) != 0) {
+        fprintf(stderr, "decode failed\n");
+        return 1;
+    }
+
+    /* both encodings must give back the same list */
+    arrays_offset_iter_t a, b;
+    uint64_t x[64], y[64];
+    int na, nb;
+    arrays_offset_iter_init(&a, &raw_view);
+    arrays_offset_iter_init(&b, &var_view);
+    while ((na = arrays_offset_iter_next(&a, x, 64)) > 0) {
+        nb = arrays_offset_iter_next(&b, y, 64);
+        if (nb != na || memcmp(x, y, (size_t)na * sizeof x[0]) != 0) {
+            fprintf(stderr, "varint list differs from raw list\n");
+            return 1;
+        }
+    }
+
+    printf("offsets=%u avg_gap=%llu rounds=%llu\n", list_len,
+           (unsigned long long)avg_gap, (unsigned long long)rounds);
+    printf("%-24s %10zu bytes  (%.2f bytes/offset)\n", "raw node", raw_size,
+           (double)raw_size / (double)list_len);
+    printf("%-24s %10zu bytes  (%.2f bytes/offset, %.1fx smaller)\n", "delta+varint node", var_size,
+           (double)var_size / (double)list_len, (double)raw_size / (double)var_size);
+
+    run_decode("raw decode", &raw_view, rounds);
+    run_decode("delta+varint decode", &var_view, rounds);
+
+    free(raw);
+    free(var);
+    free(offsets);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+/* bench_fetch.c
+ *
+ * Writes a synthetic CSV in a temporary directory, builds records.dat from it
+ * and fetches the hits of simulated queries (row ids of one author, spread
+ * over the file) one pread per record and through records_fetch_batch, which
+ * sorts the rows and merges neighbouring records into a few preadv calls.
+ * Reports time and reads per query for both.
+ *
+ * usage: build/bench_fetch [num_rows] [hits_per_query] [num_queries]
+ */
+#include "malloc_count.h"
+#include "builder.h"
+#include "records.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_SEED 0x12345678abcdefULL
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int write_csv(const char *path, uint64_t num_rows) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "title,author_name,image_url,num_pages,average_rating,text_review_count,description,"
+               "5_star_rating_counts,4_star_rating_counts,3_star_rating_counts,2_star_rating_counts,"
+               "1_star_rating_counts,total_rating_counts,genres\n");
+    for (uint64_t i = 0; i < num_rows; ++i) {
+        fprintf(f, "Title %llu,Author %llu,http://img/%llu.jpg,%llu,3.50,%llu,",
+                (unsigned long long)i, (unsigned long long)(rng_next() % 1000), (unsigned long long)i,
+                (unsigned long long)(100 + rng_next() % 900), (unsigned long long)(rng_next() % 5000));
+        int words = 20 + (int)(rng_next() % 60);
+        for (int w = 0; w < words; ++w) fputs(w ? " lorem" : "lorem", f);
+        fprintf(f, ",1,2,3,4,5,15,\"Fiction, Mystery\"\n");
+    }
+    return fclose(f);
+}
+
+int main(int argc, char **argv) {
+    uint64_t num_rows = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    size_t hits = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 300;
+    uint64_t num_queries = argc > 3 ? strtoull(argv[3], NULL, 10) : 200;
+    if (num_rows == 0 || hits == 0 || num_queries == 0) return 1;
+
+    char dir[] = "/tmp/bench_fetch_XXXXXX";
+    if (!mkdtemp(dir)) return 1;
+    char csv_path[256], rec_path[256], path[256];
+    snprintf(csv_path, sizeof csv_path, "%s/books.csv", dir);
+    snprintf(rec_path, sizeof rec_path, "%s/%s", dir, RECORDS_FILE);
+    index_spec_t spec = {"author", 1, 0};
+    if (write_csv(csv_path, num_rows) != 0 || build_indices(csv_path, dir, &spec, 1, BENCH_SEED) != 0) {
+        fprintf(stderr, "build failed\n");
+        return 1;
+    }
+
+    records_t store;
+    if (records_open(&store, rec_path) != 0) return 1;
+    uint64_t *rows = malloc(hits * sizeof(uint64_t));
+    if (!rows) return 1;
+
+    record_t rec = {0};
+    record_t view = {0};
+    records_batch_t batch = {0};
+    uint64_t sink = 0, single_ios = 0, batch_ios = 0;
+    double single_t = 0.0, batch_t = 0.0;
+    uint64_t mallocs_before = bench_malloc_calls;
+    for (uint64_t q = 0; q < num_queries; ++q) {
+        for (size_t i = 0; i < hits; ++i) rows[i] = rng_next() % num_rows;
+
+        double t0 = now_sec();
+        for (size_t i = 0; i < hits; ++i) {
+            if (records_fetch(&store, rows[i], &rec) != 0) return 1;
+            sink += rec.len[0];
+        }
+        single_ios += hits;
+        double t1 = now_sec();
+        if (records_fetch_batch(&store, rows, hits, &batch) != 0) return 1;
+        for (size_t i = 0; i < hits; ++i) {
+            if (records_batch_record(&batch, i, &view) != 0) return 1;
+            sink -= view.len[0];
+        }
+        batch_ios += batch.ios;
+        batch_t += now_sec() - t1;
+        single_t += t1 - t0;
+
+        /* both paths must give back the same records */
+        if (records_fetch(&store, rows[hits - 1], &rec) != 0 ||
+            records_batch_record(&batch, hits - 1, &view) != 0 ||
+            strcmp(rec.field[6], view.field[6]) != 0) {
+            fprintf(stderr, "batch record differs\n");
+            return 1;
+        }
+    }
+    uint64_t mallocs = bench_malloc_calls - mallocs_before;
+
+    printf("rows=%llu hits/query=%zu queries=%llu\n", (unsigned long long)num_rows, hits,
+           (unsigned long long)num_queries);
+    printf("%-20s %10.1f us/query  %8.1f reads/query\n", "pread per record",
+           single_t * 1e6 / (double)num_queries, (double)single_ios / (double)num_queries);
+    printf("%-20s %10.1f us/query  %8.1f reads/query\n", "batched preadv",
+           batch_t * 1e6 / (double)num_queries, (double)batch_ios / (double)num_queries);
+    printf("%.2f mallocs/query (check %llu)\n", (double)mallocs / (double)num_queries,
+           (unsigned long long)(sink & 0xff));
+
+    record_free(&rec);
+    records_batch_free(&batch);
+    records_close(&store);
+    free(rows);
+    const char *files[] = {"books.csv", RECORDS_FILE, "author_buckets.dat", "author_arrays.dat"};
+    for (size_t i = 0; i < sizeof files / sizeof files[0]; ++i) {
+        snprintf(path, sizeof path, "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+    return 0;
+}
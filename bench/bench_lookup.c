@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+/* bench_lookup.c
+ *
+ * Builds a small synthetic index with long collision chains in a temporary
+ * directory and measures lookup latency and heap allocations per lookup on
+ * the query path (hash, chain walk, key comparison), in pread and mmap mode,
+ * for the v1 layout and for the clustered + tagged one. The pread mode is
+ * also run through a block cache (index_set_cache), twice: the first pass
+ * fills it.
+ *
+ * usage: build/bench_lookup [num_keys] [num_buckets] [num_lookups] [cache_mb]
+ */
+#include "malloc_count.h"
+#include "arrays.h"
+#include "buckets.h"
+#include "hash.h"
+#include "index_writer.h"
+#include "keymap.h"
+#include "reader.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_SEED 0x12345678abcdefULL
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void make_key(char *buf, size_t cap, uint64_t i) {
+    snprintf(buf, cap, "Título %llu", (unsigned long long)i);
+}
+
+static int build_synthetic(const char *bpath, const char *apath, uint64_t num_keys, uint64_t num_buckets) {
+    if (buckets_create(bpath, num_buckets, BENCH_SEED) != 0) return -1;
+    if (arrays_create(apath) != 0) return -1;
+    int bfd = buckets_open_readwrite(bpath, NULL, NULL);
+    int afd = arrays_open(apath);
+    if (bfd < 0 || afd < 0) return -1;
+
+    char raw[64];
+    for (uint64_t i = 0; i < num_keys; ++i) {
+        make_key(raw, sizeof raw, i);
+        char *norm = normalize_string(raw);
+        uint64_t bucket = bucket_id_from_hash(hash_key_prefix(norm, strlen(norm), BENCH_SEED), num_buckets - 1);
+        off_t off = (off_t)(i * 100);
+        arrays_node_t node = {(uint16_t)strlen(norm), norm, 1, &off, buckets_read_head(bfd, num_buckets, bucket)};
+        off_t at = arrays_append_node(afd, &node);
+        free(norm);
+        if (at == 0 || buckets_write_head(bfd, num_buckets, bucket, at) != 0) return -1;
+    }
+    close(bfd);
+    close(afd);
+    return 0;
+}
+
+/* same keys written through a keymap: clustered, tagged layout */
+static int build_synthetic_tagged(const char *dir, uint64_t num_keys, uint64_t num_buckets) {
+    keymap_t map;
+    if (keymap_init(&map, BENCH_SEED) != 0) return -1;
+    char raw[64];
+    int rc = 0;
+    for (uint64_t i = 0; i < num_keys && rc == 0; ++i) {
+        make_key(raw, sizeof raw, i);
+        char *norm = normalize_string(raw);
+        keymap_entry_t *e = norm ? keymap_get(&map, norm, strlen(norm)) : NULL;
+        if (!e || keymap_push(&map, e, (off_t)(i * 100)) != 0) rc = -1;
+        free(norm);
+    }
+    if (rc == 0) rc = index_writer_write_keymap(&map, dir, "tagged", num_buckets, BENCH_SEED, INDEX_FLAG_TAGGED);
+    keymap_free(&map);
+    return rc;
+}
+
+static int count_hit(void *ctx, off_t off) {
+    (void)off;
+    (*(uint64_t *)ctx)++;
+    return 0;
+}
+
+static void run_mode(const char *name, index_handle_t *h, uint64_t num_keys, uint64_t num_lookups) {
+    char key[64];
+    uint64_t hits = 0;
+    uint64_t mallocs_before = bench_malloc_calls;
+    double t0 = now_sec();
+    for (uint64_t i = 0; i < num_lookups; ++i) {
+        make_key(key, sizeof key, (i * 7919) % num_keys);
+        index_lookup_each(h, key, count_hit, &hits);
+    }
+    double dt = now_sec() - t0;
+    uint64_t mallocs = bench_malloc_calls - mallocs_before;
+    printf("%-24s %10.0f ns/lookup  %6.3f mallocs/lookup  (%llu hits)\n", name,
+           dt * 1e9 / (double)num_lookups, (double)mallocs / (double)num_lookups,
+           (unsigned long long)hits);
+}
+
+int main(int argc, char **argv) {
+    uint64_t num_keys = argc > 1 ? strtoull(argv[1], NULL, 10) : 200000;
+    uint64_t num_buckets = next_pow2(argc > 2 ? strtoull(argv[2], NULL, 10) : 1024);
+    uint64_t num_lookups = argc > 3 ? strtoull(argv[3], NULL, 10) : 20000;
+    size_t cache_bytes = (size_t)(argc > 4 ? strtoull(argv[4], NULL, 10) : 16) << 20;
+    if (num_keys == 0 || num_lookups == 0) return 1;
+
+    char dir[] = "/tmp/bench_lookup.XXXXXX";
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+    char bpath[256], apath[256], tbpath[256], tapath[256];
+    snprintf(bpath, sizeof bpath, "%s/title_buckets.dat", dir);
+    snprintf(apath, sizeof apath, "%s/title_arrays.dat", dir);
+    snprintf(tbpath, sizeof tbpath, "%s/tagged_buckets.dat", dir);
+    snprintf(tapath, sizeof tapath, "%s/tagged_arrays.dat", dir);
+
+    printf("keys=%llu buckets=%llu (avg chain %.1f nodes) lookups=%llu\n",
+           (unsigned long long)num_keys, (unsigned long long)num_buckets,
+           (double)num_keys / (double)num_buckets, (unsigned long long)num_lookups);
+    if (build_synthetic(bpath, apath, num_keys, num_buckets) != 0 ||
+        build_synthetic_tagged(dir, num_keys, num_buckets) != 0) {
+        fprintf(stderr, "failed to build synthetic index in %s\n", dir);
+        return 1;
+    }
+
+    /* building blocks of the query path */
+    char key[64];
+    uint64_t sink = 0;
+    uint64_t mallocs_before = bench_malloc_calls;
+    for (uint64_t i = 0; i < num_lookups; ++i) {
+        make_key(key, sizeof key, i);
+        sink += hash_key_prefix(key, strlen(key), BENCH_SEED);
+        sink += (uint64_t)normalized_strcmp(key, "titulo 1");
+    }
+    printf("%-24s %6.3f mallocs/call\n", "hash + strcmp",
+           (double)(bench_malloc_calls - mallocs_before) / (double)num_lookups);
+
+    index_handle_t h;
+    if (index_open(&h, bpath, apath) == 0) {
+        run_mode("index_lookup_each pread", &h, num_keys, num_lookups);
+        index_close(&h);
+    }
+    if (index_open(&h, bpath, apath) == 0 && index_set_cache(&h, cache_bytes) == 0) {
+        run_mode("pread + bcache 1st pass", &h, num_keys, num_lookups);
+        run_mode("pread + bcache 2nd pass", &h, num_keys, num_lookups);
+        index_close(&h);
+    }
+    if (index_open_mmap(&h, bpath, apath) == 0) {
+        run_mode("index_lookup_each mmap", &h, num_keys, num_lookups);
+        index_close(&h);
+    }
+    if (index_open(&h, tbpath, tapath) == 0) {
+        run_mode("tagged pread", &h, num_keys, num_lookups);
+        index_close(&h);
+    }
+    if (index_open(&h, tbpath, tapath) == 0 && index_set_cache(&h, cache_bytes) == 0) {
+        run_mode("tagged bcache 1st pass", &h, num_keys, num_lookups);
+        run_mode("tagged bcache 2nd pass", &h, num_keys, num_lookups);
+        index_close(&h);
+    }
+    if (index_open_mmap(&h, tbpath, tapath) == 0) {
+        run_mode("tagged mmap", &h, num_keys, num_lookups);
+        index_close(&h);
+    }
+
+    unlink(bpath);
+    unlink(apath);
+    unlink(tbpath);
+    unlink(tapath);
+    rmdir(dir);
+    return sink == 42 ? 2 : 0;
+}
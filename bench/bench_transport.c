@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+/* bench_transport.c
+ *
+ * Sends the same bulk responses (PROTO_RECORDS messages of many record-sized
+ * items) from a forked producer to the parent, once through a FIFO and once
+ * through a shared memory ring, and reports throughput and the context
+ * switches of the consumer for each.
+ *
+ * usage: build/bench_transport [items_per_msg] [item_bytes] [messages]
+ */
+#include "proto.h"
+#include "shmring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long ctx_switches(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static uint32_t items_per_msg, item_bytes, messages;
+
+static void produce(proto_out_t *out) {
+    unsigned char *item = malloc(item_bytes);
+    const void **items = malloc(items_per_msg * sizeof(void *));
+    uint32_t *lens = malloc(items_per_msg * sizeof(uint32_t));
+    if (!item || !items || !lens) _exit(1);
+    memset(item, 'x', item_bytes);
+    for (uint32_t i = 0; i < items_per_msg; ++i) {
+        items[i] = item;
+        lens[i] = item_bytes;
+    }
+    for (uint32_t m = 0; m < messages; ++m) {
+        if (proto_send(out, PROTO_RECORDS, items, lens, items_per_msg) != 0) _exit(1);
+    }
+    _exit(0);
+}
+
+static void consume(const char *name, proto_reader_t *r, pid_t child) {
+    static proto_msg_t msg;
+    long sw0 = ctx_switches();
+    double t0 = now_sec();
+    uint64_t bytes = 0;
+    for (uint32_t m = 0; m < messages; ++m) {
+        if (proto_read(r, &msg) != 0 || msg.hdr.count != items_per_msg) {
+            fprintf(stderr, "%s: read failed\n", name);
+            exit(1);
+        }
+        bytes += PROTO_HEADER_SIZE + msg.hdr.length;
+    }
+    double dt = now_sec() - t0;
+    long sw = ctx_switches() - sw0;
+    waitpid(child, NULL, 0);
+    printf("%-8s %8.1f MB/s  %8.1f us/msg  %6.1f ctx switches/msg\n", name,
+           (double)bytes / dt / 1e6, dt * 1e6 / messages, (double)sw / messages);
+}
+
+int main(int argc, char **argv) {
+    items_per_msg = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1000;
+    item_bytes = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 300;
+    messages = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : 200;
+    if (items_per_msg == 0 || item_bytes == 0 || messages == 0) return 1;
+    printf("items/msg=%u item_bytes=%u messages=%u\n", items_per_msg, item_bytes, messages);
+
+    char fifo[64];
+    snprintf(fifo, sizeof fifo, "/tmp/bench_transport.%d.fifo", (int)getpid());
+    unlink(fifo);
+    if (mkfifo(fifo, 0600) != 0) return 1;
+    int fd = open(fifo, O_RDWR);
+    if (fd < 0) return 1;
+    pid_t child = fork();
+    if (child == 0) {
+        proto_out_t out = {fd, NULL, 0, 0};
+        produce(&out);
+    }
+    static proto_reader_t reader;
+    proto_reader_init(&reader, fd);
+    consume("fifo", &reader, child);
+    close(fd);
+    unlink(fifo);
+
+    char name[64];
+    snprintf(name, sizeof name, SHMRING_NAME_FMT, (int)getpid());
+    static shmring_t ring;
+    if (shmring_create(&ring, name, SHMRING_DEFAULT_SIZE) != 0) return 1;
+    child = fork();
+    if (child == 0) {
+        shmring_t prod;
+        if (shmring_open(&prod, name) != 0 || shmring_begin_write(&prod) != 0) _exit(1);
+        proto_out_t out = {-1, &prod, 0, 0};
+        produce(&out);
+    }
+    proto_reader_init_ring(&reader, &ring);
+    consume("shm ring", &reader, child);
+    shmring_close(&ring);
+    return 0;
+}
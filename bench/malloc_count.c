@@ -0,0 +1,23 @@
+#include "malloc_count.h"
+#include <stddef.h>
+
+uint64_t bench_malloc_calls = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    bench_malloc_calls++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    bench_malloc_calls++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    bench_malloc_calls++;
+    return __real_realloc(p, size);
+}
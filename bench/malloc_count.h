@@ -0,0 +1,11 @@
+#ifndef MALLOC_COUNT_H
+#define MALLOC_COUNT_H
+
+#include <stdint.h>
+
+/* Number of malloc/calloc/realloc calls made by the benchmark and the index
+   code. Benchmarks are linked with -Wl,--wrap=malloc,... (see Makefile), so
+   only calls from our own objects are counted, not libc internals. */
+extern uint64_t bench_malloc_calls;
+
+#endif // MALLOC_COUNT_H
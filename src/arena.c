@@ -0,0 +1,61 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_DEFAULT_BLOCK (1u << 20)
+#define ARENA_ALIGN 8
+/* block header size rounded up so data stays aligned */
+#define ARENA_HDR ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void arena_init(arena_t *a, size_t block_size) {
+    a->head = NULL;
+    a->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK;
+    a->total = 0;
+}
+
+static unsigned char *block_data(arena_block_t *b) {
+    return (unsigned char *)b + ARENA_HDR;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_block_t *b = a->head;
+    if (!b || b->size - b->used < size) {
+        size_t data_size = size > a->block_size ? size : a->block_size;
+        b = malloc(ARENA_HDR + data_size);
+        if (!b) return NULL;
+        b->used = 0;
+        b->size = data_size;
+        /* keep a partially used head block first when the new one is a one-off */
+        if (a->head && size > a->block_size) {
+            b->next = a->head->next;
+            a->head->next = b;
+        } else {
+            b->next = a->head;
+            a->head = b;
+        }
+    }
+    void *p = block_data(b) + b->used;
+    b->used += size;
+    a->total += size;
+    return p;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t len) {
+    char *p = arena_alloc(a, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+void arena_free(arena_t *a) {
+    arena_block_t *b = a->head;
+    while (b) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+    a->total = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* arena.h
+ *
+ * Bump allocator for many small objects freed all at once (keys collected
+ * while building an index). Memory comes in blocks of block_size bytes,
+ * bigger requests get a block of their own.
+ */
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    /* data follows */
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;
+    size_t block_size;
+    size_t total;        // bytes handed out, for statistics
+} arena_t;
+
+/* initialize an empty arena (block_size 0 selects a default) */
+void arena_init(arena_t *a, size_t block_size);
+
+/* allocate size bytes aligned to 8, returns NULL on OOM */
+void *arena_alloc(arena_t *a, size_t size);
+
+/* copy len bytes of s into the arena and NUL-terminate them */
+char *arena_strndup(arena_t *a, const char *s, size_t len);
+
+/* release every block */
+void arena_free(arena_t *a);
+
+#endif // ARENA_H
@@ -1,5 +1,6 @@
 #include "arrays.h"
 #include "common.h"
+#include "varint.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -40,19 +41,18 @@ size_t arrays_calc_node_size(uint16_t key_len, uint32_t list_len) {
          + sizeof(uint64_t);                 // next_ptr
 }
 
-/* append node: serialize into a buffer then write at EOF */
-off_t arrays_append_node(int fd, const arrays_node_t *node) {
-    if (!node || !node->key) return 0;
-    uint16_t key_len = (uint16_t)strlen(node->key);
-    if ((size_t)key_len != strlen(node->key)) {
-        /* key too long for uint16 */
-        return 0;
-    }
-    uint32_t list_len = node->list_len;
+size_t arrays_calc_tagged_node_size(uint16_t key_len, uint32_t list_len) {
+    return ARRAYS_TAGGED_HDR_SIZE + (size_t)key_len + (size_t)list_len * sizeof(uint64_t);
+}
 
-    size_t node_size = arrays_calc_node_size(key_len, list_len);
-    unsigned char *buf = malloc(node_size);
-    if (!buf) return 0;
+size_t arrays_calc_varint_node_size(uint16_t key_len, uint32_t list_bytes) {
+    return ARRAYS_VARINT_HDR_SIZE + (size_t)key_len + (size_t)list_bytes;
+}
+
+/* serialize node into buf (arrays_calc_node_size bytes), returns bytes written */
+size_t arrays_encode_node(unsigned char *buf, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len, off_t next_ptr)
+{
     size_t pos = 0;
 
     /* key_len */
@@ -60,7 +60,7 @@ off_t arrays_append_node(int fd, const arrays_node_t *node) {
     pos += sizeof(uint16_t);
 
     /* key bytes (no NUL on disk) */
-    memcpy(buf + pos, node->key, key_len);
+    memcpy(buf + pos, key, key_len);
     pos += key_len;
 
     /* list_len */
@@ -69,13 +69,76 @@ off_t arrays_append_node(int fd, const arrays_node_t *node) {
 
     /* offsets array */
     for (uint32_t i = 0; i < list_len; ++i) {
-        memcpy(buf + pos, &node->offsets[i], sizeof node->offsets[i]);
-        pos += sizeof node->offsets[i];
+        uint64_t v = (uint64_t)offsets[i];
+        memcpy(buf + pos, &v, sizeof v);
+        pos += sizeof v;
     }
 
     /* next_ptr */
-    memcpy(buf + pos, &node->next_ptr, sizeof node->next_ptr);
+    uint64_t next = (uint64_t)next_ptr;
+    memcpy(buf + pos, &next, sizeof next);
     pos += sizeof(uint64_t);
+    return pos;
+}
+
+/* fixed header shared by tagged and varint nodes */
+static void put_tagged_header(unsigned char *buf, uint32_t tag, uint16_t key_len, uint32_t list_len, off_t next_ptr) {
+    uint16_t reserved = 0;
+    uint64_t next = (uint64_t)next_ptr;
+    memcpy(buf + 0, &tag, sizeof tag);
+    memcpy(buf + 4, &key_len, sizeof key_len);
+    memcpy(buf + 6, &reserved, sizeof reserved);
+    memcpy(buf + 8, &list_len, sizeof list_len);
+    memcpy(buf + ARRAYS_TAGGED_NEXT_POS, &next, sizeof next);
+}
+
+/* serialize a tagged node: fixed header, then key and offsets */
+size_t arrays_encode_tagged_node(unsigned char *buf, uint32_t tag, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len, off_t next_ptr)
+{
+    put_tagged_header(buf, tag, key_len, list_len, next_ptr);
+    size_t pos = ARRAYS_TAGGED_HDR_SIZE;
+
+    memcpy(buf + pos, key, key_len);
+    pos += key_len;
+
+    for (uint32_t i = 0; i < list_len; ++i) {
+        uint64_t v = (uint64_t)offsets[i];
+        memcpy(buf + pos, &v, sizeof v);
+        pos += sizeof v;
+    }
+    return pos;
+}
+
+/* tagged header + list_bytes, then key and the delta coded offsets */
+size_t arrays_encode_varint_node(unsigned char *buf, uint32_t tag, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len, off_t next_ptr)
+{
+    put_tagged_header(buf, tag, key_len, list_len, next_ptr);
+    size_t pos = ARRAYS_VARINT_HDR_SIZE;
+
+    memcpy(buf + pos, key, key_len);
+    pos += key_len;
+
+    uint32_t list_bytes = (uint32_t)varint_delta_encode(buf + pos, offsets, list_len);
+    memcpy(buf + ARRAYS_TAGGED_HDR_SIZE, &list_bytes, sizeof list_bytes);
+    return pos + list_bytes;
+}
+
+/* append node: serialize into a buffer then write at EOF */
+off_t arrays_append_node(int fd, const arrays_node_t *node) {
+    if (!node || !node->key) return 0;
+    uint16_t key_len = (uint16_t)strlen(node->key);
+    if ((size_t)key_len != strlen(node->key)) {
+        /* key too long for uint16 */
+        return 0;
+    }
+    uint32_t list_len = node->list_len;
+
+    size_t node_size = arrays_calc_node_size(key_len, list_len);
+    unsigned char *buf = malloc(node_size);
+    if (!buf) return 0;
+    arrays_encode_node(buf, node->key, key_len, node->offsets, list_len, node->next_ptr);
 
     /* compute offset at EOF */
     off_t new_off = lseek(fd, 0, SEEK_END);
@@ -96,68 +159,292 @@ off_t arrays_append_node(int fd, const arrays_node_t *node) {
     return (off_t)new_off;
 }
 
-// reads the node data in an offset to a struct (arrays_node_t)
-int arrays_read_node_full(int fd, off_t node_off, arrays_node_t *node) {
-    if (!node) return -1;
+/* decode a node from memory without copying anything */
+int arrays_view_decode(const unsigned char *buf, size_t len, arrays_node_view_t *view) {
+    if (!buf || !view) return -1;
+    view->node_size = 0;
+    size_t pos = 0;
+
     uint16_t key_len;
-    if (safe_pread(fd, &key_len, sizeof(uint16_t), node_off) != (ssize_t)sizeof(uint16_t)) return -1;
-
-    /* read key bytes and list_len (key_len + sizeof(list_len)) */
-    size_t head_read = (size_t)key_len + sizeof(uint32_t);
-    unsigned char *headbuf = malloc(head_read);
-    if (!headbuf) return -1;
-    if (safe_pread(fd, headbuf, head_read, node_off + sizeof(uint16_t)) != (ssize_t)head_read) {
-        free(headbuf);
+    if (len < sizeof(uint16_t)) return 1;
+    memcpy(&key_len, buf, sizeof key_len);
+    pos += sizeof(uint16_t);
+
+    if (len < pos + key_len + sizeof(uint32_t)) return 1;
+    const char *key = (const char *)buf + pos;
+    pos += key_len;
+
+    uint32_t list_len;
+    memcpy(&list_len, buf + pos, sizeof list_len);
+    pos += sizeof(uint32_t);
+
+    size_t node_size = arrays_calc_node_size(key_len, list_len);
+    view->node_size = node_size;
+    if (len < node_size) return 1;
+
+    uint64_t next;
+    memcpy(&next, buf + node_size - sizeof(uint64_t), sizeof next);
+
+    view->key_len = key_len;
+    view->key = key;
+    view->list_len = list_len;
+    view->offsets = buf + pos;
+    view->next_ptr = (off_t)next;
+    view->tag = 0;
+    view->list_bytes = list_len * (uint32_t)sizeof(uint64_t);
+    view->varint = 0;
+    return 0;
+}
+
+int arrays_view_decode_tagged(const unsigned char *buf, size_t len, arrays_node_view_t *view) {
+    if (!buf || !view) return -1;
+    view->node_size = 0;
+    if (len < ARRAYS_TAGGED_HDR_SIZE) return 1;
+
+    uint64_t next;
+    memcpy(&view->tag, buf + 0, sizeof view->tag);
+    memcpy(&view->key_len, buf + 4, sizeof view->key_len);
+    memcpy(&view->list_len, buf + 8, sizeof view->list_len);
+    memcpy(&next, buf + ARRAYS_TAGGED_NEXT_POS, sizeof next);
+    view->next_ptr = (off_t)next;
+    view->list_bytes = view->list_len * (uint32_t)sizeof(uint64_t);
+    view->varint = 0;
+    view->node_size = arrays_calc_tagged_node_size(view->key_len, view->list_len);
+    if (len < view->node_size) return 1;
+
+    view->key = (const char *)buf + ARRAYS_TAGGED_HDR_SIZE;
+    view->offsets = buf + ARRAYS_TAGGED_HDR_SIZE + view->key_len;
+    return 0;
+}
+
+int arrays_view_decode_varint(const unsigned char *buf, size_t len, arrays_node_view_t *view) {
+    if (!buf || !view) return -1;
+    view->node_size = 0;
+    if (len < ARRAYS_VARINT_HDR_SIZE) return 1;
+    arrays_view_decode_tagged(buf, ARRAYS_TAGGED_HDR_SIZE, view);
+    memcpy(&view->list_bytes, buf + ARRAYS_TAGGED_HDR_SIZE, sizeof view->list_bytes);
+    view->varint = 1;
+    view->node_size = arrays_calc_varint_node_size(view->key_len, view->list_bytes);
+    if (len < view->node_size) return 1;
+
+    view->key = (const char *)buf + ARRAYS_VARINT_HDR_SIZE;
+    view->offsets = buf + ARRAYS_VARINT_HDR_SIZE + view->key_len;
+    return 0;
+}
+
+void arrays_offset_iter_init(arrays_offset_iter_t *it, const arrays_node_view_t *view) {
+    it->view = view;
+    it->p = view->offsets;
+    it->done = 0;
+    it->prev = 0;
+}
+
+int arrays_offset_iter_next(arrays_offset_iter_t *it, uint64_t *out, uint32_t max) {
+    const arrays_node_view_t *view = it->view;
+    uint32_t n = view->list_len - it->done;
+    if (n > max) n = max;
+    if (n == 0) return 0;
+    if (view->varint) {
+        const unsigned char *end = view->offsets + view->list_bytes;
+        if (varint_delta_decode(&it->p, end, &it->prev, out, n) != n) return -1;
+    } else {
+        memcpy(out, it->p, (size_t)n * sizeof(uint64_t));
+        it->p += (size_t)n * sizeof(uint64_t);
+    }
+    it->done += n;
+    return (int)n;
+}
+
+void arrays_cursor_init(arrays_cursor_t *cur, int fd, const unsigned char *map, size_t map_len,
+    off_t head, uint16_t flags)
+{
+    cur->fd = fd;
+    cur->tagged = (flags & INDEX_FLAG_TAGGED) != 0;
+    cur->varint = cur->tagged && (flags & INDEX_FLAG_VARINT) != 0;
+    cur->match_tag = 0;
+    cur->tag = 0;
+    cur->mem = map;
+    cur->mem_off = 0;
+    cur->mem_len = map ? map_len : 0;
+    cur->mem_owned = 0;
+    cur->ext_off = 0;
+    cur->ext_end = 0;
+    cur->next = head;
+    cur->cache = NULL;
+    cur->big = NULL;
+    cur->big_cap = 0;
+}
+
+void arrays_cursor_set_cache(arrays_cursor_t *cur, bcache_t *cache) {
+    cur->cache = cache;
+}
+
+void arrays_cursor_match_tag(arrays_cursor_t *cur, uint32_t tag) {
+    if (!cur->tagged) return;
+    cur->match_tag = 1;
+    cur->tag = tag;
+}
+
+static int cursor_decode(const arrays_cursor_t *cur, const unsigned char *buf, size_t len, arrays_node_view_t *view) {
+    if (cur->varint) return arrays_view_decode_varint(buf, len, view);
+    return cur->tagged ? arrays_view_decode_tagged(buf, len, view) : arrays_view_decode(buf, len, view);
+}
+
+/* the decoded header says the node can be stepped over */
+static int cursor_skips(const arrays_cursor_t *cur, const arrays_node_view_t *view) {
+    return cur->match_tag && view->node_size != 0 && view->tag != cur->tag;
+}
+
+static ssize_t cursor_pread(const arrays_cursor_t *cur, void *buf, size_t len, off_t off) {
+    return cur->cache ? bcache_pread(cur->cache, cur->fd, buf, len, off) : safe_pread(cur->fd, buf, len, off);
+}
+
+/* make sure big can hold need bytes */
+static unsigned char *cursor_big(arrays_cursor_t *cur, size_t need) {
+    if (need > cur->big_cap) {
+        unsigned char *tmp = realloc(cur->big, need);
+        if (!tmp) return NULL;
+        cur->big = tmp;
+        cur->big_cap = need;
+    }
+    return cur->big;
+}
+
+/* load the part of the extent starting at off into the window */
+static int cursor_fill(arrays_cursor_t *cur, off_t off) {
+    size_t len = (size_t)(cur->ext_end - off);
+    if (len > ARRAYS_VIEW_WINDOW) len = ARRAYS_VIEW_WINDOW;
+    ssize_t r = cursor_pread(cur, cur->window, len, off);
+    if (r <= 0) return -1;
+    cur->mem = cur->window;
+    cur->mem_off = off;
+    cur->mem_len = (size_t)r;
+    cur->mem_owned = 1;
+    return 0;
+}
+
+int arrays_cursor_load(arrays_cursor_t *cur, off_t off, size_t len) {
+    if (!cur || cur->fd < 0 || len == 0) return -1;
+    cur->ext_off = off;
+    cur->ext_end = off + (off_t)len;
+    if (cursor_fill(cur, off) != 0) {
+        cur->ext_off = cur->ext_end = 0;
         return -1;
     }
+    return 0;
+}
 
-    /* allocate key (NUL-terminated) */
-    char *key = malloc((size_t)key_len + 1);
-    if (!key) { free(headbuf); return -1; }
-    memcpy(key, headbuf, key_len);
-    key[key_len] = '\0';
+/* the node at off runs need bytes: 0 if that fits in the file */
+static int cursor_node_fits(const arrays_cursor_t *cur, off_t off, size_t need) {
+    struct stat st;
+    if (fstat(cur->fd, &st) != 0 || off > st.st_size) return -1;
+    return need <= (uint64_t)(st.st_size - off) ? 0 : -1;
+}
 
-    uint32_t list_len;
-    memcpy(&list_len, headbuf + key_len, sizeof list_len);
-    free(headbuf);
-
-    /* read offsets and next_ptr */
-    size_t rest_bytes = (size_t)list_len * sizeof(uint64_t) + sizeof(uint64_t);
-    unsigned char *restbuf = NULL;
-    if (rest_bytes > 0) {
-        restbuf = malloc(rest_bytes);
-        if (!restbuf) { free(key); return -1; }
-        if (safe_pread(fd, restbuf, rest_bytes, node_off + sizeof(uint16_t) + key_len + sizeof(uint32_t)) != (ssize_t)rest_bytes) {
-            free(key); free(restbuf); return -1;
+/* one pread of a whole window; only nodes bigger than the window need another */
+static int cursor_pread_node(arrays_cursor_t *cur, off_t off, arrays_node_view_t *view) {
+    unsigned char *buf = cur->window;
+    size_t want = ARRAYS_VIEW_WINDOW;
+    int rc;
+    while (1) {
+        ssize_t r = cursor_pread(cur, buf, want, off);
+        if (r < 0) return -1;
+        rc = cursor_decode(cur, buf, (size_t)r, view);
+        if (rc == 1 && cursor_skips(cur, view)) return 0; /* header only: no second read */
+        if (rc != 1 || (size_t)r < want) break; /* decoded, corrupt, or truncated file */
+
+        size_t need = view->node_size;
+        if (need == 0) {
+            if (cur->tagged) return -1;
+            /* not even list_len fitted: read up to it first */
+            uint16_t key_len;
+            memcpy(&key_len, buf, sizeof key_len);
+            need = sizeof(uint16_t) + (size_t)key_len + sizeof(uint32_t);
         }
-    } else {
-        restbuf = malloc(sizeof(uint64_t));
-        if (!restbuf) { free(key); return -1; }
-        if (safe_pread(fd, restbuf, sizeof(uint64_t), node_off + sizeof(uint16_t) + key_len + sizeof(uint32_t)) != (ssize_t)sizeof(uint64_t)) {
-            free(key); free(restbuf); return -1;
+        if (need <= want) return -1;
+        /* a corrupt header must not size the buffer past the file */
+        if (cursor_node_fits(cur, off, need) != 0) return -1;
+        buf = cursor_big(cur, need);
+        if (!buf) return -1;
+        want = need;
+    }
+    return rc;
+}
+
+int arrays_cursor_next(arrays_cursor_t *cur, arrays_node_view_t *view) {
+    if (!cur || !view) return -1;
+    while (1) {
+        off_t off = cur->next;
+        if (off == 0) return 0;
+        if (off < (off_t)ARRAYS_HEADER_SIZE) return -1;
+
+        int rc = 1;
+        int in_mem = cur->mem && off >= cur->mem_off && (size_t)(off - cur->mem_off) < cur->mem_len;
+        if (in_mem) {
+            size_t rel = (size_t)(off - cur->mem_off);
+            rc = cursor_decode(cur, cur->mem + rel, cur->mem_len - rel, view);
+            if (rc == 1 && cursor_skips(cur, view)) rc = 0;
+        }
+        if (rc == 1 && off >= cur->ext_off && off < cur->ext_end && !(in_mem && off == cur->mem_off)) {
+            /* the window moves on along the extent, starting at this node */
+            if (cursor_fill(cur, off) != 0) return -1;
+            rc = cursor_decode(cur, cur->mem, cur->mem_len, view);
+            if (rc == 1 && cursor_skips(cur, view)) rc = 0;
         }
+        if (rc == 1) {
+            /* a mapping covers the whole file, so only a loaded extent may fall back to pread */
+            if (cur->mem && !cur->mem_owned) return -1;
+            if (cur->fd < 0) return -1;
+            cur->mem = NULL; /* the read below reuses the window holding the extent */
+            rc = cursor_pread_node(cur, off, view);
+        }
+        if (rc != 0) return -1;
+        cur->next = view->next_ptr;
+        if (!cursor_skips(cur, view)) return 1;
     }
+}
+
+void arrays_cursor_release(arrays_cursor_t *cur) {
+    if (!cur) return;
+    free(cur->big);
+    cur->big = NULL;
+    cur->big_cap = 0;
+    cur->next = 0;
+}
+
+// reads the node data in an offset to a struct (arrays_node_t)
+int arrays_read_node_full(int fd, off_t node_off, arrays_node_t *node) {
+    if (!node) return -1;
+    arrays_cursor_t cur;
+    arrays_node_view_t view;
+    arrays_cursor_init(&cur, fd, NULL, 0, node_off, 0);
+    if (arrays_cursor_next(&cur, &view) != 1) {
+        arrays_cursor_release(&cur);
+        return -1;
+    }
+
+    /* allocate key (NUL-terminated) */
+    char *key = malloc((size_t)view.key_len + 1);
+    if (!key) { arrays_cursor_release(&cur); return -1; }
+    memcpy(key, view.key, view.key_len);
+    key[view.key_len] = '\0';
 
     off_t *offsets = NULL;
-    if (list_len > 0) {
-        offsets = malloc(sizeof(off_t) * list_len);
-        if (!offsets) { free(key); free(restbuf); return -1; }
-        for (uint32_t i = 0; i < list_len; ++i) {
-            memcpy(&offsets[i], restbuf + (size_t)i * 8, sizeof offsets[i]);
+    if (view.list_len > 0) {
+        offsets = malloc(sizeof(off_t) * view.list_len);
+        if (!offsets) { free(key); arrays_cursor_release(&cur); return -1; }
+        for (uint32_t i = 0; i < view.list_len; ++i) {
+            offsets[i] = arrays_view_offset(&view, i);
         }
     }
-
-    uint64_t tmp;
-    memcpy(&tmp, restbuf + (size_t)list_len * sizeof(uint64_t), sizeof tmp);
-    off_t next = (off_t)tmp;
-    free(restbuf);
+    arrays_cursor_release(&cur);
 
     /* fill node struct */
-    node->key_len = key_len;
+    node->key_len = view.key_len;
     node->key = key;
-    node->list_len = list_len;
+    node->list_len = view.list_len;
     node->offsets = offsets;
-    node->next_ptr = next;
+    node->next_ptr = view.next_ptr;
     return 0;
 }
 
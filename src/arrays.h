@@ -2,7 +2,9 @@
 #define ARRAYS_H
 
 #include <stdint.h>
+#include <string.h>
 #include "common.h"
+#include "bcache.h"
 
 /* arrays.h
  *
@@ -18,8 +20,26 @@
  * The file begins with a fixed-size header of ARRAYS_HEADER_SIZE bytes (reserved area).
  * Nodes should start at offsets >= ARRAYS_HEADER_SIZE; offset 0 is reserved/sentinel.
  *
+ * Indices with INDEX_FLAG_TAGGED use tagged nodes instead, with every fixed
+ * field in front so a node can be skipped from its first ARRAYS_TAGGED_HDR_SIZE bytes:
+ * - tag       : uint32  (4 bytes)   -> hash_tag() of the key hash
+ * - key_len   : uint16  (2 bytes)
+ * - reserved  : uint16  (2 bytes)   -> 0
+ * - list_len  : uint32  (4 bytes)
+ * - next_ptr  : uint64  (8 bytes)
+ * - key_bytes : key_len bytes
+ * - offsets[] : uint64 * list_len
+ *
+ * With INDEX_FLAG_VARINT as well, the tagged header is followed by
+ * - list_bytes: uint32  (4 bytes)   -> size of the encoded offsets
+ * and offsets[] holds the offsets sorted and delta + LEB128 coded (varint.h),
+ * list_bytes bytes in total.
  */
 
+#define ARRAYS_TAGGED_HDR_SIZE 20
+#define ARRAYS_TAGGED_NEXT_POS 12 // where next_ptr lives inside a tagged node
+#define ARRAYS_VARINT_HDR_SIZE 24
+
 typedef struct {
     uint16_t key_len;         
     char *key;           // key (string) of the node (title/author)
@@ -28,6 +48,64 @@ typedef struct {
     off_t next_ptr;   // next pointer to manage collisions (hash table implemented by chaining)
 } arrays_node_t;
 
+/* Zero-copy view of a node: key and offsets point into the buffer (or mapping)
+ * the node was decoded from and are only valid while that memory is.
+ * key is NOT NUL-terminated, offsets are read with an arrays_offset_iter_t
+ * (or arrays_view_offset when the node is not varint coded).
+ */
+typedef struct {
+    uint16_t key_len;
+    const char *key;
+    uint32_t list_len;
+    const unsigned char *offsets;  // list_len raw uint64 values, or list_bytes of varints
+    off_t next_ptr;
+    size_t node_size;              // bytes taken by the node on disk
+    uint32_t tag;                  // tagged nodes only, 0 otherwise
+    uint32_t list_bytes;           // bytes at offsets
+    int varint;                    // offsets are delta + varint coded
+} arrays_node_view_t;
+
+/* Sequential reader of the offsets of a view, for every layout */
+typedef struct {
+    const arrays_node_view_t *view;
+    const unsigned char *p;
+    uint32_t done;
+    uint64_t prev;
+} arrays_offset_iter_t;
+
+/* bytes read speculatively per node, enough for any node with a short key and
+   a few hundred offsets; bigger nodes need a second read */
+#define ARRAYS_VIEW_WINDOW 4096
+
+/* Chain cursor: walks next_ptr starting at a bucket head, either over memory
+ * holding part of the file (a mapping of the whole arrays file, or an extent
+ * loaded with arrays_cursor_load, one window at a time) or with one pread per
+ * node into the embedded window. No heap allocation unless a single node does
+ * not fit in the window: big is then grown to hold it, and freed by
+ * arrays_cursor_release.
+ * A view is only valid until the next call on the cursor.
+ * With a tag set (arrays_cursor_match_tag, tagged layouts) nodes carrying any
+ * other tag are stepped over from their header alone.
+ */
+typedef struct {
+    int fd;
+    int tagged;                // nodes use the tagged layout
+    int varint;                // ... with varint coded offsets
+    int match_tag;             // only return nodes whose tag is tag
+    uint32_t tag;
+    const unsigned char *mem;  // bytes [mem_off, mem_off + mem_len) of the file, or NULL
+    off_t mem_off;
+    size_t mem_len;
+    int mem_owned;             // mem is the window (loaded extent), not a mapping
+    off_t ext_off;             // extent given to arrays_cursor_load, [ext_off, ext_end)
+    off_t ext_end;
+    off_t next;
+    bcache_t *cache;           // reads go through it when set (arrays_cursor_set_cache)
+    unsigned char window[ARRAYS_VIEW_WINDOW];
+    unsigned char *big;
+    size_t big_cap;
+} arrays_cursor_t;
+
 /* create an empty arrays file with header space reserved */
 int arrays_create(const char *path);
 
@@ -37,12 +115,84 @@ int arrays_open(const char *path);
 /* appends a node and return offset where node starts (absolute offset in arrays.dat) */
 off_t arrays_append_node(int fd, const arrays_node_t *node);
 
-/* read a node fully: caller must free key_out and offsets_out */
+/* serialize a node into buf (arrays_calc_node_size(key_len, list_len) bytes), returns bytes written */
+size_t arrays_encode_node(unsigned char *buf, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len, off_t next_ptr);
+
+/* read a node (untagged layout) fully: caller must free key_out and offsets_out */
 int arrays_read_node_full(int fd, off_t node_off, arrays_node_t *node);
 
 /* returns the size of a node with a key (string) of size key_len, and a list of offsets of size list_len */
 size_t arrays_calc_node_size(uint16_t key_len, uint32_t list_len);
 
+/* same for a tagged node */
+size_t arrays_calc_tagged_node_size(uint16_t key_len, uint32_t list_len);
+
+/* same for a varint node whose offsets take list_bytes once encoded */
+size_t arrays_calc_varint_node_size(uint16_t key_len, uint32_t list_bytes);
+
+/* serialize a varint node into buf (arrays_calc_varint_node_size bytes with
+   list_bytes = varint_delta_size(offsets, list_len)); offsets must be sorted.
+   returns bytes written */
+size_t arrays_encode_varint_node(unsigned char *buf, uint32_t tag, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len, off_t next_ptr);
+
+/* serialize a tagged node into buf (arrays_calc_tagged_node_size bytes), returns bytes written */
+size_t arrays_encode_tagged_node(unsigned char *buf, uint32_t tag, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len, off_t next_ptr);
+
 void arrays_free_node(arrays_node_t *node);
 
+/* decode the node at the start of buf (len bytes available).
+   returns 0 on success, 1 if len is too short (view->node_size is then set
+   when the header could be decoded, 0 otherwise), -1 on NULL arguments.
+   node_size comes from the header as stored: a corrupt one only shows as a
+   node running past the data, which callers check against the file */
+int arrays_view_decode(const unsigned char *buf, size_t len, arrays_node_view_t *view);
+
+/* same for a tagged node; when only the header fits (return 1) tag, key_len,
+   list_len, next_ptr and node_size are already set */
+int arrays_view_decode_tagged(const unsigned char *buf, size_t len, arrays_node_view_t *view);
+
+/* same for a varint node (same partial decode as a tagged one) */
+int arrays_view_decode_varint(const unsigned char *buf, size_t len, arrays_node_view_t *view);
+
+/* start reading the offsets of view, in stored order (ascending for varint nodes) */
+void arrays_offset_iter_init(arrays_offset_iter_t *it, const arrays_node_view_t *view);
+
+/* decode up to max following offsets into out.
+   returns how many, 0 once all were read, -1 on a corrupt list */
+int arrays_offset_iter_next(arrays_offset_iter_t *it, uint64_t *out, uint32_t max);
+
+/* i-th offset of a node view (not varint coded) */
+static inline off_t arrays_view_offset(const arrays_node_view_t *view, uint32_t i) {
+    uint64_t v;
+    memcpy(&v, view->offsets + (size_t)i * sizeof(uint64_t), sizeof v);
+    return (off_t)v;
+}
+
+/* start a chain walk at head (map may be NULL to use pread on fd).
+   flags are the index layout flags, only INDEX_FLAG_TAGGED and
+   INDEX_FLAG_VARINT matter here */
+void arrays_cursor_init(arrays_cursor_t *cur, int fd, const unsigned char *map, size_t map_len,
+    off_t head, uint16_t flags);
+
+/* read through a block cache instead of plain pread (NULL to stop) */
+void arrays_cursor_set_cache(arrays_cursor_t *cur, bcache_t *cache);
+
+/* tagged layouts: skip every node whose tag is not tag */
+void arrays_cursor_match_tag(arrays_cursor_t *cur, uint32_t tag);
+
+/* walk the extent [off, off + len) in window sized preads: nodes inside the
+   window are decoded from memory, and the window moves on to the first node
+   past it (used for the contiguous chains of clustered indices) */
+int arrays_cursor_load(arrays_cursor_t *cur, off_t off, size_t len);
+
+/* decode the next node of the chain into view.
+   returns 1 when a node was produced, 0 at the end of the chain, -1 on error */
+int arrays_cursor_next(arrays_cursor_t *cur, arrays_node_view_t *view);
+
+/* release the overflow buffer (if any) */
+void arrays_cursor_release(arrays_cursor_t *cur);
+
 #endif // ARRAYS_H
@@ -0,0 +1,202 @@
+#include "bcache.h"
+#include "common.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* longest run of missing blocks read with one pread, into a stack buffer */
+#define BCACHE_MAX_RUN 8
+
+static uint64_t block_hash(int fd, uint64_t block) {
+    uint64_t h = block * 0x9e3779b97f4a7c15ULL ^ (uint64_t)(uint32_t)fd * 0xc2b2ae3d27d4eb4fULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static int shard_init(bcache_shard_t *s, uint32_t nframes) {
+    uint32_t slots = (uint32_t)next_pow2(nframes);
+    s->frames = malloc((size_t)nframes * sizeof *s->frames);
+    s->data = malloc((size_t)nframes * BCACHE_BLOCK);
+    s->table = malloc((size_t)slots * sizeof *s->table);
+    if (!s->frames || !s->data || !s->table) return -1;
+    for (uint32_t i = 0; i < nframes; ++i) {
+        s->frames[i].fd = -1;
+        s->frames[i].hnext = -1;
+        s->frames[i].ref = 0;
+    }
+    for (uint32_t i = 0; i < slots; ++i) s->table[i] = -1;
+    s->table_mask = slots - 1;
+    s->nframes = nframes;
+    pthread_mutex_init(&s->lock, NULL);
+    return 0;
+}
+
+int bcache_init(bcache_t *c, size_t bytes) {
+    memset(c, 0, sizeof *c);
+    size_t blocks = bytes / BCACHE_BLOCK;
+    uint32_t nshards = BCACHE_SHARDS;
+    while (nshards > 1 && blocks < nshards) nshards >>= 1;
+    if (blocks < nshards) blocks = nshards;
+    if (blocks / nshards > INT32_MAX) return -1;
+
+    c->shards = calloc(nshards, sizeof *c->shards);
+    if (!c->shards) return -1;
+    c->nshards = nshards;
+    for (uint32_t i = 0; i < nshards; ++i) {
+        if (shard_init(&c->shards[i], (uint32_t)(blocks / nshards)) != 0) {
+            bcache_free(c);
+            return -1;
+        }
+    }
+    c->capacity = (blocks / nshards) * nshards * BCACHE_BLOCK;
+    return 0;
+}
+
+void bcache_free(bcache_t *c) {
+    if (!c || !c->shards) return;
+    for (uint32_t i = 0; i < c->nshards; ++i) {
+        bcache_shard_t *s = &c->shards[i];
+        /* a shard that failed to allocate has nframes still 0 and no lock */
+        if (s->nframes) pthread_mutex_destroy(&s->lock);
+        free(s->frames);
+        free(s->data);
+        free(s->table);
+    }
+    free(c->shards);
+    c->shards = NULL;
+    c->nshards = 0;
+}
+
+static bcache_shard_t *shard_of(bcache_t *c, uint64_t h) {
+    return &c->shards[(uint32_t)(h >> 32) & (c->nshards - 1)];
+}
+
+static int32_t shard_find(const bcache_shard_t *s, uint64_t h, int fd, uint64_t block) {
+    int32_t i = s->table[h & s->table_mask];
+    while (i >= 0 && !(s->frames[i].fd == fd && s->frames[i].block == block)) i = s->frames[i].hnext;
+    return i;
+}
+
+/* CLOCK: clear reference bits until a frame without one comes under the hand,
+   unlink it and hand it out */
+static int32_t shard_victim(bcache_shard_t *s) {
+    while (1) {
+        int32_t i = (int32_t)s->hand;
+        bcache_frame_t *f = &s->frames[i];
+        s->hand = s->hand + 1 == s->nframes ? 0 : s->hand + 1;
+        if (f->fd < 0) return i;
+        if (f->ref) {
+            f->ref = 0;
+            continue;
+        }
+        int32_t *pp = &s->table[block_hash(f->fd, f->block) & s->table_mask];
+        while (*pp != i) pp = &s->frames[*pp].hnext;
+        *pp = f->hnext;
+        f->fd = -1;
+        s->evictions++;
+        return i;
+    }
+}
+
+/* copy what the cached block holds from in onwards. returns the bytes copied,
+   or -1 on a miss; *eof tells that the block ends the file */
+static ssize_t copy_cached(bcache_t *c, int fd, uint64_t block, size_t in,
+    unsigned char *dst, size_t len, int *eof)
+{
+    uint64_t h = block_hash(fd, block);
+    bcache_shard_t *s = shard_of(c, h);
+    pthread_mutex_lock(&s->lock);
+    int32_t i = shard_find(s, h, fd, block);
+    if (i < 0) {
+        s->misses++;
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+    bcache_frame_t *f = &s->frames[i];
+    size_t n = 0;
+    if (in < f->len) {
+        n = f->len - in < len ? f->len - in : len;
+        memcpy(dst, s->data + (size_t)i * BCACHE_BLOCK + in, n);
+    }
+    *eof = f->len < BCACHE_BLOCK;
+    f->ref = 1;
+    s->hits++;
+    pthread_mutex_unlock(&s->lock);
+    return (ssize_t)n;
+}
+
+static void insert_block(bcache_t *c, int fd, uint64_t block, const unsigned char *src, size_t len) {
+    uint64_t h = block_hash(fd, block);
+    bcache_shard_t *s = shard_of(c, h);
+    pthread_mutex_lock(&s->lock);
+    /* another thread may have loaded it meanwhile */
+    int32_t i = shard_find(s, h, fd, block);
+    if (i < 0) {
+        i = shard_victim(s);
+        bcache_frame_t *f = &s->frames[i];
+        f->fd = fd;
+        f->block = block;
+        f->ref = 0; /* a second use earns the bit, one-off reads go first */
+        f->hnext = s->table[h & s->table_mask];
+        s->table[h & s->table_mask] = i;
+    }
+    s->frames[i].len = (uint32_t)len;
+    memcpy(s->data + (size_t)i * BCACHE_BLOCK, src, len);
+    pthread_mutex_unlock(&s->lock);
+}
+
+ssize_t bcache_pread(bcache_t *c, int fd, void *buf, size_t len, off_t off) {
+    if (off < 0) return -1;
+    if (len == 0) return 0;
+    /* reads about the size of the cache would only flush it */
+    if (len > c->capacity / 4) return safe_pread(fd, buf, len, off);
+
+    unsigned char *dst = buf;
+    size_t done = 0;
+    uint64_t last = ((uint64_t)off + len - 1) / BCACHE_BLOCK;
+    while (done < len) {
+        uint64_t pos = (uint64_t)off + done;
+        uint64_t block = pos / BCACHE_BLOCK;
+        size_t in = (size_t)(pos % BCACHE_BLOCK);
+        int eof = 0;
+        ssize_t n = copy_cached(c, fd, block, in, dst + done, len - done, &eof);
+        if (n >= 0) {
+            done += (size_t)n;
+            if (eof) break;
+            continue;
+        }
+
+        /* the rest of the request, in one read (blocks of it that were cached
+           are simply refreshed) */
+        uint64_t run = last - block + 1;
+        if (run > BCACHE_MAX_RUN) run = BCACHE_MAX_RUN;
+        unsigned char tmp[BCACHE_MAX_RUN * BCACHE_BLOCK];
+        ssize_t r = safe_pread(fd, tmp, (size_t)run * BCACHE_BLOCK, (off_t)(block * BCACHE_BLOCK));
+        if (r < 0) return -1;
+        for (uint64_t k = 0; k < run && (size_t)r > k * BCACHE_BLOCK; ++k) {
+            size_t blen = (size_t)r - k * BCACHE_BLOCK;
+            insert_block(c, fd, block + k, tmp + k * BCACHE_BLOCK, blen < BCACHE_BLOCK ? blen : BCACHE_BLOCK);
+        }
+        size_t got = (size_t)r > in ? (size_t)r - in : 0;
+        if (got > len - done) got = len - done;
+        memcpy(dst + done, tmp + in, got);
+        done += got;
+        if ((size_t)r < run * BCACHE_BLOCK) break;
+    }
+    return (ssize_t)done;
+}
+
+void bcache_get_stats(bcache_t *c, bcache_stats_t *out) {
+    memset(out, 0, sizeof *out);
+    for (uint32_t i = 0; i < c->nshards; ++i) {
+        bcache_shard_t *s = &c->shards[i];
+        pthread_mutex_lock(&s->lock);
+        out->hits += s->hits;
+        out->misses += s->misses;
+        out->evictions += s->evictions;
+        pthread_mutex_unlock(&s->lock);
+    }
+    out->capacity = c->capacity;
+}
@@ -0,0 +1,72 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* bcache.h
+ *
+ * Block cache for the pread mode of an index: buckets.dat and arrays.dat are
+ * read in aligned BCACHE_BLOCK pages kept in user memory, so hot buckets and
+ * chains are served without a syscall even when the page cache is cold or
+ * the files are not mapped.
+ *
+ * Blocks are spread over BCACHE_SHARDS shards by (fd, block), each with its
+ * own lock, frames and CLOCK hand: a hit sets the frame's reference bit, the
+ * hand clears bits until it finds a frame without one and reuses it. Reads
+ * copy out of the frames under the shard lock, so nothing stays pinned.
+ */
+
+#define BCACHE_BLOCK 4096
+#define BCACHE_SHARDS 16
+
+typedef struct {
+    int fd;              // -1: free frame
+    uint32_t len;        // valid bytes, short only for the last block of a file
+    uint64_t block;
+    int32_t hnext;       // next frame in the hash chain, -1 = end
+    uint8_t ref;         // CLOCK reference bit
+} bcache_frame_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    bcache_frame_t *frames;
+    unsigned char *data;   // nframes * BCACHE_BLOCK
+    int32_t *table;        // hash heads, frame indices
+    uint32_t table_mask;
+    uint32_t nframes;
+    uint32_t hand;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} bcache_shard_t;
+
+typedef struct {
+    bcache_shard_t *shards;
+    uint32_t nshards;
+    size_t capacity;       // bytes of block data
+} bcache_t;
+
+typedef struct {
+    uint64_t hits;         // blocks served from memory
+    uint64_t misses;       // blocks read from the file
+    uint64_t evictions;
+    size_t capacity;
+} bcache_stats_t;
+
+/* cache of about bytes of block data (at least one block per shard).
+   returns 0 or -1 */
+int bcache_init(bcache_t *c, size_t bytes);
+
+void bcache_free(bcache_t *c);
+
+/* read len bytes of fd at off like pread, through the cache: runs of missing
+   blocks are read with one pread each and kept. returns the bytes read
+   (short at the end of the file) or -1 */
+ssize_t bcache_pread(bcache_t *c, int fd, void *buf, size_t len, off_t off);
+
+void bcache_get_stats(bcache_t *c, bcache_stats_t *out);
+
+#endif // BCACHE_H
@@ -0,0 +1,281 @@
+#include "bitmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint16_t key;
+    uint16_t type;
+    uint32_t card;
+    uint32_t off;
+} entry_t;
+
+/* Appends containers to a bitmap whose entry table was sized for max */
+typedef struct {
+    bitmap_t *b;
+    uint32_t n;
+    uint32_t max;
+} writer_t;
+
+static uint32_t num_containers(const unsigned char *bm, size_t len) {
+    uint32_t n;
+    if (len < sizeof n) return 0;
+    memcpy(&n, bm, sizeof n);
+    return n;
+}
+
+static void get_entry(const unsigned char *bm, uint32_t i, entry_t *e) {
+    const unsigned char *p = bm + sizeof(uint32_t) + (size_t)i * BITMAP_ENTRY_SIZE;
+    memcpy(&e->key, p, sizeof e->key);
+    memcpy(&e->type, p + 2, sizeof e->type);
+    memcpy(&e->card, p + 4, sizeof e->card);
+    memcpy(&e->off, p + 8, sizeof e->off);
+}
+
+static size_t container_size(const entry_t *e) {
+    return e->type == BITMAP_BITS ? BITMAP_WORDS * sizeof(uint64_t) : (size_t)e->card * sizeof(uint16_t);
+}
+
+static int reserve(bitmap_t *b, size_t extra) {
+    if (b->len + extra <= b->cap) return 0;
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + extra) cap *= 2;
+    unsigned char *tmp = realloc(b->buf, cap);
+    if (!tmp) return -1;
+    b->buf = tmp;
+    b->cap = cap;
+    return 0;
+}
+
+static int writer_begin(writer_t *w, bitmap_t *b, uint32_t max) {
+    w->b = b;
+    w->n = 0;
+    w->max = max;
+    b->len = 0;
+    size_t head = sizeof(uint32_t) + (size_t)max * BITMAP_ENTRY_SIZE;
+    if (reserve(b, head) != 0) return -1;
+    memset(b->buf, 0, head);
+    b->len = head;
+    return 0;
+}
+
+static int writer_add(writer_t *w, uint16_t key, uint16_t type, uint32_t card, const void *data) {
+    entry_t e = {key, type, card, (uint32_t)w->b->len};
+    size_t size = container_size(&e);
+    if (w->n == w->max || w->b->len + size > UINT32_MAX || reserve(w->b, size) != 0) return -1;
+    memcpy(w->b->buf + w->b->len, data, size);
+    w->b->len += size;
+    unsigned char *p = w->b->buf + sizeof(uint32_t) + (size_t)w->n * BITMAP_ENTRY_SIZE;
+    memcpy(p, &e.key, sizeof e.key);
+    memcpy(p + 2, &e.type, sizeof e.type);
+    memcpy(p + 4, &e.card, sizeof e.card);
+    memcpy(p + 8, &e.off, sizeof e.off);
+    w->n++;
+    return 0;
+}
+
+/* drop the unused entries of the table, moving the containers down */
+static void writer_finish(writer_t *w) {
+    bitmap_t *b = w->b;
+    size_t gap = (size_t)(w->max - w->n) * BITMAP_ENTRY_SIZE;
+    size_t data = sizeof(uint32_t) + (size_t)w->max * BITMAP_ENTRY_SIZE;
+    if (gap) {
+        memmove(b->buf + data - gap, b->buf + data, b->len - data);
+        b->len -= gap;
+        for (uint32_t i = 0; i < w->n; ++i) {
+            unsigned char *p = b->buf + sizeof(uint32_t) + (size_t)i * BITMAP_ENTRY_SIZE + 8;
+            uint32_t off;
+            memcpy(&off, p, sizeof off);
+            off -= (uint32_t)gap;
+            memcpy(p, &off, sizeof off);
+        }
+    }
+    memcpy(b->buf, &w->n, sizeof w->n);
+}
+
+/* add the low bits of a container of card rows, as an array or as bits */
+static int add_lows(writer_t *w, uint16_t key, const uint16_t *lows, uint32_t card) {
+    if (card <= BITMAP_ARRAY_MAX) return writer_add(w, key, BITMAP_ARRAY, card, lows);
+    uint64_t words[BITMAP_WORDS] = {0};
+    for (uint32_t i = 0; i < card; ++i) words[lows[i] >> 6] |= 1ULL << (lows[i] & 63);
+    return writer_add(w, key, BITMAP_BITS, card, words);
+}
+
+int bitmap_build(bitmap_t *out, const uint32_t *rows, size_t n) {
+    uint32_t groups = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (i == 0 || (rows[i] >> 16) != (rows[i - 1] >> 16)) groups++;
+    }
+    writer_t w;
+    if (writer_begin(&w, out, groups) != 0) return -1;
+    uint16_t *lows = malloc(65536 * sizeof *lows);
+    if (!lows) return -1;
+    for (size_t i = 0; i < n;) {
+        uint32_t key = rows[i] >> 16, card = 0;
+        while (i < n && (rows[i] >> 16) == key) lows[card++] = (uint16_t)rows[i++];
+        if (add_lows(&w, (uint16_t)key, lows, card) != 0) {
+            free(lows);
+            return -1;
+        }
+    }
+    free(lows);
+    writer_finish(&w);
+    return 0;
+}
+
+int bitmap_copy(bitmap_t *out, const unsigned char *bm, size_t len) {
+    if (bitmap_check(bm, len) != 0) return -1;
+    out->len = 0;
+    if (reserve(out, len) != 0) return -1;
+    memcpy(out->buf, bm, len);
+    out->len = len;
+    return 0;
+}
+
+static uint16_t array_at(const unsigned char *c, uint32_t i) {
+    uint16_t v;
+    memcpy(&v, c + (size_t)i * sizeof v, sizeof v);
+    return v;
+}
+
+static int bits_test(const unsigned char *c, uint16_t low) {
+    uint64_t word;
+    memcpy(&word, c + (size_t)(low >> 6) * sizeof word, sizeof word);
+    return (word >> (low & 63)) & 1;
+}
+
+/* intersect two containers into w (nothing is added when empty) */
+static int and_containers(writer_t *w, uint16_t key, const entry_t *ea, const unsigned char *ca,
+    const entry_t *eb, const unsigned char *cb)
+{
+    uint16_t lows[BITMAP_ARRAY_MAX];
+    uint32_t card = 0;
+    if (ea->type == BITMAP_BITS && eb->type == BITMAP_BITS) {
+        uint64_t words[BITMAP_WORDS];
+        for (uint32_t i = 0; i < BITMAP_WORDS; ++i) {
+            uint64_t x, y;
+            memcpy(&x, ca + (size_t)i * sizeof x, sizeof x);
+            memcpy(&y, cb + (size_t)i * sizeof y, sizeof y);
+            words[i] = x & y;
+            card += (uint32_t)__builtin_popcountll(words[i]);
+        }
+        if (card > BITMAP_ARRAY_MAX) return writer_add(w, key, BITMAP_BITS, card, words);
+        card = 0;
+        for (uint32_t i = 0; i < BITMAP_WORDS; ++i) {
+            for (uint64_t word = words[i]; word; word &= word - 1) {
+                lows[card++] = (uint16_t)(i * 64 + (uint32_t)__builtin_ctzll(word));
+            }
+        }
+    } else if (ea->type == BITMAP_BITS || eb->type == BITMAP_BITS) {
+        /* the array (at most BITMAP_ARRAY_MAX rows) filtered by the bits */
+        const entry_t *ar = ea->type == BITMAP_BITS ? eb : ea;
+        const unsigned char *arc = ea->type == BITMAP_BITS ? cb : ca;
+        const unsigned char *bits = ea->type == BITMAP_BITS ? ca : cb;
+        for (uint32_t i = 0; i < ar->card; ++i) {
+            uint16_t v = array_at(arc, i);
+            if (bits_test(bits, v)) lows[card++] = v;
+        }
+    } else {
+        uint32_t i = 0, j = 0;
+        while (i < ea->card && j < eb->card) {
+            uint16_t x = array_at(ca, i), y = array_at(cb, j);
+            if (x < y) {
+                i++;
+            } else if (y < x) {
+                j++;
+            } else {
+                lows[card++] = x;
+                i++;
+                j++;
+            }
+        }
+    }
+    return card ? writer_add(w, key, BITMAP_ARRAY, card, lows) : 0;
+}
+
+int bitmap_and(bitmap_t *out, const unsigned char *a, size_t a_len, const unsigned char *b, size_t b_len) {
+    if (bitmap_check(a, a_len) != 0 || bitmap_check(b, b_len) != 0) return -1;
+    uint32_t na = num_containers(a, a_len), nb = num_containers(b, b_len);
+    writer_t w;
+    if (writer_begin(&w, out, na < nb ? na : nb) != 0) return -1;
+    uint32_t i = 0, j = 0;
+    entry_t ea, eb;
+    while (i < na && j < nb) {
+        get_entry(a, i, &ea);
+        get_entry(b, j, &eb);
+        if (ea.key < eb.key) {
+            i++;
+        } else if (eb.key < ea.key) {
+            j++;
+        } else {
+            if (and_containers(&w, ea.key, &ea, a + ea.off, &eb, b + eb.off) != 0) return -1;
+            i++;
+            j++;
+        }
+    }
+    writer_finish(&w);
+    return 0;
+}
+
+int bitmap_contains(const unsigned char *bm, size_t len, uint32_t row) {
+    uint32_t n = num_containers(bm, len);
+    if (len < sizeof(uint32_t) + (uint64_t)n * BITMAP_ENTRY_SIZE) return -1;
+    uint16_t key = (uint16_t)(row >> 16), low = (uint16_t)row;
+    uint32_t lo = 0, hi = n;
+    entry_t e;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        get_entry(bm, mid, &e);
+        if (e.key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == n) return 0;
+    get_entry(bm, lo, &e);
+    if (e.key != key) return 0;
+    if (e.off > len || container_size(&e) > len - e.off) return -1;
+    const unsigned char *c = bm + e.off;
+    if (e.type == BITMAP_BITS) return bits_test(c, low);
+    lo = 0;
+    hi = e.card;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (array_at(c, mid) < low) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < e.card && array_at(c, lo) == low;
+}
+
+uint64_t bitmap_cardinality(const unsigned char *bm, size_t len) {
+    uint32_t n = num_containers(bm, len);
+    uint64_t card = 0;
+    if (len < sizeof(uint32_t) + (uint64_t)n * BITMAP_ENTRY_SIZE) return 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        entry_t e;
+        get_entry(bm, i, &e);
+        card += e.card;
+    }
+    return card;
+}
+
+int bitmap_check(const unsigned char *bm, size_t len) {
+    uint32_t n = num_containers(bm, len);
+    if (len < sizeof(uint32_t) || len < sizeof(uint32_t) + (uint64_t)n * BITMAP_ENTRY_SIZE) return -1;
+    entry_t e = {0};
+    for (uint32_t i = 0; i < n; ++i) {
+        uint16_t prev = e.key;
+        get_entry(bm, i, &e);
+        if ((i > 0 && e.key <= prev) || (e.type != BITMAP_ARRAY && e.type != BITMAP_BITS) ||
+            (e.type == BITMAP_ARRAY && e.card > BITMAP_ARRAY_MAX) || e.card > 65536 ||
+            e.off > len || container_size(&e) > len - e.off) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void bitmap_free(bitmap_t *b) {
+    if (!b) return;
+    free(b->buf);
+    b->buf = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* bitmap.h
+ *
+ * Compressed sets of row numbers, roaring style: rows are split by their
+ * high 16 bits into containers; a container with up to BITMAP_ARRAY_MAX rows
+ * keeps their low 16 bits as a sorted u16 array, a fuller one is a plain
+ * 65536 bit bitmap. Dense sets cost one bit per row, sparse ones two bytes.
+ *
+ * A bitmap is always kept serialized, so the same functions work on bitmaps
+ * mapped from an index file and on the ones built in memory:
+ * - num_containers u32
+ * - num_containers entries of BITMAP_ENTRY_SIZE bytes, by increasing key:
+ *   key u16 (high bits), type u16 (BITMAP_ARRAY / BITMAP_BITS),
+ *   card u32 (rows in the container), off u32 (from the start of the bitmap)
+ * - the containers: card u16 for an array, BITMAP_WORDS u64 for bits
+ */
+
+#define BITMAP_ARRAY_MAX 4096
+#define BITMAP_WORDS 1024
+#define BITMAP_ENTRY_SIZE 12
+#define BITMAP_ARRAY 0
+#define BITMAP_BITS 1
+
+/* A bitmap built in memory (serialized in buf) */
+typedef struct {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+} bitmap_t;
+
+/* bitmap of n rows, ascending and distinct. returns 0 or -1 */
+int bitmap_build(bitmap_t *out, const uint32_t *rows, size_t n);
+
+/* copy of the bitmap bm into out. returns 0, -1 if out of memory or corrupt */
+int bitmap_copy(bitmap_t *out, const unsigned char *bm, size_t len);
+
+/* rows in both a and b into out (which may not be a or b).
+   returns 0, -1 if out of memory or a bitmap is corrupt */
+int bitmap_and(bitmap_t *out, const unsigned char *a, size_t a_len, const unsigned char *b, size_t b_len);
+
+/* 1 if row is in the bitmap, 0 if not, -1 if corrupt */
+int bitmap_contains(const unsigned char *bm, size_t len, uint32_t row);
+
+/* rows in the bitmap */
+uint64_t bitmap_cardinality(const unsigned char *bm, size_t len);
+
+/* 0 if the containers of the bitmap lie within its len bytes */
+int bitmap_check(const unsigned char *bm, size_t len);
+
+void bitmap_free(bitmap_t *b);
+
+#endif // BITMAP_H
@@ -1,5 +1,6 @@
 #include "buckets.h"
 #include "common.h"
+#include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -11,15 +12,28 @@
 /* Header layout:
    offset 0: magic 4 bytes //
    offset 4: version uint16 //
-   offset 6: reserved uint16 //
+   offset 6: flags uint16 //
    offset 8: page_size uint32
    offset 12: num_buckets uint64
    offset 20: hash_seed uint64
-   offset 28: entry_size uint32 (8)
+   offset 28: entry_size uint32 (8, or 16 with flags)
    rest: padding to BUCKETS_HEADER_SIZE
 */
 
+uint64_t buckets_for_load(uint64_t num_keys, double load_factor) {
+    if (load_factor <= 0.0) load_factor = INDEX_DEFAULT_LOAD_FACTOR;
+    double want = (double)num_keys / load_factor;
+    uint64_t n = want < 1.0 ? 1 : (uint64_t)want;
+    if ((double)n < want) n++;
+    return next_pow2(n);
+}
+
 int buckets_create(const char *path, uint64_t num_buckets, uint64_t hash_seed) {
+    return buckets_create_flags(path, num_buckets, hash_seed, 0);
+}
+
+int buckets_create_flags(const char *path, uint64_t num_buckets, uint64_t hash_seed, uint16_t flags) {
+    uint32_t entry_size = flags ? BUCKET_ENTRY_SIZE_EXT : BUCKET_ENTRY_SIZE;
     mkdir("data/index", 0755); 
     int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
     if (fd < 0) {
@@ -34,9 +48,9 @@ int buckets_create(const char *path, uint64_t num_buckets, uint64_t hash_seed) {
     uint16_t v16;
     uint32_t v32;
     uint64_t v64;
-    v16 = (uint16_t)INDEX_VERSION;
+    v16 = (uint16_t)(flags ? INDEX_VERSION_FLAGS : INDEX_VERSION);
     memcpy(header + 4, &v16, sizeof(v16));
-    v16 = 0;
+    v16 = flags;
     memcpy(header + 6, &v16, sizeof(v16));
     v32 = (uint32_t)BUCKETS_HEADER_SIZE;
     memcpy(header + 8, &v32, sizeof(v32));
@@ -44,7 +58,7 @@ int buckets_create(const char *path, uint64_t num_buckets, uint64_t hash_seed) {
     memcpy(header + 12, &v64, sizeof(v64));
     v64 = (uint64_t)hash_seed;
     memcpy(header + 20, &v64, sizeof(v64));
-    v32 = (uint32_t)BUCKET_ENTRY_SIZE;
+    v32 = entry_size;
     memcpy(header + 28, &v32, sizeof(v32));
 
     if (safe_pwrite(fd, header, BUCKETS_HEADER_SIZE, 0) != (ssize_t)BUCKETS_HEADER_SIZE) {
@@ -54,7 +68,7 @@ int buckets_create(const char *path, uint64_t num_buckets, uint64_t hash_seed) {
 
     /* write zeroed bucket entries */
     off_t entries_offset = BUCKETS_HEADER_SIZE;
-    size_t entries_size = (size_t)num_buckets * BUCKET_ENTRY_SIZE;
+    size_t entries_size = (size_t)num_buckets * entry_size;
     /* allocate zero buffer in chunks to avoid huge malloc */
     size_t chunk = 65536;
     unsigned char *zeros = calloc(1, chunk);
@@ -83,6 +97,15 @@ int buckets_create(const char *path, uint64_t num_buckets, uint64_t hash_seed) {
 }
 
 int buckets_open_readwrite(const char *path, uint64_t *num_buckets_out, uint64_t *hash_seed_out) {
+    buckets_header_t hdr;
+    int fd = buckets_open_header(path, &hdr);
+    if (fd < 0) return -1;
+    if (num_buckets_out) *num_buckets_out = hdr.num_buckets;
+    if (hash_seed_out) *hash_seed_out = hdr.hash_seed;
+    return fd;
+}
+
+int buckets_open_header(const char *path, buckets_header_t *hdr) {
     int fd = open(path, O_RDWR);
     if (fd < 0) return -1;
     unsigned char header[BUCKETS_HEADER_SIZE];
@@ -94,16 +117,32 @@ int buckets_open_readwrite(const char *path, uint64_t *num_buckets_out, uint64_t
         close(fd);
         return -1;
     }
-    uint64_t num_buckets, hash_seed;
-    memcpy(&num_buckets, header + 12, sizeof num_buckets);
-    memcpy(&hash_seed,   header + 20, sizeof hash_seed);
-    if (num_buckets_out) *num_buckets_out = num_buckets;
-    if (hash_seed_out) *hash_seed_out = hash_seed;
+    memcpy(&hdr->version,     header + 4,  sizeof hdr->version);
+    memcpy(&hdr->flags,       header + 6,  sizeof hdr->flags);
+    memcpy(&hdr->num_buckets, header + 12, sizeof hdr->num_buckets);
+    memcpy(&hdr->hash_seed,   header + 20, sizeof hdr->hash_seed);
+    memcpy(&hdr->entry_size,  header + 28, sizeof hdr->entry_size);
+    if (hdr->version == INDEX_VERSION) {
+        /* version 1 files may carry anything in the reserved field */
+        hdr->flags = 0;
+        hdr->entry_size = BUCKET_ENTRY_SIZE;
+    }
+    /* flags and entry size go together, as buckets_create_flags writes them:
+       tagged or clustered lookups need the extent and tag filter of 16 byte
+       entries, and plain ones would misread them */
+    if (hdr->entry_size != (hdr->flags ? BUCKET_ENTRY_SIZE_EXT : BUCKET_ENTRY_SIZE)) {
+        close(fd);
+        return -1;
+    }
     return fd;
 }
 
 off_t buckets_entry_offset(uint64_t bucket_id) {
-    return (off_t)BUCKETS_HEADER_SIZE + (off_t)bucket_id * BUCKET_ENTRY_SIZE;
+    return buckets_entry_pos(bucket_id, BUCKET_ENTRY_SIZE);
+}
+
+off_t buckets_entry_pos(uint64_t bucket_id, uint32_t entry_size) {
+    return (off_t)BUCKETS_HEADER_SIZE + (off_t)bucket_id * entry_size;
 }
 
 off_t buckets_read_head(int fd, uint64_t num_buckets, uint64_t bucket_id) {
@@ -122,3 +161,47 @@ int buckets_write_head(int fd, uint64_t num_buckets, uint64_t bucket_id, off_t h
     if (safe_pwrite(fd, &head, 8, pos) != 8) return -1;
     return 0;
 }
+
+
+void buckets_decode_entry(const unsigned char *p, uint32_t entry_size, bucket_entry_t *entry) {
+    uint64_t head;
+    memcpy(&head, p, sizeof head);
+    entry->head = (off_t)head;
+    entry->extent_len = 0;
+    entry->tag_filter = 0;
+    if (entry_size >= BUCKET_ENTRY_SIZE_EXT) {
+        memcpy(&entry->extent_len, p + 8, sizeof entry->extent_len);
+        memcpy(&entry->tag_filter, p + 12, sizeof entry->tag_filter);
+    }
+}
+
+int buckets_read_entry(int fd, const buckets_header_t *hdr, uint64_t bucket_id, bucket_entry_t *entry) {
+    entry->head = 0;
+    entry->extent_len = 0;
+    entry->tag_filter = 0;
+    if (bucket_id >= hdr->num_buckets) return -1;
+    unsigned char buf[BUCKET_ENTRY_SIZE_EXT];
+    off_t pos = buckets_entry_pos(bucket_id, hdr->entry_size);
+    if (safe_pread(fd, buf, hdr->entry_size, pos) != (ssize_t)hdr->entry_size) return -1;
+    buckets_decode_entry(buf, hdr->entry_size, entry);
+    return 0;
+}
+
+int buckets_write_entries(int fd, const buckets_header_t *hdr, const bucket_entry_t *entries) {
+    size_t size = (size_t)hdr->num_buckets * hdr->entry_size;
+    unsigned char *table = calloc(1, size ? size : 1);
+    if (!table) return -1;
+    for (uint64_t i = 0; i < hdr->num_buckets; ++i) {
+        unsigned char *p = table + (size_t)i * hdr->entry_size;
+        uint64_t head = (uint64_t)entries[i].head;
+        memcpy(p, &head, sizeof head);
+        if (hdr->entry_size >= BUCKET_ENTRY_SIZE_EXT) {
+            memcpy(p + 8, &entries[i].extent_len, sizeof entries[i].extent_len);
+            memcpy(p + 12, &entries[i].tag_filter, sizeof entries[i].tag_filter);
+        }
+    }
+    int rc = 0;
+    if (safe_pwrite(fd, table, size, buckets_entry_pos(0, hdr->entry_size)) != (ssize_t)size) rc = -1;
+    free(table);
+    return rc;
+}
@@ -11,22 +11,58 @@
  * File layout:
  * - header (fixed size BUCKETS_HEADER_SIZE bytes)
  *   - magic         : 4 bytes  (ASCII, e.g. "IDX1")
- *   - version       : uint16  (2 bytes)
- *   - reserved      : uint16  (2 bytes)
+ *   - version       : uint16  (2 bytes)  // INDEX_VERSION, or INDEX_VERSION_FLAGS when flags != 0
+ *   - flags         : uint16  (2 bytes)  // INDEX_FLAG_* (reserved, 0, in version 1)
  *   - page_size     : uint32  (4 bytes)  // typically BUCKETS_HEADER_SIZE
  *   - num_buckets   : uint64  (8 bytes)  // number of bucket entries (prefer power-of-two)
  *   - hash_seed     : uint64  (8 bytes)  // seed used by the hash function
- *   - entry_size    : uint32  (4 bytes)  // size of each bucket entry in bytes (typically 8)
+ *   - entry_size    : uint32  (4 bytes)  // size of each bucket entry in bytes (8, or 16 with flags)
  *   - reserved/pad  : rest of header to fill BUCKETS_HEADER_SIZE
  *
+ * - entry (8 bytes): head_offset uint64
+ * - entry (16 bytes): head_offset uint64, extent_len uint32, tag_filter uint32
+ *   With INDEX_FLAG_CLUSTERED all nodes of a bucket are stored back to back in
+ *   arrays.dat, in chain order, in [head_offset, head_offset + extent_len), so
+ *   the whole chain can be fetched with one read.
+ *   With INDEX_FLAG_TAGGED tag_filter ORs buckets_tag_bits() of the tag of
+ *   every node in the chain: a key whose bits are not all set is not in the
+ *   bucket and arrays.dat is not read at all. (0 when the flag is not set.)
  * - head_offset == 0 means the bucket is empty (no nodes).
  *
  * This module exposes functions to create/open the buckets file, read a bucket head, and write a bucket head.
  */
 
+typedef struct {
+    uint16_t version;
+    uint16_t flags;
+    uint64_t num_buckets;
+    uint64_t hash_seed;
+    uint32_t entry_size;
+} buckets_header_t;
+
+typedef struct {
+    off_t head;
+    uint32_t extent_len;   // 0 when unknown (entries of 8 bytes)
+    uint32_t tag_filter;   // INDEX_FLAG_TAGGED only
+} bucket_entry_t;
+
+/* two of the 32 bits of a tag filter, chosen by a node tag */
+static inline uint32_t buckets_tag_bits(uint32_t tag) {
+    return (1u << (tag & 31)) | (1u << ((tag >> 5) & 31));
+}
+
+/* Power-of-two bucket count keeping num_keys / num_buckets <= load_factor */
+uint64_t buckets_for_load(uint64_t num_keys, double load_factor);
+
 /* Create buckets file with header and num_buckets entries zeroed */
 int buckets_create(const char *path, uint64_t num_buckets, uint64_t hash_seed);
 
+/* Same, for a layout with INDEX_FLAG_* flags (entries of BUCKET_ENTRY_SIZE_EXT bytes) */
+int buckets_create_flags(const char *path, uint64_t num_buckets, uint64_t hash_seed, uint16_t flags);
+
+/* Open buckets file and return the whole header (returns fd or -1) */
+int buckets_open_header(const char *path, buckets_header_t *hdr);
+
 /* Open buckets file and read header (returns fd or -1) */
 int buckets_open_readwrite(const char *path, uint64_t *num_buckets_out, uint64_t *hash_seed_out);
 
@@ -36,7 +72,19 @@ off_t buckets_read_head(int fd, uint64_t num_buckets, uint64_t bucket_id);
 /* Write head offset for bucket_id */
 int buckets_write_head(int fd, uint64_t num_buckets, uint64_t bucket_id, off_t head);
 
+/* Read a full entry of a file of any entry size */
+int buckets_read_entry(int fd, const buckets_header_t *hdr, uint64_t bucket_id, bucket_entry_t *entry);
+
+/* Decode an entry of entry_size bytes from memory */
+void buckets_decode_entry(const unsigned char *p, uint32_t entry_size, bucket_entry_t *entry);
+
+/* Write the whole table of num_buckets entries at once */
+int buckets_write_entries(int fd, const buckets_header_t *hdr, const bucket_entry_t *entries);
+
 /* Helper to compute offset in file for bucket entry */
 off_t buckets_entry_offset(uint64_t bucket_id);
 
+/* Same for entries of entry_size bytes */
+off_t buckets_entry_pos(uint64_t bucket_id, uint32_t entry_size);
+
 #endif // BUCKETS_H
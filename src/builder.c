@@ -5,75 +5,25 @@
 #include "common.h"
 #include "hash.h"
 #include "util.h"
+#include "keymap.h"
+#include "index_writer.h"
+#include "csv_scan.h"
+#include "records.h"
+#include "prefix.h"
+#include "reader.h"
+#include "trigram.h"
+#include "fulltext.h"
+#include "genres.h"
+#include "numeric.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
-
-/* Extract CSV field by index (0-based), support quoted fields with double quotes.
-   The returned pointer is malloc'd and must be freed (or ownership transferred).
-*/
-static char *csv_get_field_copy(const char *line, int field_idx) {
-    const char *p = line;
-    int idx = 0;
-    while (*p && idx < field_idx) {
-        if (*p == '"') {
-            p++;
-            while (*p && !(*p == '"' && (*(p+1) == ',' || *(p+1) == '\0' || *(p+1) == '\n' || *(p+1)=='\r'))) {
-                /* skip until closing quote followed by comma or EOL */
-                if (*p == '"' && *(p+1) == '"') { p += 2; continue; } /* escaped quote */
-                p++;
-            }
-            if (*p == '"') p++;
-            if (*p == ',') p++;
-            idx++;
-            continue;
-        } else {
-            while (*p && *p != ',') p++;
-            if (*p == ',') p++;
-            idx++;
-            continue;
-        }
-    }
-    /* extract field at idx == field_idx */
-    if (!*p) return strdup("");
-    char *out = NULL;
-    if (*p == '"') {
-        p++;
-        size_t cap = 256;
-        out = malloc(cap);
-        size_t len = 0;
-        while (*p) {
-            if (*p == '"' && *(p+1) == '"') {
-                /* escaped quote -> copy one quote */
-                if (len + 1 >= cap) { cap *= 2; out = realloc(out, cap); }
-                out[len++] = '"';
-                p += 2;
-                continue;
-            } else if (*p == '"') {
-                p++;
-                break;
-            } else {
-                if (len + 1 >= cap) { cap *= 2; out = realloc(out, cap); }
-                out[len++] = *p++;
-            }
-        }
-        out[len] = '\0';
-        /* skip optional comma */
-        if (*p == ',') p++;
-    } else {
-        const char *start = p;
-        while (*p && *p != ',' && *p != '\n' && *p != '\r') p++;
-        size_t len = p - start;
-        out = malloc(len + 1);
-        memcpy(out, start, len);
-        out[len] = '\0';
-        if (*p == ',') p++;
-    }
-    return out;
-}
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* field index: title = 0, author_name = 1 */
 static int get_field_index_for(const char *index_name) {
@@ -82,115 +32,482 @@ static int get_field_index_for(const char *index_name) {
     return -1;
 }
 
+/* enough raw bytes for normalize_prefix to see everything it uses */
+#define FIELD_PREFIX_BYTES (NORMALIZED_MAX_LEN + 8)
+
+/* below this many bytes per thread a parallel build is not worth it */
+#define BUILD_MIN_CHUNK (1u << 20)
+
+/* map a whole CSV read-only for a sequential scan, NULL on failure */
+static const char *map_csv(const char *csv_path, size_t *size_out) {
+    int fd = open(csv_path, O_RDONLY);
+    if (fd < 0) { fprintf(stderr,"open csv failed\n"); return NULL; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) { close(fd); return NULL; }
+    size_t size = (size_t)st.st_size;
+    const char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { perror("mmap csv"); return NULL; }
+    madvise((void *)base, size, MADV_SEQUENTIAL);
+    *size_out = size;
+    return base;
+}
+
 /* Build single index in streaming mode: for each CSV row (after header),
-   read the key, get current file byte offset for the line, create an arrays_node_t
-   with list_len=1 and next_ptr = old_head, append and update bucket head.
+   read the key, get the byte offset of the row, and add a node with
+   list_len=1 in front of its bucket chain. Nodes and bucket heads go through
+   an index_writer_t, so no syscall is made per row.
 */
 int build_index_stream(const char *csv_path, const char *out_dir, const char *index_name, uint64_t num_buckets, uint64_t hash_seed) {
     int field_idx = get_field_index_for(index_name);
     if (field_idx < 0) return -1;
 
-    char buckets_path[1024];
-    char arrays_path[1024];
-    snprintf(buckets_path, sizeof(buckets_path), "%s/%s_buckets.dat", out_dir, index_name);
-    snprintf(arrays_path, sizeof(arrays_path), "%s/%s_arrays.dat", out_dir, index_name);
+    size_t size;
+    const char *base = map_csv(csv_path, &size);
+    if (!base) return -1;
+    const char *end = base + size;
+    csv_scanner_t sc;
+    csv_scanner_init(&sc, base, end);
+    const char *data = csv_scan_row(&sc, base, NULL, 0, NULL); /* skip header */
 
-    if (buckets_create(buckets_path, num_buckets, hash_seed) != 0) {
-        fprintf(stderr, "Failed to create buckets file %s\n", buckets_path);
-        return -1;
+    if (num_buckets == 0) {
+        /* one node per row: size for the row count */
+        uint64_t rows = 0;
+        for (const char *p = data; p < end; p = csv_scan_row(&sc, p, NULL, 0, NULL)) rows++;
+        num_buckets = buckets_for_load(rows, INDEX_DEFAULT_LOAD_FACTOR);
     }
-    if (arrays_create(arrays_path) != 0) {
-        fprintf(stderr, "Failed to create arrays file %s\n", arrays_path);
+
+    index_writer_t w;
+    if (index_writer_open(&w, out_dir, index_name, num_buckets, hash_seed) != 0) {
+        munmap((void *)base, size);
         return -1;
     }
 
-    int bfd = buckets_open_readwrite(buckets_path, NULL, NULL);
-    if (bfd < 0) { fprintf(stderr,"open buckets failed\n"); return -1; }
-    int afd = arrays_open(arrays_path);
-    if (afd < 0) { close(bfd); fprintf(stderr,"open arrays failed\n"); return -1; }
+    /* iterate rows */
+    csv_span_t spans[NUM_DATASET_FIELDS];
+    char raw[FIELD_PREFIX_BYTES];
+    char norm[NORMALIZED_MAX_LEN + 1];
+    const char *p = data;
+    while (p < end) {
+        off_t row_off = (off_t)(p - base);
+        int nfields;
+        p = csv_scan_row(&sc, p, spans, field_idx + 1, &nfields);
 
-    FILE *f = fopen(csv_path, "rb");
-    if (!f) { close(bfd); close(afd); fprintf(stderr,"open csv failed\n"); return -1; }
+        /* a missing column is indexed as the empty key */
+        size_t raw_len = 0;
+        raw[0] = '\0';
+        if (field_idx < nfields) raw_len = csv_span_copy(&spans[field_idx], raw, sizeof raw);
+        size_t norm_len = normalize_prefix(raw, raw_len, norm);
 
-    /* read header line and skip */
-    off_t line_off = ftello(f);
-    char *line = NULL;
-    size_t llen = 0;
-    ssize_t nread;
-    nread = getline(&line, &llen, f);
-    if (nread <= 0) { fclose(f); close(bfd); close(afd); if (line) free(line); return -1; }
+        uint64_t h = hash_key_prefix(norm, norm_len, hash_seed);
+        if (index_writer_add(&w, h, norm, (uint16_t)norm_len, &row_off, 1) == 0) {
+            fprintf(stderr, "failed append node\n");
+        }
+    }
 
-    /* iterate rows */
+    munmap((void *)base, size);
+    return index_writer_close(&w);
+}
+
+/* One worker of a (possibly parallel) build: scans the rows that start in
+   [begin, end) of the mapped CSV, groups them into its own keymaps and
+   serializes them into its own records chunk. */
+typedef struct {
+    const char *begin;
+    const char *end;
+    const index_spec_t *specs;
+    size_t num_specs;
+    keymap_t *maps;            // num_specs maps, owned by the worker
+    records_chunk_t records;   // rows of the chunk, row ids start at 0 here
+    int rc;
+} build_chunk_t;
+
+/* The last column (genres) may hold unquoted commas: when a row has more
+   fields than the dataset, the last one runs to the end of the row */
+static void extend_last_field(csv_span_t *last, const char *row_end) {
+    if (last->quoted) return;
+    const char *e = row_end;
+    if (e > last->start && e[-1] == '\n') e--;
+    if (e > last->start && e[-1] == '\r') e--;
+    if (e > last->start + last->len) last->len = (size_t)(e - last->start);
+}
+
+/* Split and group every row of a chunk (rows may span several lines inside
+   quoted fields). Postings are row numbers counted from the chunk start,
+   rebased when the chunks are merged. */
+static void *build_chunk_run(void *arg) {
+    build_chunk_t *c = arg;
+    csv_span_t spans[NUM_DATASET_FIELDS];
+    char raw[FIELD_PREFIX_BYTES];
+    char norm[NORMALIZED_MAX_LEN + 1];
 
-    while (1) {
-        line_off = ftello(f);
-        if (line_off == (off_t)-1) {
-            perror("ftello");
+    csv_scanner_t sc;
+    csv_scanner_init(&sc, c->begin, c->end);
+    const char *p = c->begin;
+    while (p < c->end && c->rc == 0) {
+        off_t row = (off_t)c->records.rows;
+        int nfields;
+        const char *next = csv_scan_row(&sc, p, spans, NUM_DATASET_FIELDS, &nfields);
+        if (nfields == NUM_DATASET_FIELDS) extend_last_field(&spans[NUM_DATASET_FIELDS - 1], next);
+        if (records_chunk_add(&c->records, spans, nfields) != 0) {
+            fprintf(stderr, "out of memory storing records\n");
+            c->rc = -1;
             break;
         }
-        nread = getline(&line, &llen, f);
-        if (nread <= 0) break;
+        for (size_t k = 0; k < c->num_specs; ++k) {
+            /* a missing column is indexed as the empty key */
+            size_t raw_len = 0;
+            raw[0] = '\0';
+            if (c->specs[k].field_idx < nfields) {
+                raw_len = csv_span_copy(&spans[c->specs[k].field_idx], raw, sizeof raw);
+            }
+            size_t norm_len = normalize_prefix(raw, raw_len, norm);
 
-        char *field = csv_get_field_copy(line, field_idx);
-        if (!field) continue;
+            keymap_entry_t *e = keymap_get(&c->maps[k], norm, norm_len);
+            if (!e || keymap_push(&c->maps[k], e, row) != 0) {
+                fprintf(stderr, "out of memory grouping keys\n");
+                c->rc = -1;
+                break;
+            }
+        }
+        p = next;
+    }
+    return NULL;
+}
 
-        char *normalized_key;
-        normalized_key = normalize_string(field);
-        
-        free(field);
+/* Append every entry of src to dst, keeping insertion order of keys and
+   postings; the postings of src are shifted by row_base */
+static int keymap_merge(keymap_t *dst, const keymap_t *src, off_t row_base) {
+    for (size_t i = 0; i < src->count; ++i) {
+        const keymap_entry_t *se = &src->entries[i];
+        keymap_entry_t *e = keymap_get_hashed(dst, se->key, se->key_len, se->hash);
+        if (!e) return -1;
+        for (uint32_t j = 0; j < se->count; ++j) {
+            if (keymap_push(dst, e, se->offsets[j] + row_base) != 0) return -1;
+        }
+    }
+    return 0;
+}
 
-        uint64_t h = hash_key_prefix(normalized_key, strlen(normalized_key), hash_seed);
-        uint64_t mask = num_buckets - 1;
-        uint64_t bucket = bucket_id_from_hash(h, mask);
+static void free_chunk_maps(build_chunk_t *c) {
+    records_chunk_free(&c->records);
+    if (!c->maps) return;
+    for (size_t k = 0; k < c->num_specs; ++k) keymap_free(&c->maps[k]);
+    free(c->maps);
+    c->maps = NULL;
+}
 
-        off_t old_head = buckets_read_head(bfd, num_buckets, bucket);
+/* Build several grouped indices from one scan of the CSV: every row is read
+   and split once, then each index takes its column from the spans.
+   The CSV is mapped and cut into num_threads ranges aligned to row starts;
+   each thread groups its range, then the per-thread maps are merged in file
+   order so the result is the same as a single-threaded scan.
+   The rows themselves go to out_dir/records.dat in the same order, and the
+   postings hold row numbers into it (INDEX_FLAG_ROWIDS). */
+int build_indices_parallel(const char *csv_path, const char *out_dir, const index_spec_t *specs,
+    size_t num_specs, uint64_t hash_seed, int num_threads)
+{
+    if (!specs || num_specs == 0) return -1;
+    for (size_t k = 0; k < num_specs; ++k) {
+        if (specs[k].field_idx < 0 || specs[k].field_idx >= NUM_DATASET_FIELDS) return -1;
+    }
 
-        arrays_node_t node;
-        node.key_len = (uint16_t)strlen(normalized_key);
-        node.key = strdup(normalized_key); 
+    size_t size;
+    const char *base = map_csv(csv_path, &size);
+    if (!base) return -1;
+    const char *data_end = base + size;
+    csv_scanner_t sc;
+    csv_scanner_init(&sc, base, data_end);
+    const char *data = csv_scan_row(&sc, base, NULL, 0, NULL); /* skip header */
 
-        free(normalized_key);
+    if (num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = (size_t)(data_end - data) / BUILD_MIN_CHUNK + 1;
+    if (num_threads < 1) num_threads = 1;
+    if ((size_t)num_threads > max_threads) num_threads = (int)max_threads;
 
-        node.list_len = 1;
-        node.offsets = malloc(sizeof(off_t) * 1);
-        if (!node.offsets) {
-            arrays_free_node(&node);
-            fprintf(stderr, "malloc failed for offsets\n");
-            continue;
-        }
-        node.offsets[0] = (off_t)line_off;
-        node.next_ptr = old_head;
+    build_chunk_t *chunks = calloc((size_t)num_threads, sizeof *chunks);
+    pthread_t *tids = calloc((size_t)num_threads, sizeof *tids);
+    if (!chunks || !tids) { free(chunks); free(tids); munmap((void *)base, size); return -1; }
 
-        off_t new_node_off = arrays_append_node(afd, &node);
-        if (new_node_off == 0) {
-            fprintf(stderr, "failed append node\n");
-            arrays_free_node(&node);
-            continue;
+    /* cut ranges, moving each boundary to the start of the next row. Rows are
+       followed from the start so a newline inside quotes is never taken for
+       a row end (a cheap pass over the separators only) */
+    int rc = 0;
+    const char *cut = data;
+    for (int t = 0; t < num_threads; ++t) {
+        build_chunk_t *c = &chunks[t];
+        c->begin = cut;
+        if (t == num_threads - 1) {
+            cut = data_end;
+        } else {
+            const char *target = data + (size_t)(data_end - data) / (size_t)num_threads * (size_t)(t + 1);
+            cut = csv_scan_skip_to(&sc, cut, target);
+        }
+        c->end = cut;
+        c->specs = specs;
+        c->num_specs = num_specs;
+        c->maps = calloc(num_specs, sizeof(keymap_t));
+        if (!c->maps) { rc = -1; continue; }
+        for (size_t k = 0; k < num_specs; ++k) {
+            if (keymap_init(&c->maps[k], hash_seed) != 0) rc = -1;
         }
+    }
 
-        arrays_free_node(&node);
+    int started = 0;
+    for (int t = 0; rc == 0 && t < num_threads; ++t) {
+        if (pthread_create(&tids[t], NULL, build_chunk_run, &chunks[t]) != 0) { rc = -1; break; }
+        started++;
+    }
+    for (int t = 0; t < started; ++t) {
+        pthread_join(tids[t], NULL);
+        if (chunks[t].rc != 0) rc = -1;
+    }
+    munmap((void *)base, size);
 
-        if (buckets_write_head(bfd, num_buckets, bucket, new_node_off) != 0) {
-            fprintf(stderr, "failed write bucket head\n");
+    /* records of every chunk, in file order: row ids are global from here */
+    if (rc == 0) {
+        records_chunk_t *runs = calloc((size_t)num_threads, sizeof *runs);
+        char records_path[1024];
+        snprintf(records_path, sizeof(records_path), "%s/%s", out_dir, RECORDS_FILE);
+        if (!runs) rc = -1;
+        for (int t = 0; runs && t < num_threads; ++t) runs[t] = chunks[t].records;
+        if (runs && records_write(records_path, runs, (size_t)num_threads) != 0) {
+            fprintf(stderr, "Failed to write %s\n", records_path);
+            rc = -1;
         }
+        free(runs);
     }
 
-    if (line) free(line);
-    fclose(f);
-    close(bfd);
-    close(afd);
-    return 0;
+    /* merge per-thread maps in file order into chunk 0, then write */
+    for (size_t k = 0; rc == 0 && k < num_specs; ++k) {
+        off_t row_base = (off_t)chunks[0].records.rows;
+        for (int t = 1; t < num_threads; ++t) {
+            int merged = keymap_merge(&chunks[0].maps[k], &chunks[t].maps[k], row_base);
+            row_base += (off_t)chunks[t].records.rows;
+            if (merged != 0) {
+                fprintf(stderr, "out of memory merging keys\n");
+                rc = -1;
+                break;
+            }
+            keymap_free(&chunks[t].maps[k]);
+            if (keymap_init(&chunks[t].maps[k], hash_seed) != 0) { rc = -1; break; }
+        }
+        uint64_t num_buckets = specs[k].num_buckets;
+        if (num_buckets == 0) num_buckets = buckets_for_load(chunks[0].maps[k].count, INDEX_DEFAULT_LOAD_FACTOR);
+        if (rc == 0 && index_writer_write_keymap(&chunks[0].maps[k], out_dir, specs[k].name, num_buckets, hash_seed,
+                                                INDEX_LAYOUT_DEFAULT | INDEX_FLAG_ROWIDS) != 0) {
+            fprintf(stderr, "Failed to write index %s\n", specs[k].name);
+            rc = -1;
+        }
+    }
+
+    for (int t = 0; t < num_threads; ++t) free_chunk_maps(&chunks[t]);
+    free(chunks);
+    free(tids);
+    return rc;
+}
+
+/* Build several grouped indices from one scan of the CSV (single thread) */
+int build_indices(const char *csv_path, const char *out_dir, const index_spec_t *specs, size_t num_specs, uint64_t hash_seed) {
+    return build_indices_parallel(csv_path, out_dir, specs, num_specs, hash_seed, 1);
+}
+
+/* Build single index in grouped mode: collect the row of every record per
+   normalized key in a keymap, then write one node per distinct key with its
+   whole postings list (in CSV order). Needs memory for all keys and postings. */
+int build_index_grouped(const char *csv_path, const char *out_dir, const char *index_name, uint64_t num_buckets, uint64_t hash_seed) {
+    index_spec_t spec = { index_name, get_field_index_for(index_name), num_buckets };
+    if (spec.field_idx < 0) return -1;
+    return build_indices(csv_path, out_dir, &spec, 1, hash_seed);
 }
 
 int build_both_indices_stream(const char *csv_path, const char *out_dir, uint64_t num_buckets_title, uint64_t num_buckets_author, uint64_t hash_seed) {
-    /* We will do two passes (one per index) to keep code simple */
-    if (build_index_stream(csv_path, out_dir, "title", num_buckets_title, hash_seed) != 0) {
-        perror("build title index");
-        return -1;
-    }
-    if (build_index_stream(csv_path, out_dir, "author", num_buckets_author, hash_seed) != 0) {
-        perror("build author index");   
+    /* one scan of the CSV feeds both indices */
+    index_spec_t specs[2] = {
+        { "title",  get_field_index_for("title"),  num_buckets_title },
+        { "author", get_field_index_for("author"), num_buckets_author },
+    };
+    if (build_indices_parallel(csv_path, out_dir, specs, 2, hash_seed, 0) != 0) {
+        perror("build title/author indices");
         return -1;
     }
     return 0;
 }
+
+/* the hash indices that also get completions and trigrams */
+#define DERIVED_COLUMNS 2
+
+static const index_spec_t derived_columns[DERIVED_COLUMNS] = {
+    { "title",  FIELD_TITLE,  0 },
+    { "author", FIELD_AUTHOR, 0 },
+};
+
+/* builders fed by the scan of records.dat, want_* set for the files to write */
+typedef struct {
+    prefix_builder_t prefix[DERIVED_COLUMNS];
+    fulltext_builder_t fulltext;
+    genres_builder_t genres;
+    numeric_builder_t numeric[NUMERIC_NUM_COLUMNS];
+    int want_prefix[DERIVED_COLUMNS];
+    int want_fulltext;
+    int want_genres;
+    int want_numeric[NUMERIC_NUM_COLUMNS];
+} derived_t;
+
+static int add_field(records_field_cb add, void *b, uint64_t row, const record_t *rec, int field_idx) {
+    if ((uint32_t)field_idx >= rec->num_fields) return 0;
+    return add(row, rec->field[field_idx], rec->len[field_idx], b);
+}
+
+static int derived_row(uint64_t row, const record_t *rec, void *ctx) {
+    derived_t *d = ctx;
+    int rc = 0;
+    for (int i = 0; rc == 0 && i < DERIVED_COLUMNS; ++i) {
+        if (d->want_prefix[i]) rc = add_field(prefix_builder_add, &d->prefix[i], row, rec, derived_columns[i].field_idx);
+    }
+    if (rc == 0 && d->want_fulltext) rc = add_field(fulltext_builder_add, &d->fulltext, row, rec, FIELD_DESCRIPTION);
+    if (rc == 0 && d->want_genres) rc = add_field(genres_builder_add, &d->genres, row, rec, FIELD_GENRES);
+    for (int c = 0; rc == 0 && c < NUMERIC_NUM_COLUMNS; ++c) {
+        if (d->want_numeric[c]) rc = add_field(numeric_builder_add, &d->numeric[c], row, rec, numeric_columns[c].field_idx);
+    }
+    return rc;
+}
+
+/* count a file written, or report it */
+static void tally(int write_rc, const char *path, int *built, int *failed) {
+    if (write_rc == 0) {
+        (*built)++;
+        return;
+    }
+    fprintf(stderr, "Failed to write %s\n", path);
+    (*failed)++;
+}
+
+/* whether path opens as a file of its kind, to tell a current file from one
+   of an older version or a damaged one */
+static int prefix_usable(const char *path) {
+    prefix_index_t p;
+    if (prefix_open(&p, path) != 0) return 0;
+    prefix_close(&p);
+    return 1;
+}
+
+static int trigram_usable(const char *path) {
+    trigram_index_t t;
+    if (trigram_open(&t, path) != 0) return 0;
+    trigram_close(&t);
+    return 1;
+}
+
+static int fulltext_usable(const char *path) {
+    fulltext_index_t f;
+    if (fulltext_open(&f, path) != 0) return 0;
+    fulltext_close(&f);
+    return 1;
+}
+
+static int genres_usable(const char *path) {
+    genres_index_t g;
+    if (genres_open(&g, path) != 0) return 0;
+    genres_close(&g);
+    return 1;
+}
+
+static int numeric_usable(const char *path) {
+    numeric_index_t n;
+    if (numeric_open(&n, path) != 0) return 0;
+    numeric_close(&n);
+    return 1;
+}
+
+/* with only_missing, files that are there and open are kept */
+static int want_file(const char *path, int only_missing, int (*usable)(const char *path)) {
+    return !only_missing || access(path, F_OK) != 0 || !usable(path);
+}
+
+int build_derived_indices(const char *out_dir, int only_missing) {
+    char records_path[1024], fulltext_path[1024], genres_path[1024];
+    char prefix_paths[DERIVED_COLUMNS][1024], trigram_paths[DERIVED_COLUMNS][1024];
+    char numeric_paths[NUMERIC_NUM_COLUMNS][1024];
+    derived_t d;
+    memset(&d, 0, sizeof d);
+
+    snprintf(records_path, sizeof(records_path), "%s/%s", out_dir, RECORDS_FILE);
+    snprintf(fulltext_path, sizeof(fulltext_path), "%s/%s", out_dir, FULLTEXT_FILE);
+    snprintf(genres_path, sizeof(genres_path), "%s/%s", out_dir, GENRES_FILE);
+    int scan = 0;
+    for (int i = 0; i < DERIVED_COLUMNS; ++i) {
+        snprintf(prefix_paths[i], sizeof(prefix_paths[i]), "%s/%s%s", out_dir, derived_columns[i].name, PREFIX_SUFFIX);
+        snprintf(trigram_paths[i], sizeof(trigram_paths[i]), "%s/%s%s", out_dir, derived_columns[i].name, TRIGRAM_SUFFIX);
+        scan |= d.want_prefix[i] = want_file(prefix_paths[i], only_missing, prefix_usable);
+    }
+    scan |= d.want_fulltext = want_file(fulltext_path, only_missing, fulltext_usable);
+    scan |= d.want_genres = want_file(genres_path, only_missing, genres_usable);
+    for (int c = 0; c < NUMERIC_NUM_COLUMNS; ++c) {
+        snprintf(numeric_paths[c], sizeof(numeric_paths[c]), "%s/%s%s", out_dir, numeric_columns[c].name, NUMERIC_SUFFIX);
+        scan |= d.want_numeric[c] = want_file(numeric_paths[c], only_missing, numeric_usable);
+    }
+
+    /* every file read from records.dat comes out of one scan of it */
+    int built = 0, failed = 0;
+    records_t r;
+    if (scan && records_open(&r, records_path) != 0) {
+        fprintf(stderr, "Failed to open %s\n", records_path);
+        failed++;
+    } else if (scan) {
+        int rc = 0;
+        for (int i = 0; i < DERIVED_COLUMNS; ++i) {
+            if (d.want_prefix[i]) prefix_builder_init(&d.prefix[i]);
+        }
+        if (d.want_fulltext && fulltext_builder_init(&d.fulltext, r.num_rows) != 0) rc = -1;
+        if (d.want_genres && genres_builder_init(&d.genres, r.num_rows) != 0) rc = -1;
+        for (int c = 0; c < NUMERIC_NUM_COLUMNS; ++c) {
+            if (d.want_numeric[c] && numeric_builder_init(&d.numeric[c], r.num_rows, numeric_columns[c].scale) != 0) rc = -1;
+        }
+        if (rc == 0 && records_for_each(&r, derived_row, &d) != 0) rc = -1;
+        if (rc != 0) {
+            fprintf(stderr, "Failed to read %s\n", records_path);
+            failed++;
+        }
+        records_close(&r);
+
+        /* a file that cannot be written does not keep the others from it */
+        for (int i = 0; rc == 0 && i < DERIVED_COLUMNS; ++i) {
+            if (!d.want_prefix[i]) continue;
+            tally(prefix_builder_write(&d.prefix[i], prefix_paths[i]), prefix_paths[i], &built, &failed);
+        }
+        if (rc == 0 && d.want_fulltext) {
+            tally(fulltext_builder_write(&d.fulltext, fulltext_path), fulltext_path, &built, &failed);
+        }
+        if (rc == 0 && d.want_genres) {
+            tally(genres_builder_write(&d.genres, genres_path), genres_path, &built, &failed);
+        }
+        for (int c = 0; rc == 0 && c < NUMERIC_NUM_COLUMNS; ++c) {
+            if (!d.want_numeric[c]) continue;
+            tally(numeric_builder_write(&d.numeric[c], numeric_paths[c]), numeric_paths[c], &built, &failed);
+        }
+
+        for (int i = 0; i < DERIVED_COLUMNS; ++i) prefix_builder_free(&d.prefix[i]);
+        fulltext_builder_free(&d.fulltext);
+        genres_builder_free(&d.genres);
+        for (int c = 0; c < NUMERIC_NUM_COLUMNS; ++c) numeric_builder_free(&d.numeric[c]);
+    }
+
+    /* trigrams of the keys of the hash indices, read back from the indices */
+    for (int i = 0; i < DERIVED_COLUMNS; ++i) {
+        if (!want_file(trigram_paths[i], only_missing, trigram_usable)) continue;
+        char buckets_path[1024], arrays_path[1024];
+        snprintf(buckets_path, sizeof(buckets_path), "%s/%s_buckets.dat", out_dir, derived_columns[i].name);
+        snprintf(arrays_path, sizeof(arrays_path), "%s/%s_arrays.dat", out_dir, derived_columns[i].name);
+        index_handle_t h;
+        if (index_open_mmap(&h, buckets_path, arrays_path) != 0 &&
+            index_open(&h, buckets_path, arrays_path) != 0) {
+            fprintf(stderr, "Failed to open index %s\n", derived_columns[i].name);
+            failed++;
+            continue;
+        }
+        tally(trigram_build(&h, trigram_paths[i]), trigram_paths[i], &built, &failed);
+        index_close(&h);
+    }
+    return failed == 0 ? built : -1;
+}
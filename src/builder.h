@@ -2,12 +2,47 @@
 #define BUILDER_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 /* Functions for building the two index files from dataset CSV */
 
+/* One index fed by build_indices: files <out_dir>/<name>_{buckets,arrays}.dat
+   keyed by the CSV column field_idx.
+   num_buckets == 0 (here and in every build function) sizes the table from the
+   number of keys and INDEX_DEFAULT_LOAD_FACTOR. */
+typedef struct {
+    const char *name;
+    int field_idx;
+    uint64_t num_buckets;
+} index_spec_t;
+
+/* One node per row, postings are byte offsets of the rows in the CSV (v1 layout) */
 int build_index_stream(const char *csv_path, const char *out_dir, const char *index_name, uint64_t num_buckets, uint64_t hash_seed);
 
-/* Build both indices title and author */
+/* Same files as build_index_stream, but postings are grouped in memory by
+   normalized key first so every distinct key becomes a single node.
+   Grouped builds also write <out_dir>/records.dat (records.h) and their
+   postings are row numbers in it (INDEX_FLAG_ROWIDS) */
+int build_index_grouped(const char *csv_path, const char *out_dir, const char *index_name, uint64_t num_buckets, uint64_t hash_seed);
+
+/* Build every index in specs (grouped mode) from a single scan of the CSV */
+int build_indices(const char *csv_path, const char *out_dir, const index_spec_t *specs, size_t num_specs, uint64_t hash_seed);
+
+/* Same as build_indices with the CSV split in row-aligned ranges grouped by
+   num_threads threads (<= 0: one per online CPU). Output is identical. */
+int build_indices_parallel(const char *csv_path, const char *out_dir, const index_spec_t *specs,
+    size_t num_specs, uint64_t hash_seed, int num_threads);
+
+/* Build both indices title and author (grouped mode, single parallel scan) */
 int build_both_indices_stream(const char *csv_path, const char *out_dir, uint64_t num_buckets_title, uint64_t num_buckets_author, uint64_t hash_seed);
 
+/* Write the files derived from the title and author indices of out_dir and
+   their records.dat: completions and trigrams of both columns, the
+   description words, the genre bitmaps and the numeric columns. Run once the
+   hash indices are written; the files read from records.dat come out of a
+   single scan of it. With only_missing the files already present are kept
+   unless they fail to open (older version, damaged).
+   returns how many files were written, -1 if one of them failed */
+int build_derived_indices(const char *out_dir, int only_missing);
+
 #endif // BUILDER_H
@@ -9,15 +9,35 @@
 #define BUCKETS_HEADER_SIZE 4096
 #define ARRAYS_HEADER_SIZE 4096
 #define BUCKET_ENTRY_SIZE 8
+#define BUCKET_ENTRY_SIZE_EXT 16 // head + extent_len + tag_filter, used by layouts with flags
 #define INDEX_MAGIC "IDX1" 
 #define INDEX_VERSION 1 
+#define INDEX_VERSION_FLAGS 2 // version written when the header carries layout flags
+
+/* layout flags stored in the buckets header */
+#define INDEX_FLAG_CLUSTERED 0x0001 // nodes of a bucket are contiguous, entry holds the extent
+#define INDEX_FLAG_TAGGED    0x0002 // nodes carry a hash tag, entries a filter of their tags
+#define INDEX_FLAG_VARINT    0x0004 // tagged nodes hold sorted, delta + varint coded offsets
+#define INDEX_FLAG_ROWIDS    0x0008 // postings are row numbers in records.dat, not CSV offsets
+
+/* layout written by grouped builds, compact and resize */
+#define INDEX_LAYOUT_DEFAULT (INDEX_FLAG_CLUSTERED | INDEX_FLAG_TAGGED | INDEX_FLAG_VARINT)
 
 #define CSV_PATH "data/dataset/books_data.csv"
 #define INDEX_DIR "data/index"
 #define NUM_DATASET_FIELDS 14
 
+/* columns of the dataset (and of records.dat) used by the indices */
+#define FIELD_TITLE 0
+#define FIELD_AUTHOR 1
+#define FIELD_DESCRIPTION 6
+#define FIELD_GENRES 13
+
 #define KEY_PREFIX_LEN 14 // lenght for a matching search 
 
+/* keys per bucket aimed at when the bucket count is chosen automatically */
+#define INDEX_DEFAULT_LOAD_FACTOR 0.75
+
 /* safe IO wrappers */
 ssize_t safe_pread(int fd, void *buf, size_t count, off_t offset);
 ssize_t safe_pwrite(int fd, const void *buf, size_t count, off_t offset);
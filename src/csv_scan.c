@@ -0,0 +1,213 @@
+#include "csv_scan.h"
+#include <string.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(CSV_SCAN_SCALAR)
+#include <immintrin.h>
+#define CSV_SCAN_X86 1
+#endif
+
+#define CSV_BLOCK 64
+
+typedef void (*classify_fn)(const char *blk, uint64_t *quote, uint64_t *sep, uint64_t *nl);
+
+static void classify_scalar(const char *blk, uint64_t *quote, uint64_t *sep, uint64_t *nl) {
+    uint64_t q = 0, c = 0, n = 0;
+    for (int i = 0; i < CSV_BLOCK; ++i) {
+        q |= (uint64_t)(blk[i] == '"') << i;
+        c |= (uint64_t)(blk[i] == ',') << i;
+        n |= (uint64_t)(blk[i] == '\n') << i;
+    }
+    *quote = q;
+    *sep = c | n;
+    *nl = n;
+}
+
+#ifdef CSV_SCAN_X86
+#ifdef __SSE2__
+static void classify_sse2(const char *blk, uint64_t *quote, uint64_t *sep, uint64_t *nl) {
+    const __m128i vq = _mm_set1_epi8('"');
+    const __m128i vc = _mm_set1_epi8(',');
+    const __m128i vn = _mm_set1_epi8('\n');
+    uint64_t q = 0, c = 0, n = 0;
+    for (int i = 0; i < CSV_BLOCK / 16; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(blk + 16 * i));
+        q |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vq)) << (16 * i);
+        c |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vc)) << (16 * i);
+        n |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vn)) << (16 * i);
+    }
+    *quote = q;
+    *sep = c | n;
+    *nl = n;
+}
+#endif
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char *blk, uint64_t *quote, uint64_t *sep, uint64_t *nl) {
+    const __m256i vq = _mm256_set1_epi8('"');
+    const __m256i vc = _mm256_set1_epi8(',');
+    const __m256i vn = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)blk);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(blk + 32));
+    uint64_t q = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, vq))
+               | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, vq)) << 32;
+    uint64_t c = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, vc))
+               | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, vc)) << 32;
+    uint64_t n = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, vn))
+               | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, vn)) << 32;
+    *quote = q;
+    *sep = c | n;
+    *nl = n;
+}
+#endif
+
+static classify_fn pick_classifier(const char **name) {
+#ifdef CSV_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return classify_avx2;
+    }
+#ifdef __SSE2__
+    *name = "sse2";
+    return classify_sse2;
+#endif
+#endif
+    *name = "scalar";
+    return classify_scalar;
+}
+
+static classify_fn classify;
+static const char *classify_name;
+static pthread_once_t classify_once = PTHREAD_ONCE_INIT;
+
+static void classify_init(void) {
+    classify = pick_classifier(&classify_name);
+}
+
+const char *csv_scan_impl(void) {
+    pthread_once(&classify_once, classify_init);
+    return classify_name;
+}
+
+void csv_scanner_init(csv_scanner_t *s, const char *base, const char *end) {
+    pthread_once(&classify_once, classify_init);
+    s->base = base;
+    s->end = end;
+    s->blk = NULL;
+    s->quote = 0;
+    s->sep = 0;
+    s->nl = 0;
+}
+
+/* classify the block at blk; the last, short one goes through a padded copy */
+static void scan_load(csv_scanner_t *s, const char *blk) {
+    if (s->end - blk >= CSV_BLOCK) {
+        classify(blk, &s->quote, &s->sep, &s->nl);
+    } else {
+        char tail[CSV_BLOCK];
+        size_t n = (size_t)(s->end - blk);
+        memcpy(tail, blk, n);
+        memset(tail + n, 0, CSV_BLOCK - n);
+        classify(tail, &s->quote, &s->sep, &s->nl);
+    }
+    s->blk = blk;
+}
+
+enum { FIND_QUOTE, FIND_SEP, FIND_NL_QUOTE };
+
+/* first byte of the class what at or after p, end if none */
+static const char *scan_find(csv_scanner_t *s, const char *p, int what) {
+    while (p < s->end) {
+        const char *blk = s->base + ((size_t)(p - s->base) & ~(size_t)(CSV_BLOCK - 1));
+        if (blk != s->blk) scan_load(s, blk);
+        uint64_t m = what == FIND_QUOTE ? s->quote : what == FIND_SEP ? s->sep : (s->nl | s->quote);
+        m >>= (p - blk);
+        if (m) return p + __builtin_ctzll(m);
+        p = blk + CSV_BLOCK;
+    }
+    return s->end;
+}
+
+/* end of the closing quote of the quoted field whose content starts at q (end if unterminated) */
+static const char *scan_closing_quote(csv_scanner_t *s, const char *q) {
+    const char *end = s->end;
+    while ((q = scan_find(s, q, FIND_QUOTE)) < end && q + 1 < end && q[1] == '"') q += 2; /* escaped quote */
+    return q;
+}
+
+/* rest of a row from p (a field start) once no more spans are wanted: only
+   newlines and quotes opening a field matter, commas are not visited */
+static const char *scan_skip_row(csv_scanner_t *s, const char *p, const char *row) {
+    const char *end = s->end;
+    const char *q;
+    while ((q = scan_find(s, p, FIND_NL_QUOTE)) < end) {
+        if (*q == '\n') return q + 1;
+        if (q == row || q[-1] == ',') {
+            q = scan_closing_quote(s, q + 1);
+            if (q >= end) return end;
+            /* bytes after a closing quote end the fields: only a newline matters */
+            if (q + 1 < end && q[1] != ',' && q[1] != '\n') {
+                while ((q = scan_find(s, q + 1, FIND_SEP)) < end && *q != '\n') {}
+                return q < end ? q + 1 : end;
+            }
+        }
+        p = q + 1;
+    }
+    return end;
+}
+
+const char *csv_scan_row(csv_scanner_t *s, const char *row, csv_span_t *spans, int max_fields, int *nfields) {
+    const char *end = s->end;
+    const char *p = row;
+    int n = 0;
+    while (1) {
+        if (n >= max_fields) {
+            p = scan_skip_row(s, p, row);
+            break;
+        }
+        csv_span_t sp;
+        const char *q;
+        if (p < end && *p == '"') {
+            sp.start = p + 1;
+            sp.quoted = 1;
+            q = scan_closing_quote(s, sp.start);
+            sp.len = (size_t)(q - sp.start);
+            p = q < end ? q + 1 : end;
+        } else {
+            sp.start = p;
+            sp.quoted = 0;
+            q = scan_find(s, p, FIND_SEP);
+            sp.len = (size_t)(q - p);
+            if (q < end && *q == '\n' && sp.len > 0 && q[-1] == '\r') sp.len--;
+            p = q;
+        }
+        spans[n++] = sp;
+
+        if (p >= end) break;
+        if (*p == ',') { p++; continue; }
+        if (*p == '\n') { p++; break; }
+
+        /* bytes after a closing quote: no more fields, the row ends at the next '\n' */
+        while ((q = scan_find(s, p, FIND_SEP)) < end && *q != '\n') p = q + 1;
+        p = q < end ? q + 1 : end;
+        break;
+    }
+    if (nfields) *nfields = n;
+    return p;
+}
+
+const char *csv_scan_skip_to(csv_scanner_t *s, const char *row, const char *target) {
+    while (row < target && row < s->end) row = csv_scan_row(s, row, NULL, 0, NULL);
+    return row;
+}
+
+size_t csv_span_copy(const csv_span_t *sp, char *out, size_t cap) {
+    size_t o = 0;
+    for (size_t i = 0; i < sp->len && o + 1 < cap; ++i) {
+        out[o++] = sp->start[i];
+        if (sp->quoted && sp->start[i] == '"') i++; /* "" -> " */
+    }
+    out[o] = '\0';
+    return o;
+}
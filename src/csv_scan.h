@@ -0,0 +1,59 @@
+#ifndef CSV_SCAN_H
+#define CSV_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* csv_scan.h
+ *
+ * Row/field splitter for CSV text held in memory (usually a mapping of the
+ * whole file). The buffer is classified 64 bytes at a time into bitmasks of
+ * quotes and of separators (',' and '\n'), with AVX2 or SSE2 compares when
+ * the CPU has them and a scalar loop otherwise; fields are then delimited by
+ * jumping from one set bit to the next, so ordinary bytes are never looked
+ * at one by one.
+ *
+ * Quoting rules: a field starting with '"' runs to the next '"' that is not
+ * doubled ("" is an escaped quote) and may contain ',' and '\n'; a row ends
+ * at the first '\n' outside quotes. Quotes inside an unquoted field are plain
+ * bytes. An unquoted field ending a "\r\n" row does not include the '\r'.
+ * Nothing is copied: fields are returned as spans of the buffer.
+ * Build with -DCSV_SCAN_SCALAR to force the scalar classifier.
+ */
+
+/* Span of one CSV field inside the buffer */
+typedef struct {
+    const char *start;  // first content byte (after the opening quote if quoted)
+    size_t len;         // raw length, escaped quotes count twice
+    int quoted;
+} csv_span_t;
+
+typedef struct {
+    const char *base;   // start of the buffer (blocks are 64 bytes from here)
+    const char *end;
+    const char *blk;    // block described by quote/sep, NULL before the first one
+    uint64_t quote;     // bit i set when blk[i] == '"'
+    uint64_t sep;       // bit i set when blk[i] is ',' or '\n'
+    uint64_t nl;        // bit i set when blk[i] == '\n'
+} csv_scanner_t;
+
+/* scan [base, end) */
+void csv_scanner_init(csv_scanner_t *s, const char *base, const char *end);
+
+/* Split the row starting at row. The first max_fields fields are stored in
+   spans (spans may be NULL when max_fields is 0), the rest of the row is
+   only skipped. *nfields gets the number of fields stored.
+   returns the start of the next row (end after the last one) */
+const char *csv_scan_row(csv_scanner_t *s, const char *row, csv_span_t *spans, int max_fields, int *nfields);
+
+/* start of the first row at or after target, rows being followed from row
+   (a row start). returns end if no row starts there */
+const char *csv_scan_skip_to(csv_scanner_t *s, const char *row, const char *target);
+
+/* Copy at most cap-1 unescaped bytes of a field into out, returns the length */
+size_t csv_span_copy(const csv_span_t *sp, char *out, size_t cap);
+
+/* name of the block classifier in use: "avx2", "sse2" or "scalar" */
+const char *csv_scan_impl(void);
+
+#endif // CSV_SCAN_H
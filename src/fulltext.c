@@ -0,0 +1,618 @@
+#include "fulltext.h"
+#include "records.h"
+#include "arena.h"
+#include "varint.h"
+#include "util.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* A distinct word while building */
+typedef struct {
+    const char *term;    // normalized, arena owned
+    uint16_t len;
+    uint32_t df;
+} term_t;
+
+/* term id by term text, to write the dictionary in order */
+typedef struct {
+    const char *term;
+    uint16_t len;
+    uint32_t id;
+} term_ref_t;
+
+/* Open addressing table of term ids, grown at half load */
+typedef struct fulltext_terms {
+    int32_t *slots;
+    uint32_t mask;
+    term_t *terms;
+    uint32_t n;
+    uint32_t cap;
+} term_table_t;
+
+/* (term, row, tf) of every distinct word of every row, in row order */
+typedef struct fulltext_posting {
+    uint32_t term;
+    uint32_t row;
+    uint32_t tf;
+} posting_t;
+
+static uint64_t term_hash(const char *s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int is_word_byte(unsigned char c) {
+    return c >= 0x80 || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+/* next word of [*p, end) normalized into out (FULLTEXT_TERM_MAX + 1 bytes).
+   returns its length, 0 when there are no more words */
+static size_t next_term(const char **p, const char *end, char *out) {
+    const char *s = *p;
+    while (s < end) {
+        while (s < end && !is_word_byte((unsigned char)*s)) s++;
+        const char *w = s;
+        while (s < end && is_word_byte((unsigned char)*s)) s++;
+        if (s == w) break;
+        size_t len = normalize_text(w, (size_t)(s - w), out, FULLTEXT_TERM_MAX + 1);
+        if (len > 0) {
+            *p = s;
+            return len;
+        }
+    }
+    *p = end;
+    return 0;
+}
+
+static int table_grow(term_table_t *t) {
+    uint32_t slots = t->mask ? (t->mask + 1) * 2 : 1u << 16;
+    int32_t *s = malloc((size_t)slots * sizeof *s);
+    if (!s) return -1;
+    for (uint32_t i = 0; i < slots; ++i) s[i] = -1;
+    for (uint32_t id = 0; id < t->n; ++id) {
+        uint32_t i = (uint32_t)term_hash(t->terms[id].term, t->terms[id].len) & (slots - 1);
+        while (s[i] >= 0) i = (i + 1) & (slots - 1);
+        s[i] = (int32_t)id;
+    }
+    free(t->slots);
+    t->slots = s;
+    t->mask = slots - 1;
+    return 0;
+}
+
+/* id of term, added on first sight. returns -1 when out of memory */
+static int64_t table_get(term_table_t *t, arena_t *arena, const char *term, size_t len) {
+    if ((uint64_t)(t->n + 1) * 2 > (uint64_t)t->mask + 1 && table_grow(t) != 0) return -1;
+    uint32_t i = (uint32_t)term_hash(term, len) & t->mask;
+    while (t->slots[i] >= 0) {
+        const term_t *e = &t->terms[t->slots[i]];
+        if (e->len == len && memcmp(e->term, term, len) == 0) return t->slots[i];
+        i = (i + 1) & t->mask;
+    }
+    if (t->n == t->cap) {
+        uint32_t new_cap = t->cap ? t->cap * 2 : 4096;
+        term_t *tmp = realloc(t->terms, (size_t)new_cap * sizeof *tmp);
+        if (!tmp) return -1;
+        t->terms = tmp;
+        t->cap = new_cap;
+    }
+    term_t *e = &t->terms[t->n];
+    e->term = arena_strndup(arena, term, len);
+    if (!e->term) return -1;
+    e->len = (uint16_t)len;
+    e->df = 0;
+    t->slots[i] = (int32_t)t->n;
+    return t->n++;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+int fulltext_builder_init(fulltext_builder_t *b, uint64_t num_rows) {
+    memset(b, 0, sizeof *b);
+    arena_init(&b->arena, 0);
+    if (num_rows > UINT32_MAX) return -1;
+    b->num_docs = (uint32_t)num_rows;
+    b->table = calloc(1, sizeof *b->table);
+    b->lens = calloc((size_t)b->num_docs + 1, sizeof *b->lens);
+    return b->table && b->lens ? 0 : -1;
+}
+
+/* tokenize the field of one record: its word count into lens, one posting
+   per distinct word */
+int fulltext_builder_add(uint64_t row, const char *p, size_t plen, void *ctx) {
+    fulltext_builder_t *b = ctx;
+    if (row >= b->num_docs) return -1;
+    const char *end = p + plen;
+    char term[FULLTEXT_TERM_MAX + 1];
+    size_t len, nw = 0;
+    while ((len = next_term(&p, end, term)) > 0) {
+        int64_t id = table_get(b->table, &b->arena, term, len);
+        if (id < 0) return -1;
+        if (nw == b->words_cap) {
+            size_t new_cap = b->words_cap ? b->words_cap * 2 : 256;
+            uint32_t *tmp = realloc(b->words, new_cap * sizeof *tmp);
+            if (!tmp) return -1;
+            b->words = tmp;
+            b->words_cap = new_cap;
+        }
+        b->words[nw++] = (uint32_t)id;
+    }
+    b->lens[row] = nw > UINT32_MAX ? UINT32_MAX : (uint32_t)nw;
+    b->total_len += nw;
+
+    /* repeated words of the row become one posting with their count */
+    uint32_t *words = b->words;
+    qsort(words, nw, sizeof *words, cmp_u32);
+    for (size_t w = 0; w < nw;) {
+        size_t run = w;
+        while (run < nw && words[run] == words[w]) run++;
+        if (b->n == b->cap) {
+            size_t new_cap = b->cap ? b->cap * 2 : 65536;
+            posting_t *tmp = realloc(b->postings, new_cap * sizeof *tmp);
+            if (!tmp) return -1;
+            b->postings = tmp;
+            b->cap = new_cap;
+        }
+        posting_t *e = &b->postings[b->n++];
+        e->term = words[w];
+        e->row = (uint32_t)row;
+        e->tf = (uint32_t)(run - w);
+        b->table->terms[words[w]].df++;
+        w = run;
+    }
+    return 0;
+}
+
+void fulltext_builder_free(fulltext_builder_t *b) {
+    if (!b) return;
+    if (b->table) {
+        free(b->table->slots);
+        free(b->table->terms);
+        free(b->table);
+    }
+    free(b->lens);
+    free(b->words);
+    free(b->postings);
+    arena_free(&b->arena);
+    memset(b, 0, sizeof *b);
+}
+
+static int cmp_term_ref(const void *pa, const void *pb) {
+    const term_ref_t *a = pa, *b = pb;
+    return cmp_keys(a->term, a->len, b->term, b->len);
+}
+
+/* append the bytes and the blocked list of one term to o, filling its
+   dictionary entry */
+static int encode_term(out_buf_t *o, const term_t *t, const posting_t *list, const uint32_t *lens,
+    unsigned char *entry)
+{
+    uint32_t num_blocks = (t->df + FULLTEXT_BLOCK_DOCS - 1) / FULLTEXT_BLOCK_DOCS;
+    uint64_t term_off = o->len;
+    unsigned char *p = out_reserve(o, t->len + (size_t)num_blocks * 8);
+    if (!p) return -1;
+    memcpy(p, t->term, t->len);
+    o->len += t->len;
+    uint64_t list_off = o->len;
+    size_t skips = o->len;
+    o->len += (size_t)num_blocks * 8;
+    size_t blocks = o->len;
+
+    uint32_t max_tf = 0, min_len = UINT32_MAX, prev = 0;
+    for (uint32_t b = 0; b < num_blocks; ++b) {
+        uint32_t first = b * FULLTEXT_BLOCK_DOCS;
+        uint32_t last = first + FULLTEXT_BLOCK_DOCS < t->df ? first + FULLTEXT_BLOCK_DOCS : t->df;
+        if (!(p = out_reserve(o, (size_t)(last - first) * 2 * VARINT_MAX_BYTES))) return -1;
+        for (uint32_t i = first; i < last; ++i) {
+            p += varint_put(p, list[i].row - prev);
+            p += varint_put(p, list[i].tf);
+            prev = list[i].row;
+            if (list[i].tf > max_tf) max_tf = list[i].tf;
+            if (lens[list[i].row] < min_len) min_len = lens[list[i].row];
+        }
+        o->len = (size_t)(p - o->buf);
+        uint32_t end = (uint32_t)(o->len - blocks);
+        memcpy(o->buf + skips + (size_t)b * 8, &prev, sizeof prev);
+        memcpy(o->buf + skips + (size_t)b * 8 + 4, &end, sizeof end);
+    }
+
+    memset(entry, 0, FULLTEXT_DICT_ENTRY);
+    memcpy(entry, &list_off, sizeof list_off);
+    memcpy(entry + 8, &term_off, sizeof term_off);
+    memcpy(entry + 16, &t->df, sizeof t->df);
+    memcpy(entry + 20, &max_tf, sizeof max_tf);
+    memcpy(entry + 24, &min_len, sizeof min_len);
+    memcpy(entry + 28, &num_blocks, sizeof num_blocks);
+    memcpy(entry + 32, &t->len, sizeof t->len);
+    return 0;
+}
+
+int fulltext_build(const char *records_path, int field_idx, const char *out_path) {
+    if (field_idx < 0 || field_idx >= NUM_DATASET_FIELDS) return -1;
+    records_t r;
+    if (records_open(&r, records_path) != 0) return -1;
+    fulltext_builder_t b;
+    int rc = fulltext_builder_init(&b, r.num_rows);
+    if (rc == 0) rc = records_for_each_field(&r, field_idx, fulltext_builder_add, &b);
+    records_close(&r);
+    if (rc == 0) rc = fulltext_builder_write(&b, out_path);
+    fulltext_builder_free(&b);
+    return rc;
+}
+
+int fulltext_builder_write(fulltext_builder_t *b, const char *out_path) {
+    const term_table_t *table = b->table;
+    const posting_t *postings = b->postings;
+    const uint32_t *lens = b->lens;
+    posting_t *sorted = NULL;
+    term_ref_t *order = NULL;
+    uint32_t *starts = NULL;
+    size_t n = b->n;
+    uint64_t total_len = b->total_len;
+    uint32_t num_docs = b->num_docs;
+    out_buf_t o = {0};
+    int rc = 0;
+
+    /* group the postings by term, keeping the row order inside each */
+    if (rc == 0) {
+        sorted = malloc((n ? n : 1) * sizeof *sorted);
+        starts = calloc((size_t)table->n + 1, sizeof *starts);
+        order = malloc(((size_t)table->n + 1) * sizeof *order);
+        if (!sorted || !starts || !order) rc = -1;
+    }
+    if (rc == 0) {
+        for (uint32_t t = 0; t < table->n; ++t) starts[t + 1] = starts[t] + table->terms[t].df;
+        for (size_t i = 0; i < n; ++i) sorted[starts[postings[i].term]++] = postings[i];
+        for (uint32_t t = 0; t < table->n; ++t) starts[t] -= table->terms[t].df;
+        for (uint32_t t = 0; t < table->n; ++t) {
+            order[t].term = table->terms[t].term;
+            order[t].len = table->terms[t].len;
+            order[t].id = t;
+        }
+        qsort(order, table->n, sizeof *order, cmp_term_ref);
+    }
+
+    uint64_t lens_off = FULLTEXT_HEADER_SIZE;
+    uint64_t dict_off = lens_off + (uint64_t)num_docs * sizeof(uint32_t);
+    uint64_t data_off = dict_off + (uint64_t)table->n * FULLTEXT_DICT_ENTRY;
+    if (rc == 0 && !out_reserve(&o, (size_t)data_off)) rc = -1;
+    if (rc == 0) {
+        memset(o.buf, 0, (size_t)data_off);
+        if (num_docs) memcpy(o.buf + lens_off, lens, (size_t)num_docs * sizeof *lens);
+        o.len = (size_t)data_off;
+        for (uint32_t i = 0; rc == 0 && i < table->n; ++i) {
+            unsigned char entry[FULLTEXT_DICT_ENTRY];
+            const term_t *t = &table->terms[order[i].id];
+            rc = encode_term(&o, t, sorted + starts[order[i].id], lens, entry);
+            if (rc == 0) memcpy(o.buf + dict_off + (size_t)i * FULLTEXT_DICT_ENTRY, entry, sizeof entry);
+        }
+    }
+    if (rc == 0) {
+        unsigned char *h = o.buf;
+        uint16_t version = FULLTEXT_VERSION;
+        uint32_t block_docs = FULLTEXT_BLOCK_DOCS;
+        memcpy(h, FULLTEXT_MAGIC, 4);
+        memcpy(h + 4, &version, sizeof version);
+        memcpy(h + 8, &num_docs, sizeof num_docs);
+        memcpy(h + 12, &table->n, sizeof table->n);
+        memcpy(h + 16, &block_docs, sizeof block_docs);
+        memcpy(h + 24, &total_len, sizeof total_len);
+        memcpy(h + 32, &lens_off, sizeof lens_off);
+        memcpy(h + 40, &dict_off, sizeof dict_off);
+        memcpy(h + 48, &data_off, sizeof data_off);
+
+        int fd = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0) {
+            rc = -1;
+        } else {
+            if (safe_pwrite(fd, o.buf, o.len, 0) != (ssize_t)o.len) rc = -1;
+            if (close(fd) != 0) rc = -1;
+        }
+    }
+
+    free(o.buf);
+    free(order);
+    free(starts);
+    free(sorted);
+    return rc;
+}
+
+int fulltext_open(fulltext_index_t *f, const char *path) {
+    memset(f, 0, sizeof *f);
+    f->fd = -1;
+    if (map_file(path, FULLTEXT_HEADER_SIZE, &f->fd, &f->map, &f->map_len) != 0) return -1;
+
+    uint16_t version;
+    uint32_t block_docs;
+    uint64_t total_len, lens_off, dict_off, data_off;
+    memcpy(&version, f->map + 4, sizeof version);
+    memcpy(&f->num_docs, f->map + 8, sizeof f->num_docs);
+    memcpy(&f->num_terms, f->map + 12, sizeof f->num_terms);
+    memcpy(&block_docs, f->map + 16, sizeof block_docs);
+    memcpy(&total_len, f->map + 24, sizeof total_len);
+    memcpy(&lens_off, f->map + 32, sizeof lens_off);
+    memcpy(&dict_off, f->map + 40, sizeof dict_off);
+    memcpy(&data_off, f->map + 48, sizeof data_off);
+    if (memcmp(f->map, FULLTEXT_MAGIC, 4) != 0 || version != FULLTEXT_VERSION ||
+        block_docs != FULLTEXT_BLOCK_DOCS || lens_off != FULLTEXT_HEADER_SIZE ||
+        dict_off != lens_off + (uint64_t)f->num_docs * sizeof(uint32_t) ||
+        data_off != dict_off + (uint64_t)f->num_terms * FULLTEXT_DICT_ENTRY || data_off > f->map_len) {
+        fulltext_close(f);
+        return -1;
+    }
+    f->lens = f->map + lens_off;
+    f->dict = f->map + dict_off;
+    f->data = f->map + data_off;
+    f->avg_len = f->num_docs ? (double)total_len / f->num_docs : 0.0;
+    return 0;
+}
+
+void fulltext_close(fulltext_index_t *f) {
+    if (!f) return;
+    unmap_file(f->fd, f->map, f->map_len);
+    memset(f, 0, sizeof *f);
+    f->fd = -1;
+}
+
+/* Dictionary entry of one term */
+typedef struct {
+    uint64_t list_off;
+    uint64_t term_off;
+    uint32_t df;
+    uint32_t max_tf;
+    uint32_t min_len;
+    uint32_t num_blocks;
+    uint16_t term_len;
+} dict_entry_t;
+
+static void read_entry(const fulltext_index_t *f, uint32_t i, dict_entry_t *e) {
+    const unsigned char *p = f->dict + (size_t)i * FULLTEXT_DICT_ENTRY;
+    memcpy(&e->list_off, p, sizeof e->list_off);
+    memcpy(&e->term_off, p + 8, sizeof e->term_off);
+    memcpy(&e->df, p + 16, sizeof e->df);
+    memcpy(&e->max_tf, p + 20, sizeof e->max_tf);
+    memcpy(&e->min_len, p + 24, sizeof e->min_len);
+    memcpy(&e->num_blocks, p + 28, sizeof e->num_blocks);
+    memcpy(&e->term_len, p + 32, sizeof e->term_len);
+}
+
+/* binary search of the dictionary. returns 1 with *e filled, 0 if the term
+   is not there, -1 if corrupt */
+static int find_term(const fulltext_index_t *f, const char *term, size_t len, dict_entry_t *e) {
+    uint32_t lo = 0, hi = f->num_terms;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        read_entry(f, mid, e);
+        if (e->term_off > f->map_len || e->term_len > f->map_len - e->term_off) return -1;
+        int c = cmp_keys((const char *)f->map + e->term_off, e->term_len, term, len);
+        if (c == 0) return 1;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+/* Cursor over the postings of one query term */
+typedef struct {
+    const unsigned char *skips;   // num_blocks (last row, end)
+    const unsigned char *blocks;
+    const unsigned char *p;
+    const unsigned char *block_end;
+    const unsigned char *end;
+    uint32_t num_blocks;
+    uint32_t block;
+    uint32_t row;
+    uint32_t tf;
+    int done;
+    double idf;
+    double ub;                    // highest score the term adds to a row
+} list_cursor_t;
+
+static uint32_t skip_field(const list_cursor_t *c, uint32_t block, int which) {
+    uint32_t v;
+    memcpy(&v, c->skips + (size_t)block * 8 + (size_t)which * 4, sizeof v);
+    return v;
+}
+
+/* position c at the start of block b. returns 0, -1 if corrupt */
+static int enter_block(list_cursor_t *c, uint32_t b) {
+    uint32_t start = b ? skip_field(c, b - 1, 1) : 0;
+    uint32_t stop = skip_field(c, b, 1);
+    if (start > stop || stop > (size_t)(c->end - c->blocks)) return -1;
+    c->block = b;
+    c->p = c->blocks + start;
+    c->block_end = c->blocks + stop;
+    c->row = b ? skip_field(c, b - 1, 0) : 0;
+    return 0;
+}
+
+/* advance to the next posting. returns 0 (c->done at the end), -1 if corrupt */
+static int cursor_next(list_cursor_t *c) {
+    if (c->p == c->block_end) {
+        if (c->block + 1 >= c->num_blocks) {
+            c->done = 1;
+            return 0;
+        }
+        if (enter_block(c, c->block + 1) != 0) return -1;
+    }
+    uint64_t delta, tf;
+    size_t u;
+    if ((u = varint_get(c->p, c->block_end, &delta)) == 0) return -1;
+    c->p += u;
+    if ((u = varint_get(c->p, c->block_end, &tf)) == 0) return -1;
+    c->p += u;
+    if (delta > UINT32_MAX - c->row || tf > UINT32_MAX) return -1;
+    c->row += (uint32_t)delta;
+    c->tf = (uint32_t)tf;
+    return 0;
+}
+
+/* advance to the first posting with row >= target, jumping over the blocks
+   that end before it */
+static int cursor_seek(list_cursor_t *c, uint32_t target) {
+    if (c->done || c->row >= target) return 0;
+    if (skip_field(c, c->block, 0) < target) {
+        uint32_t b = c->block + 1;
+        while (b < c->num_blocks && skip_field(c, b, 0) < target) b++;
+        if (b == c->num_blocks) {
+            c->done = 1;
+            return 0;
+        }
+        if (enter_block(c, b) != 0) return -1;
+    }
+    while (!c->done && c->row < target) {
+        if (cursor_next(c) != 0) return -1;
+    }
+    return 0;
+}
+
+static double bm25(const fulltext_index_t *f, double idf, uint32_t tf, uint32_t len) {
+    double norm = FULLTEXT_K1 * (1.0 - FULLTEXT_B + FULLTEXT_B * (f->avg_len > 0 ? len / f->avg_len : 0.0));
+    return idf * (tf * (FULLTEXT_K1 + 1.0)) / (tf + norm);
+}
+
+static uint32_t doc_len(const fulltext_index_t *f, uint32_t row) {
+    uint32_t v = 0;
+    if (row < f->num_docs) memcpy(&v, f->lens + (size_t)row * sizeof v, sizeof v);
+    return v;
+}
+
+/* worse hit first: lower score, then higher row */
+static int hit_worse(const fulltext_hit_t *a, const fulltext_hit_t *b) {
+    if (a->score != b->score) return a->score < b->score;
+    return a->row > b->row;
+}
+
+static void heap_down(fulltext_hit_t *h, uint32_t n, uint32_t i) {
+    while (1) {
+        uint32_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && hit_worse(&h[l], &h[m])) m = l;
+        if (r < n && hit_worse(&h[r], &h[m])) m = r;
+        if (m == i) return;
+        fulltext_hit_t tmp = h[i];
+        h[i] = h[m];
+        h[m] = tmp;
+        i = m;
+    }
+}
+
+static void heap_up(fulltext_hit_t *h, uint32_t i) {
+    while (i > 0 && hit_worse(&h[i], &h[(i - 1) / 2])) {
+        fulltext_hit_t tmp = h[i];
+        h[i] = h[(i - 1) / 2];
+        h[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static int cmp_ub(const void *pa, const void *pb) {
+    const list_cursor_t *a = pa, *b = pb;
+    return (a->ub > b->ub) - (a->ub < b->ub);
+}
+
+static int cmp_hit(const void *pa, const void *pb) {
+    const fulltext_hit_t *a = pa, *b = pb;
+    return hit_worse(a, b) ? 1 : hit_worse(b, a) ? -1 : 0;
+}
+
+/* open a cursor on the postings of e at its first posting */
+static int cursor_open(const fulltext_index_t *f, const dict_entry_t *e, list_cursor_t *c) {
+    memset(c, 0, sizeof *c);
+    if (e->num_blocks == 0 || e->list_off > f->map_len ||
+        (f->map_len - e->list_off) / 8 < e->num_blocks) return -1;
+    c->skips = f->map + e->list_off;
+    c->blocks = c->skips + (size_t)e->num_blocks * 8;
+    c->end = f->map + f->map_len;
+    c->num_blocks = e->num_blocks;
+    c->idf = log(1.0 + (f->num_docs - e->df + 0.5) / (e->df + 0.5));
+    c->ub = bm25(f, c->idf, e->max_tf, e->min_len);
+    if (enter_block(c, 0) != 0) return -1;
+    return cursor_next(c);
+}
+
+int fulltext_search(const fulltext_index_t *f, const char *query, fulltext_hit_t *out, uint32_t k) {
+    if (!f || !f->map || !out) return -1;
+    if (k == 0 || !query) return 0;
+
+    /* distinct words of the query that occur somewhere */
+    list_cursor_t cur[FULLTEXT_QUERY_TERMS];
+    char seen[FULLTEXT_QUERY_TERMS][FULLTEXT_TERM_MAX + 1];
+    uint32_t m = 0, nseen = 0;
+    const char *p = query, *end = query + strlen(query);
+    char term[FULLTEXT_TERM_MAX + 1];
+    size_t len;
+    while (nseen < FULLTEXT_QUERY_TERMS && (len = next_term(&p, end, term)) > 0) {
+        uint32_t s = 0;
+        while (s < nseen && strcmp(seen[s], term) != 0) s++;
+        if (s < nseen) continue;
+        memcpy(seen[nseen++], term, len + 1);
+        dict_entry_t e;
+        int rc = find_term(f, term, len, &e);
+        if (rc < 0) return -1;
+        if (rc == 0) continue;
+        if (cursor_open(f, &e, &cur[m]) != 0) return -1;
+        m++;
+    }
+    if (m == 0) return 0;
+
+    /* MaxScore: with the lists by increasing bound, the first ones whose
+       bounds add up to no more than the k-th best score cannot make a row
+       enter on their own; rows are taken from the others (essential) and
+       the first ones are only probed for those rows */
+    qsort(cur, m, sizeof *cur, cmp_ub);
+    double cum[FULLTEXT_QUERY_TERMS];
+    for (uint32_t i = 0; i < m; ++i) cum[i] = cur[i].ub + (i ? cum[i - 1] : 0.0);
+
+    uint32_t n = 0, essential = 0;
+    double threshold = 0.0;
+    while (essential < m) {
+        uint32_t row = UINT32_MAX;
+        for (uint32_t i = essential; i < m; ++i) {
+            if (!cur[i].done && cur[i].row < row) row = cur[i].row;
+        }
+        if (row == UINT32_MAX) break;
+
+        uint32_t dl = doc_len(f, row);
+        double score = 0.0;
+        for (uint32_t i = essential; i < m; ++i) {
+            if (cur[i].done || cur[i].row != row) continue;
+            score += bm25(f, cur[i].idf, cur[i].tf, dl);
+            if (cursor_next(&cur[i]) != 0) return -1;
+        }
+        for (uint32_t i = essential; i-- > 0;) {
+            if (n == k && score + cum[i] <= threshold) break;
+            if (cursor_seek(&cur[i], row) != 0) return -1;
+            if (!cur[i].done && cur[i].row == row) score += bm25(f, cur[i].idf, cur[i].tf, dl);
+        }
+
+        fulltext_hit_t hit = {row, score};
+        if (n < k) {
+            out[n] = hit;
+            heap_up(out, n++);
+        } else if (hit_worse(&out[0], &hit)) {
+            out[0] = hit;
+            heap_down(out, n, 0);
+        } else {
+            continue;
+        }
+        if (n == k) {
+            threshold = out[0].score;
+            while (essential < m && cum[essential] <= threshold) essential++;
+        }
+    }
+
+    qsort(out, n, sizeof *out, cmp_hit);
+    return (int)n;
+}
@@ -0,0 +1,105 @@
+#ifndef FULLTEXT_H
+#define FULLTEXT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "arena.h"
+
+/* fulltext.h
+ *
+ * Inverted index over the words of a free text column (the descriptions,
+ * <dir>/description_fulltext.dat), ranked with BM25. Words are runs of
+ * letters and digits, normalized like the keys of the hash index but whole
+ * (up to FULLTEXT_TERM_MAX characters).
+ *
+ * File layout (host byte order):
+ * - header (FULLTEXT_HEADER_SIZE bytes):
+ *   magic "FTX1", version u16, reserved u16, num_docs u32, num_terms u32,
+ *   block_docs u32, reserved u32, total_len u64 (words of every document),
+ *   lens_off u64, dict_off u64, data_off u64
+ * - lens: u32 words of every row of records.dat
+ * - dict: num_terms entries of FULLTEXT_DICT_ENTRY bytes, sorted by term:
+ *   list_off u64, term_off u64, df u32 (rows with the term), max_tf u32,
+ *   min_len u32 (shortest row with the term), num_blocks u32,
+ *   term_len u16, reserved u16 + u32
+ * - data: for every term its bytes, then its list: num_blocks skip entries
+ *   (last row u32, end u32: bytes from the first block to the end of this
+ *   one), then the blocks of up to block_docs postings, each a varint row
+ *   delta (from the last row of the previous block) and a varint tf.
+ *
+ * max_tf and min_len bound the score a term can add to any row, which lets
+ * a top-k search skip the rows that cannot enter the results (MaxScore);
+ * the skip entries let it jump over whole blocks of those.
+ */
+
+#define FULLTEXT_MAGIC "FTX1"
+#define FULLTEXT_VERSION 1
+#define FULLTEXT_HEADER_SIZE 64
+#define FULLTEXT_DICT_ENTRY 40
+#define FULLTEXT_BLOCK_DOCS 128
+#define FULLTEXT_TERM_MAX 32      // normalized characters kept per word
+#define FULLTEXT_QUERY_TERMS 16   // distinct words of a query used, the rest are ignored
+#define FULLTEXT_FILE "description_fulltext.dat"
+
+/* BM25 parameters */
+#define FULLTEXT_K1 1.2
+#define FULLTEXT_B 0.75
+
+typedef struct {
+    int fd;
+    const unsigned char *map;
+    size_t map_len;
+    uint32_t num_docs;
+    uint32_t num_terms;
+    double avg_len;
+    const unsigned char *lens;   // num_docs u32
+    const unsigned char *dict;   // num_terms entries
+    const unsigned char *data;
+} fulltext_index_t;
+
+typedef struct {
+    uint64_t row;
+    double score;
+} fulltext_hit_t;
+
+/* write out_path from the field field_idx of every record of records_path.
+   returns 0 or -1 */
+int fulltext_build(const char *records_path, int field_idx, const char *out_path);
+
+/* Incremental form of fulltext_build for a caller that scans records.dat
+   itself: init with the number of rows, fulltext_builder_add (a
+   records_field_cb) the column of every record, then fulltext_builder_write */
+typedef struct {
+    arena_t arena;                     // term texts
+    struct fulltext_terms *table;      // term ids by text
+    uint32_t *lens;                    // words of every row
+    uint32_t num_docs;
+    uint32_t *words;                   // term ids of the row being added
+    size_t words_cap;
+    struct fulltext_posting *postings;
+    size_t n;
+    size_t cap;
+    uint64_t total_len;
+} fulltext_builder_t;
+
+/* returns 0, or -1 (too many rows, out of memory) after which only
+   fulltext_builder_free may be called */
+int fulltext_builder_init(fulltext_builder_t *b, uint64_t num_rows);
+
+int fulltext_builder_add(uint64_t row, const char *field, size_t len, void *b);
+
+/* returns 0 or -1 */
+int fulltext_builder_write(fulltext_builder_t *b, const char *out_path);
+
+void fulltext_builder_free(fulltext_builder_t *b);
+
+/* map a fulltext file read-only. returns 0 or -1 */
+int fulltext_open(fulltext_index_t *f, const char *path);
+
+void fulltext_close(fulltext_index_t *f);
+
+/* the k rows with the best BM25 score for the words of query, best first
+   (ties by row). returns how many, or -1 on a corrupt file */
+int fulltext_search(const fulltext_index_t *f, const char *query, fulltext_hit_t *out, uint32_t k);
+
+#endif // FULLTEXT_H
@@ -0,0 +1,253 @@
+#include "genres.h"
+#include "records.h"
+#include "util.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* A genre while building, with its rows in order */
+typedef struct genres_genre {
+    char name[GENRES_NAME_MAX + 1];
+    uint16_t name_len;
+    uint32_t *rows;
+    uint32_t n;
+    uint32_t cap;
+} genre_t;
+
+/* next genre of the comma separated [*p, end), normalized into out
+   (GENRES_NAME_MAX + 1 bytes). returns its length, 0 when there are no more */
+static size_t next_genre(const char **p, const char *end, char *out) {
+    const char *s = *p;
+    while (s < end) {
+        const char *g = s;
+        while (s < end && *s != ',') s++;
+        size_t len = normalize_text(g, (size_t)(s - g), out, GENRES_NAME_MAX + 1);
+        if (s < end) s++;
+        if (len > 0) {
+            *p = s;
+            return len;
+        }
+    }
+    *p = end;
+    return 0;
+}
+
+/* add row to the genre name, created on first sight */
+static int genre_add(genres_builder_t *l, const char *name, size_t len, uint32_t row) {
+    uint32_t lo = 0, hi = l->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cmp_keys(l->items[mid].name, l->items[mid].name_len, name, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == l->n || cmp_keys(l->items[lo].name, l->items[lo].name_len, name, len) != 0) {
+        if (l->n == l->cap) {
+            uint32_t new_cap = l->cap ? l->cap * 2 : 64;
+            genre_t *tmp = realloc(l->items, (size_t)new_cap * sizeof *tmp);
+            if (!tmp) return -1;
+            l->items = tmp;
+            l->cap = new_cap;
+        }
+        memmove(&l->items[lo + 1], &l->items[lo], (size_t)(l->n - lo) * sizeof *l->items);
+        genre_t *g = &l->items[lo];
+        memcpy(g->name, name, len);
+        g->name_len = (uint16_t)len;
+        g->rows = NULL;
+        g->n = 0;
+        g->cap = 0;
+        l->n++;
+    }
+    genre_t *g = &l->items[lo];
+    /* a genre listed twice by the same book */
+    if (g->n > 0 && g->rows[g->n - 1] == row) return 0;
+    if (g->n == g->cap) {
+        uint32_t new_cap = g->cap ? g->cap * 2 : 1024;
+        uint32_t *tmp = realloc(g->rows, (size_t)new_cap * sizeof *tmp);
+        if (!tmp) return -1;
+        g->rows = tmp;
+        g->cap = new_cap;
+    }
+    g->rows[g->n++] = row;
+    return 0;
+}
+
+int genres_builder_init(genres_builder_t *b, uint64_t num_rows) {
+    memset(b, 0, sizeof *b);
+    if (num_rows > UINT32_MAX) return -1;
+    b->num_rows = (uint32_t)num_rows;
+    return 0;
+}
+
+int genres_builder_add(uint64_t row, const char *p, size_t plen, void *ctx) {
+    genres_builder_t *b = ctx;
+    if (row >= b->num_rows) return -1;
+    const char *end = p + plen;
+    char name[GENRES_NAME_MAX + 1];
+    size_t len;
+    while ((len = next_genre(&p, end, name)) > 0) {
+        if (genre_add(b, name, len, (uint32_t)row) != 0) return -1;
+    }
+    return 0;
+}
+
+void genres_builder_free(genres_builder_t *b) {
+    if (!b) return;
+    for (uint32_t i = 0; i < b->n; ++i) free(b->items[i].rows);
+    free(b->items);
+    memset(b, 0, sizeof *b);
+}
+
+int genres_build(const char *records_path, int field_idx, const char *out_path) {
+    if (field_idx < 0 || field_idx >= NUM_DATASET_FIELDS) return -1;
+    records_t r;
+    if (records_open(&r, records_path) != 0) return -1;
+    genres_builder_t b;
+    int rc = genres_builder_init(&b, r.num_rows);
+    if (rc == 0) rc = records_for_each_field(&r, field_idx, genres_builder_add, &b);
+    records_close(&r);
+    if (rc == 0) rc = genres_builder_write(&b, out_path);
+    genres_builder_free(&b);
+    return rc;
+}
+
+int genres_builder_write(genres_builder_t *b, const char *out_path) {
+    /* the header and dictionary go first, names and bitmaps after them */
+    uint64_t dict_off = GENRES_HEADER_SIZE;
+    uint64_t data_off = dict_off + (uint64_t)b->n * GENRES_DICT_ENTRY;
+    int fd = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    int rc = fd >= 0 ? 0 : -1;
+    uint64_t at = data_off;
+    bitmap_t bm = {0};
+    for (uint32_t i = 0; rc == 0 && i < b->n; ++i) {
+        const genre_t *g = &b->items[i];
+        if (bitmap_build(&bm, g->rows, g->n) != 0 || bm.len > UINT32_MAX) { rc = -1; break; }
+        unsigned char entry[GENRES_DICT_ENTRY] = {0};
+        uint64_t bitmap_off = at + g->name_len;
+        uint32_t bitmap_len = (uint32_t)bm.len;
+        memcpy(entry, &at, sizeof at);
+        memcpy(entry + 8, &bitmap_off, sizeof bitmap_off);
+        memcpy(entry + 16, &bitmap_len, sizeof bitmap_len);
+        memcpy(entry + 20, &g->n, sizeof g->n);
+        memcpy(entry + 24, &g->name_len, sizeof g->name_len);
+        if (safe_pwrite(fd, entry, sizeof entry, (off_t)(dict_off + (uint64_t)i * GENRES_DICT_ENTRY)) != (ssize_t)sizeof entry ||
+            safe_pwrite(fd, g->name, g->name_len, (off_t)at) != (ssize_t)g->name_len ||
+            safe_pwrite(fd, bm.buf, bm.len, (off_t)bitmap_off) != (ssize_t)bm.len) {
+            rc = -1;
+        }
+        at = bitmap_off + bm.len;
+    }
+    bitmap_free(&bm);
+    if (rc == 0) {
+        unsigned char header[GENRES_HEADER_SIZE] = {0};
+        uint16_t version = GENRES_VERSION;
+        memcpy(header, GENRES_MAGIC, 4);
+        memcpy(header + 4, &version, sizeof version);
+        memcpy(header + 8, &b->n, sizeof b->n);
+        memcpy(header + 12, &b->num_rows, sizeof b->num_rows);
+        memcpy(header + 16, &dict_off, sizeof dict_off);
+        memcpy(header + 24, &data_off, sizeof data_off);
+        if (safe_pwrite(fd, header, sizeof header, 0) != (ssize_t)sizeof header) rc = -1;
+    }
+    if (fd >= 0 && close(fd) != 0) rc = -1;
+    return rc;
+}
+
+int genres_open(genres_index_t *g, const char *path) {
+    memset(g, 0, sizeof *g);
+    g->fd = -1;
+    if (map_file(path, GENRES_HEADER_SIZE, &g->fd, &g->map, &g->map_len) != 0) return -1;
+
+    uint16_t version;
+    uint64_t dict_off, data_off;
+    memcpy(&version, g->map + 4, sizeof version);
+    memcpy(&g->num_genres, g->map + 8, sizeof g->num_genres);
+    memcpy(&g->num_rows, g->map + 12, sizeof g->num_rows);
+    memcpy(&dict_off, g->map + 16, sizeof dict_off);
+    memcpy(&data_off, g->map + 24, sizeof data_off);
+    if (memcmp(g->map, GENRES_MAGIC, 4) != 0 || version != GENRES_VERSION || dict_off != GENRES_HEADER_SIZE ||
+        data_off != dict_off + (uint64_t)g->num_genres * GENRES_DICT_ENTRY || data_off > g->map_len) {
+        genres_close(g);
+        return -1;
+    }
+    g->dict = g->map + dict_off;
+    return 0;
+}
+
+void genres_close(genres_index_t *g) {
+    if (!g) return;
+    unmap_file(g->fd, g->map, g->map_len);
+    memset(g, 0, sizeof *g);
+    g->fd = -1;
+}
+
+/* bitmap of the genre name. returns 1 with it in *bm and *len, 0 if there is
+   no such genre, -1 if corrupt */
+static int find_genre(const genres_index_t *g, const char *name, size_t len,
+    const unsigned char **bm, size_t *bm_len)
+{
+    uint32_t lo = 0, hi = g->num_genres;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const unsigned char *e = g->dict + (size_t)mid * GENRES_DICT_ENTRY;
+        uint64_t name_off;
+        uint16_t name_len;
+        memcpy(&name_off, e, sizeof name_off);
+        memcpy(&name_len, e + 24, sizeof name_len);
+        if (name_off > g->map_len || name_len > g->map_len - name_off) return -1;
+        int c = cmp_keys((const char *)g->map + name_off, name_len, name, len);
+        if (c < 0) {
+            lo = mid + 1;
+        } else if (c > 0) {
+            hi = mid;
+        } else {
+            uint64_t off;
+            uint32_t blen;
+            memcpy(&off, e + 8, sizeof off);
+            memcpy(&blen, e + 16, sizeof blen);
+            if (off > g->map_len || blen > g->map_len - off) return -1;
+            *bm = g->map + off;
+            *bm_len = blen;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int genres_match(const genres_index_t *g, const char *list, bitmap_t *out) {
+    if (!g || !g->map || !list || !out) return -1;
+    const char *p = list, *end = list + strlen(list);
+    char name[GENRES_NAME_MAX + 1];
+    size_t len;
+    bitmap_t tmp = {0};
+    int first = 1, rc = 0;
+    while (rc == 0 && (len = next_genre(&p, end, name)) > 0) {
+        const unsigned char *bm;
+        size_t bm_len;
+        int found = find_genre(g, name, len, &bm, &bm_len);
+        if (found < 0) {
+            rc = -1;
+        } else if (found == 0) {
+            /* nothing has it: the empty bitmap */
+            rc = bitmap_build(out, NULL, 0);
+            first = 0;
+            break;
+        } else if (first) {
+            rc = bitmap_copy(out, bm, bm_len);
+            first = 0;
+        } else {
+            /* rows of every genre so far, one AND per genre */
+            rc = bitmap_and(&tmp, out->buf, out->len, bm, bm_len);
+            if (rc == 0) {
+                bitmap_t swap = *out;
+                *out = tmp;
+                tmp = swap;
+            }
+        }
+    }
+    bitmap_free(&tmp);
+    if (first) return -1;
+    return rc;
+}
@@ -0,0 +1,75 @@
+#ifndef GENRES_H
+#define GENRES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bitmap.h"
+
+/* genres.h
+ *
+ * Genre index (<dir>/genre_bitmaps.dat): the genres column holds a comma
+ * separated list per book; every genre, normalized, gets the bitmap
+ * (bitmap.h) of the rows of records.dat that list it. Genres are few and
+ * each one covers a large share of the rows, which is where bitmaps are much
+ * smaller than lists of row numbers and intersect faster.
+ *
+ * File layout (host byte order):
+ * - header (GENRES_HEADER_SIZE bytes):
+ *   magic "GNR1", version u16, reserved u16, num_genres u32, num_rows u32,
+ *   dict_off u64, data_off u64
+ * - dict: num_genres entries of GENRES_DICT_ENTRY bytes, sorted by name:
+ *   name_off u64, bitmap_off u64, bitmap_len u32, rows u32,
+ *   name_len u16, reserved u16 + u32
+ * - data: names and bitmaps
+ */
+
+#define GENRES_MAGIC "GNR1"
+#define GENRES_VERSION 1
+#define GENRES_HEADER_SIZE 64
+#define GENRES_DICT_ENTRY 32
+#define GENRES_NAME_MAX 64     // normalized characters kept per genre
+#define GENRES_FILE "genre_bitmaps.dat"
+
+typedef struct {
+    int fd;
+    const unsigned char *map;
+    size_t map_len;
+    uint32_t num_genres;
+    uint32_t num_rows;
+    const unsigned char *dict;
+} genres_index_t;
+
+/* write out_path from the field field_idx of every record of records_path.
+   returns 0 or -1 */
+int genres_build(const char *records_path, int field_idx, const char *out_path);
+
+/* genres_build one record at a time: init with the number of rows of
+   records.dat, genres_builder_add (a records_field_cb) the genres of every
+   record in row order, then genres_builder_write */
+typedef struct {
+    struct genres_genre *items;    // sorted by name
+    uint32_t n;
+    uint32_t cap;
+    uint32_t num_rows;
+} genres_builder_t;
+
+/* returns 0, or -1 when there are too many rows */
+int genres_builder_init(genres_builder_t *b, uint64_t num_rows);
+
+int genres_builder_add(uint64_t row, const char *field, size_t len, void *b);
+
+/* returns 0 or -1 */
+int genres_builder_write(genres_builder_t *b, const char *out_path);
+
+void genres_builder_free(genres_builder_t *b);
+
+/* map a genre file read-only. returns 0 or -1 */
+int genres_open(genres_index_t *g, const char *path);
+
+void genres_close(genres_index_t *g);
+
+/* rows that have every genre of the comma separated list into out (an
+   unknown genre leaves it empty). returns 0, -1 on error or an empty list */
+int genres_match(const genres_index_t *g, const char *list, bitmap_t *out);
+
+#endif // GENRES_H
@@ -13,4 +13,10 @@ static inline uint64_t bucket_id_from_hash(uint64_t h, uint64_t mask) {
     return h & mask;
 }
 
+/* 32-bit tag stored next to keys in tagged layouts: the bits of the hash not
+   used to pick the bucket (for tables of up to 2^32 buckets) */
+static inline uint32_t hash_tag(uint64_t h) {
+    return (uint32_t)(h >> 32);
+}
+
 #endif // HASH_H
@@ -0,0 +1,141 @@
+#include "index_ops.h"
+#include "index_writer.h"
+#include "keymap.h"
+#include "arrays.h"
+#include "buckets.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+int index_compute_stats(index_handle_t *h, index_stats_t *stats) {
+    memset(stats, 0, sizeof *stats);
+    stats->num_buckets = h->num_buckets;
+    stats->flags = h->flags;
+    struct stat st;
+    if (fstat(h->arrays_fd, &st) == 0) stats->arrays_bytes = (uint64_t)st.st_size;
+
+    arrays_cursor_t cur;
+    arrays_node_view_t view;
+    for (uint64_t b = 0; b < h->num_buckets; ++b) {
+        bucket_entry_t entry;
+        if (index_read_bucket(h, b, &entry) != 0) return -1;
+        if (entry.head == 0) continue;
+        stats->used_buckets++;
+
+        uint64_t chain = 0;
+        int rc;
+        index_chain_open(h, &entry, &cur);
+        while ((rc = arrays_cursor_next(&cur, &view)) == 1) {
+            chain++;
+            stats->num_offsets += view.list_len;
+        }
+        arrays_cursor_release(&cur);
+        if (rc < 0) return -1;
+        stats->num_nodes += chain;
+        if (chain > stats->max_chain) stats->max_chain = chain;
+    }
+    return 0;
+}
+
+/* Load every node of an index into a keymap, bucket by bucket in chain order.
+   Nodes sharing a key (streaming builds) end up in one entry. */
+static int index_load_keymap(index_handle_t *h, keymap_t *map) {
+    arrays_cursor_t cur;
+    arrays_node_view_t view;
+    for (uint64_t b = 0; b < h->num_buckets; ++b) {
+        bucket_entry_t entry;
+        if (index_read_bucket(h, b, &entry) != 0) return -1;
+        if (entry.head == 0) continue;
+
+        int rc;
+        index_chain_open(h, &entry, &cur);
+        while ((rc = arrays_cursor_next(&cur, &view)) == 1) {
+            keymap_entry_t *e = keymap_get(map, view.key, view.key_len);
+            if (!e) { rc = -1; break; }
+            arrays_offset_iter_t it;
+            uint64_t batch[64];
+            int n;
+            arrays_offset_iter_init(&it, &view);
+            while (rc == 1 && (n = arrays_offset_iter_next(&it, batch, 64)) != 0) {
+                if (n < 0) { rc = -1; break; }
+                for (int i = 0; i < n && rc == 1; ++i) {
+                    if (keymap_push(map, e, (off_t)batch[i]) != 0) rc = -1;
+                }
+            }
+            if (rc < 0) break;
+        }
+        arrays_cursor_release(&cur);
+        if (rc < 0) return -1;
+    }
+    return 0;
+}
+
+/* Rewrite an index through temporary files, then rename them over the
+   originals. num_buckets == 0 keeps the current count unless load_factor > 0,
+   in which case it is sized from the number of keys. */
+static int index_rewrite(const char *dir, const char *index_name, uint64_t num_buckets, double load_factor) {
+    char buckets_path[1024], arrays_path[1024];
+    snprintf(buckets_path, sizeof(buckets_path), "%s/%s_buckets.dat", dir, index_name);
+    snprintf(arrays_path, sizeof(arrays_path), "%s/%s_arrays.dat", dir, index_name);
+
+    index_handle_t h;
+    if (index_open_mmap(&h, buckets_path, arrays_path) != 0 &&
+        index_open(&h, buckets_path, arrays_path) != 0) {
+        fprintf(stderr, "cannot open index %s/%s\n", dir, index_name);
+        return -1;
+    }
+    uint64_t old_num_buckets = h.num_buckets;
+    uint64_t hash_seed = h.hash_seed;
+    uint16_t keep_flags = h.flags & INDEX_FLAG_ROWIDS;
+
+    keymap_t map;
+    if (keymap_init(&map, hash_seed) != 0) { index_close(&h); return -1; }
+    int rc = index_load_keymap(&h, &map);
+    index_close(&h);
+    if (rc != 0) {
+        fprintf(stderr, "failed reading index %s/%s\n", dir, index_name);
+        keymap_free(&map);
+        return -1;
+    }
+
+    if (num_buckets != 0) {
+        num_buckets = next_pow2(num_buckets);
+    } else if (load_factor > 0.0) {
+        num_buckets = buckets_for_load(map.count, load_factor);
+    } else {
+        num_buckets = old_num_buckets;
+    }
+
+    char tmp_name[512];
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", index_name);
+    rc = index_writer_write_keymap(&map, dir, tmp_name, num_buckets, hash_seed, INDEX_LAYOUT_DEFAULT | keep_flags);
+    keymap_free(&map);
+
+    char tmp_buckets[1024], tmp_arrays[1024];
+    snprintf(tmp_buckets, sizeof(tmp_buckets), "%s/%s_buckets.dat", dir, tmp_name);
+    snprintf(tmp_arrays, sizeof(tmp_arrays), "%s/%s_arrays.dat", dir, tmp_name);
+    if (rc != 0) {
+        unlink(tmp_buckets);
+        unlink(tmp_arrays);
+        return -1;
+    }
+    /* a reader opening the index between the two renames would mix files:
+       indices are only rewritten while the server is not (re)opening them */
+    if (rename(tmp_arrays, arrays_path) != 0 || rename(tmp_buckets, buckets_path) != 0) {
+        perror("rename");
+        return -1;
+    }
+    return 0;
+}
+
+int index_compact(const char *dir, const char *index_name) {
+    return index_rewrite(dir, index_name, 0, 0.0);
+}
+
+int index_resize(const char *dir, const char *index_name, uint64_t new_num_buckets, double load_factor) {
+    if (new_num_buckets == 0 && load_factor <= 0.0) load_factor = INDEX_DEFAULT_LOAD_FACTOR;
+    return index_rewrite(dir, index_name, new_num_buckets, load_factor);
+}
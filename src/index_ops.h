@@ -0,0 +1,37 @@
+#ifndef INDEX_OPS_H
+#define INDEX_OPS_H
+
+#include <stdint.h>
+#include "reader.h"
+
+/* index_ops.h
+ *
+ * Offline maintenance of an existing title/author index, working from the
+ * index files alone (the CSV is not parsed again).
+ */
+
+typedef struct {
+    uint64_t num_buckets;
+    uint64_t used_buckets;   // buckets with at least one node
+    uint64_t num_nodes;
+    uint64_t num_offsets;
+    uint64_t max_chain;      // longest chain, in nodes
+    uint64_t arrays_bytes;   // size of arrays.dat
+    uint16_t flags;
+} index_stats_t;
+
+/* Walk every chain of an open index and fill stats */
+int index_compute_stats(index_handle_t *h, index_stats_t *stats);
+
+/* Rewrite <dir>/<name>_{buckets,arrays}.dat in the clustered layout: nodes
+   with the same key are merged and every bucket chain becomes one contiguous
+   extent (chain order is kept). The new files replace the old ones atomically
+   (rename), so a running server keeps its open copy until it reopens. */
+int index_compact(const char *dir, const char *index_name);
+
+/* Rehash an index into new_num_buckets buckets (rounded up to a power of two;
+   0 sizes it from the number of keys and load_factor, <= 0 meaning
+   INDEX_DEFAULT_LOAD_FACTOR). Written in the clustered layout, same as compact. */
+int index_resize(const char *dir, const char *index_name, uint64_t new_num_buckets, double load_factor);
+
+#endif // INDEX_OPS_H
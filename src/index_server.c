@@ -2,18 +2,41 @@
 #include "util.h"
 #include "reader.h"
 #include "builder.h"
+#include "records.h"
+#include "buckets.h"
+#include "workq.h"
+#include "proto.h"
+#include "shmring.h"
+#include "qcache.h"
+#include "prefix.h"
+#include "trigram.h"
+#include "fulltext.h"
+#include "genres.h"
+#include "numeric.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
 
 #define DEFAULT_HASH_SEED 0x12345678abcdefULL
 #define REQ_FIFO "/tmp/index_req.fifo"
-#define RSP_FIFO "/tmp/index_rsp.fifo"
+#define RSP_FIFO_FMT "/tmp/index_rsp.%d.fifo"
+#define MAX_WORKERS 16
+#define QUEUE_CAP 64
 #define BUF_SZ 8192
+#define DEFAULT_CACHE_MB 64
+#define PREFIX_LIMIT_MAX 100
+#define TEXT_LIMIT_MAX 100
+#define RANGE_LIMIT_MAX 100    // rows answered for a query with only a numeric filter
+#define FUZZY_MAX_KEYS 10      // nearest keys looked up per field of a PROTO_FUZZY
 
 /* ensure pipe exists */
 static int ensure_fifo(const char *path) {
@@ -32,50 +55,56 @@ static int ensure_fifo(const char *path) {
     return 0;
 }
 
-static char *read_line_fd(int fd) {
-    char *buf = malloc(BUF_SZ);
-    if (!buf) return NULL;
-    size_t pos = 0;
-    while (1) {
-        ssize_t r = read(fd, buf + pos, 1);
-        if (r <= 0) {
-            if (pos == 0) { free(buf); return NULL; } 
-            break;
-        }
-        if (buf[pos] == '\n') { buf[pos] = '\0'; return buf; }
-        pos++;
-        if (pos + 1 >= BUF_SZ) break; // if too long, truncate
-    }
-    buf[pos] = '\0';
-    return buf;
+/* 1 if the buckets file at path is flagged INDEX_FLAG_ROWIDS */
+static int index_has_rowids(const char *buckets_path) {
+    buckets_header_t hdr;
+    int fd = buckets_open_header(buckets_path, &hdr);
+    if (fd < 0) return 0;
+    close(fd);
+    return (hdr.flags & INDEX_FLAG_ROWIDS) != 0;
 }
 
-static int write_line_fd(int fd, const char *s) {
-    size_t len = strlen(s);
-    ssize_t w = write(fd, s, len);
-    if (w != (ssize_t)len) return -1;
-    if (write(fd, "\n", 1) != 1) return -1;
-    return 0;
-}
+/* Bytes read from a request FIFO that do not form a whole message yet */
+typedef struct {
+    unsigned char buf[BUF_SZ];
+    size_t len;
+} req_buf_t;
 
-int main() {
-    const char *index_dir = INDEX_DIR;
-    const char *csv_path = CSV_PATH;
-
-    if (ensure_fifo(REQ_FIFO) != 0) return 1;
-    if (ensure_fifo(RSP_FIFO) != 0) return 1;
-
-    int req_fd = open(REQ_FIFO, O_RDWR);
-    if (req_fd < 0) { printf("fifo de peticiones"); return 1; }
-    int rsp_fd = open(RSP_FIFO, O_RDWR);
-    if (rsp_fd < 0) { perror("abrir fifo de respuestas"); close(req_fd); return 1; }
+/* Shared by the workers: index handles and the record store are only read
+   (pread or mappings), so lookups run concurrently under the read side of
+   reload_lock; a reload (SIGHUP) takes the write side to reopen them */
+typedef struct {
+    const char *index_dir;
+    size_t block_cache;        // bytes per index, 0: indices are mapped instead
+    pthread_rwlock_t reload_lock;
+    int ready;                 // indices and records open
+    index_handle_t th;
+    index_handle_t ah;
+    records_t store;
+    prefix_index_t tp;         // completions of titles and authors
+    prefix_index_t ap;
+    trigram_index_t tt;        // typo tolerant keys of titles and authors
+    trigram_index_t at;
+    fulltext_index_t ft;       // words of the descriptions
+    genres_index_t gi;         // rows of every genre
+    numeric_index_t nums[NUMERIC_NUM_COLUMNS];   // sorted values, numeric_columns order
+    qcache_t cache;
+    workq_t queue;
+} server_t;
 
+/* build the indices of index_dir when missing or outdated, then open them and
+   records.dat. returns 0, or -1 if records.dat cannot be used */
+static int open_indices(server_t *srv) {
+    const char *index_dir = srv->index_dir;
     char title_buckets[1024], title_arrays[1024], author_buckets[1024], author_arrays[1024];
     snprintf(title_buckets, sizeof(title_buckets), "%s/title_buckets.dat", index_dir);
     snprintf(title_arrays, sizeof(title_arrays), "%s/title_arrays.dat", index_dir);
     snprintf(author_buckets, sizeof(author_buckets), "%s/author_buckets.dat", index_dir);
     snprintf(author_arrays, sizeof(author_arrays), "%s/author_arrays.dat", index_dir);
 
+    char records_path[1024];
+    snprintf(records_path, sizeof(records_path), "%s/%s", index_dir, RECORDS_FILE);
+
     int need_build = 0;
     if (access(title_buckets, F_OK) != 0) {
         printf("Falta archivo de índice: %s\n", title_buckets);
@@ -85,116 +114,877 @@ int main() {
         printf("Falta archivo de índice: %s\n", author_arrays);
         need_build = 1;
     }
+    if (access(records_path, F_OK) != 0) {
+        printf("Falta archivo de registros: %s\n", records_path);
+        need_build = 1;
+    }
+    /* indices from older builds point into the CSV: rebuild them */
+    if (!need_build && (!index_has_rowids(title_buckets) || !index_has_rowids(author_buckets))) {
+        printf("Los índices no usan filas de %s\n", RECORDS_FILE);
+        need_build = 1;
+    }
 
     if (need_build) {
-        uint64_t num_buckets_title = next_pow2(4096);
-        uint64_t num_buckets_author = next_pow2(4096);
+        /* 0: bucket count sized from the number of keys of each index */
+        uint64_t num_buckets_title = 0;
+        uint64_t num_buckets_author = 0;
         uint64_t hash_seed = DEFAULT_HASH_SEED;
-        printf("Construyendo índices en '%s'...\n", INDEX_DIR);
-        if (build_both_indices_stream(CSV_PATH, INDEX_DIR, num_buckets_title, num_buckets_author, hash_seed) != 0) {
+        printf("Construyendo índices en '%s'...\n", index_dir);
+        if (build_both_indices_stream(CSV_PATH, index_dir, num_buckets_title, num_buckets_author, hash_seed) != 0) {
             fprintf(stderr, "Fallo al construir los índices\n");
-            return 1;
+            return -1;
         }
         printf("Índices construidos.\n");
     } else {
         printf("Archivos de índice encontrados.\n");
     }
 
-    index_handle_t th, ah;
-    if (index_open(&th, title_buckets, title_arrays) != 0) {
-        fprintf(stderr, "Fallo al abrir el índice de títulos\n");
+    /* completions, trigrams, descriptions, genres and numeric columns: all
+       of them after a rebuild, else only those missing or of an older version.
+       without one of them only the requests that use it fail */
+    int built = build_derived_indices(index_dir, !need_build);
+    if (built < 0) {
+        fprintf(stderr, "Fallo al construir alguno de los índices derivados\n");
+    } else if (built > 0) {
+        printf("Índices derivados construidos: %d\n", built);
+    }
+
+    if (srv->block_cache > 0) {
+        /* pread through our own block cache: the memory used for the indices
+           is bounded, whatever their size */
+        if (index_open(&srv->th, title_buckets, title_arrays) != 0 ||
+            index_set_cache(&srv->th, srv->block_cache) != 0) {
+            fprintf(stderr, "Fallo al abrir el índice de títulos\n");
+        }
+        if (index_open(&srv->ah, author_buckets, author_arrays) != 0 ||
+            index_set_cache(&srv->ah, srv->block_cache) != 0) {
+            fprintf(stderr, "Fallo al abrir el índice de autores\n");
+        }
+    } else {
+        /* prefer the mmap mode, fall back to pread if the files cannot be mapped */
+        if (index_open_mmap(&srv->th, title_buckets, title_arrays) != 0 &&
+            index_open(&srv->th, title_buckets, title_arrays) != 0) {
+            fprintf(stderr, "Fallo al abrir el índice de títulos\n");
+        }
+        if (index_open_mmap(&srv->ah, author_buckets, author_arrays) != 0 &&
+            index_open(&srv->ah, author_buckets, author_arrays) != 0) {
+            fprintf(stderr, "Fallo al abrir el índice de autores\n");
+        }
+    }
+
+    if (records_open(&srv->store, records_path) != 0) {
+        printf("Fatal: No se puede abrir el archivo de registros %s\n", records_path);
+        index_close(&srv->th);
+        index_close(&srv->ah);
+        return -1;
     }
-    if (index_open(&ah, author_buckets, author_arrays) != 0) {
-        fprintf(stderr, "Fallo al abrir el índice de autores\n");
+
+    prefix_index_t *prefixes[2] = {&srv->tp, &srv->ap};
+    trigram_index_t *trigrams[2] = {&srv->tt, &srv->at};
+    const char *names[2] = {"title", "author"};
+    for (int i = 0; i < 2; ++i) {
+        char prefix_path[1024], trigram_path[1024];
+        snprintf(prefix_path, sizeof(prefix_path), "%s/%s%s", index_dir, names[i], PREFIX_SUFFIX);
+        if (prefix_open(prefixes[i], prefix_path) != 0) {
+            fprintf(stderr, "Fallo al abrir el índice de prefijos %s\n", prefix_path);
+        }
+        snprintf(trigram_path, sizeof(trigram_path), "%s/%s%s", index_dir, names[i], TRIGRAM_SUFFIX);
+        if (trigram_open(trigrams[i], trigram_path) != 0) {
+            fprintf(stderr, "Fallo al abrir el índice de trigramas %s\n", trigram_path);
+        }
+    }
+
+    char fulltext_path[1024];
+    snprintf(fulltext_path, sizeof(fulltext_path), "%s/%s", index_dir, FULLTEXT_FILE);
+    if (fulltext_open(&srv->ft, fulltext_path) != 0) {
+        fprintf(stderr, "Fallo al abrir el índice de descripciones %s\n", fulltext_path);
     }
-    printf("Esperando peticiones de busqueda\n");
+
+    char genres_path[1024];
+    snprintf(genres_path, sizeof(genres_path), "%s/%s", index_dir, GENRES_FILE);
+    if (genres_open(&srv->gi, genres_path) != 0) {
+        fprintf(stderr, "Fallo al abrir el índice de géneros %s\n", genres_path);
+    }
+
+    for (int c = 0; c < NUMERIC_NUM_COLUMNS; ++c) {
+        char numeric_path[1024];
+        snprintf(numeric_path, sizeof(numeric_path), "%s/%s%s", index_dir, numeric_columns[c].name, NUMERIC_SUFFIX);
+        if (numeric_open(&srv->nums[c], numeric_path) != 0) {
+            fprintf(stderr, "Fallo al abrir el índice numérico %s\n", numeric_path);
+        }
+    }
+    srv->ready = 1;
+    return 0;
+}
+
+static void close_indices(server_t *srv) {
+    if (!srv->ready) return;
+    records_close(&srv->store);
+    index_close(&srv->th);
+    index_close(&srv->ah);
+    prefix_close(&srv->tp);
+    prefix_close(&srv->ap);
+    trigram_close(&srv->tt);
+    trigram_close(&srv->at);
+    fulltext_close(&srv->ft);
+    genres_close(&srv->gi);
+    for (int c = 0; c < NUMERIC_NUM_COLUMNS; ++c) numeric_close(&srv->nums[c]);
+    srv->ready = 0;
+}
+
+/* SIGHUP: the indices were rebuilt (or removed) on disk. workers finish their
+   lookups first; results cached from the old files are dropped */
+static void reload_indices(server_t *srv) {
+    pthread_rwlock_wrlock(&srv->reload_lock);
+    close_indices(srv);
+    if (open_indices(srv) != 0) {
+        fprintf(stderr, "Fallo al recargar los índices, las búsquedas fallarán\n");
+    }
+    qcache_invalidate(&srv->cache);
+    pthread_rwlock_unlock(&srv->reload_lock);
+    printf("Índices recargados\n");
+}
+
+static void print_cache_stats(server_t *srv) {
+    qcache_stats_t st;
+    qcache_get_stats(&srv->cache, &st);
+    uint64_t lookups = st.hits + st.misses;
+    printf("Caché: %llu aciertos, %llu fallos (%.1f%%), %llu entradas, %llu expulsadas, %zu/%zu bytes\n",
+           (unsigned long long)st.hits, (unsigned long long)st.misses,
+           lookups ? 100.0 * (double)st.hits / (double)lookups : 0.0,
+           (unsigned long long)st.entries, (unsigned long long)st.evictions, st.bytes, st.budget);
+    pthread_rwlock_rdlock(&srv->reload_lock);
+    const index_handle_t *handles[2] = {&srv->th, &srv->ah};
+    const char *names[2] = {"títulos", "autores"};
+    for (int i = 0; i < 2; ++i) {
+        if (!srv->ready || !handles[i]->cache) continue;
+        bcache_stats_t bs;
+        bcache_get_stats(handles[i]->cache, &bs);
+        printf("Bloques de %s: %llu aciertos, %llu lecturas, %llu expulsados, %zu bytes\n", names[i],
+               (unsigned long long)bs.hits, (unsigned long long)bs.misses,
+               (unsigned long long)bs.evictions, bs.capacity);
+    }
+    pthread_rwlock_unlock(&srv->reload_lock);
     fflush(stdout);
+}
 
-    FILE *csvf = fopen(csv_path, "rb");
-    if(!csvf) {
-        printf("Fatal: No se puede abrir el archivo CSV %s:\n", csv_path);
-        close(req_fd);
-        close(rsp_fd);
-        return 1;
+/* One request, answered on RSP_FIFO_FMT of pid, or on the ring
+   SHMRING_NAME_FMT of pid when shm is set (PROTO_QUERY_SHM, PROTO_FLAG_SHM) */
+typedef struct {
+    uint16_t type;     // PROTO_QUERY (for both query types), PROTO_PREFIX, PROTO_FUZZY or PROTO_TEXT
+    int pid;
+    int shm;
+    uint32_t field;    // PROTO_PREFIX: FIELD_TITLE or FIELD_AUTHOR
+    uint32_t limit;    // PROTO_PREFIX, PROTO_TEXT: results wanted
+    char *title;       // NUL-terminated, stored after the struct
+    char *author;
+    char *genres;      // PROTO_QUERY: comma separated genres every hit must have
+    char *filter;      // PROTO_QUERY: numeric predicates every hit must pass
+    char *text;        // PROTO_PREFIX: the prefix, PROTO_TEXT: the words
+} request_t;
+
+static int item_u32(const unsigned char *item, uint32_t len, uint32_t *v) {
+    if (len != sizeof *v) return -1;
+    memcpy(v, item, sizeof *v);
+    return 0;
+}
+
+/* copy the request in msg (size bytes, header included) into a request_t,
+   returns NULL if malformed */
+static request_t *parse_request(const unsigned char *msg, size_t size) {
+    proto_msg_t m;
+    long n = proto_peek(msg, size, size, &m.hdr);
+    if (n <= 0) return NULL;
+    uint32_t want;
+    switch (m.hdr.type) {
+    case PROTO_QUERY:
+    case PROTO_QUERY_SHM: want = m.hdr.count >= 3 && m.hdr.count <= 5 ? m.hdr.count : 3; break;
+    case PROTO_PREFIX: want = 5; break;
+    case PROTO_FUZZY:
+    case PROTO_TEXT: want = 4; break;
+    default: return NULL;
     }
-    
-    while (1) {
-        char *req = read_line_fd(req_fd);
-        if (!req) {
-            usleep(100000);
-            continue;
+    if (m.hdr.count != want) return NULL;
+    m.payload = (unsigned char *)msg + PROTO_HEADER_SIZE;
+
+    proto_items_t it;
+    const unsigned char *item[5];
+    uint32_t len[5];
+    proto_items_init(&it, &m);
+    for (uint32_t i = 0; i < want; ++i) {
+        if (proto_items_next(&it, &item[i], &len[i]) != 1) return NULL;
+    }
+    uint32_t pid;
+    if (item_u32(item[0], len[0], &pid) != 0 || pid == 0 || pid > INT_MAX) return NULL;
+
+    /* strings: title, author, genres and filter of a query, the prefix of a
+       PROTO_PREFIX */
+    const unsigned char *str[4] = {item[1], item[2], NULL, NULL};
+    uint32_t str_len[4] = {len[1], len[2], 0, 0};
+    uint32_t flags = 0, field = 0, limit = 0;
+    if (m.hdr.type == PROTO_PREFIX) {
+        if (item_u32(item[1], len[1], &flags) != 0 || item_u32(item[2], len[2], &field) != 0 ||
+            item_u32(item[4], len[4], &limit) != 0) {
+            return NULL;
         }
-        char *sep = strchr(req, '|');
-        char *title = NULL;
-        char *author = NULL;
-        if (sep) {
-            *sep = '\0';
-            title = req;
-            author = sep + 1;
-        } else {
-            title = req;
-            author = "";
+        str[0] = item[3];
+        str_len[0] = len[3];
+        str_len[1] = 0;
+    } else if (m.hdr.type == PROTO_TEXT) {
+        if (item_u32(item[1], len[1], &flags) != 0 || item_u32(item[3], len[3], &limit) != 0) return NULL;
+        str[0] = item[2];
+        str_len[0] = len[2];
+        str_len[1] = 0;
+    } else if (m.hdr.type == PROTO_FUZZY) {
+        if (item_u32(item[1], len[1], &flags) != 0) return NULL;
+        str[0] = item[2];
+        str[1] = item[3];
+        str_len[0] = len[2];
+        str_len[1] = len[3];
+    } else {
+        for (uint32_t i = 3; i < want; ++i) {
+            str[i - 1] = item[i];
+            str_len[i - 1] = len[i];
         }
+    }
 
-        if ((title[0] == '\0') && (author[0] == '\0')) {
-            write_line_fd(rsp_fd, "ERR|La búsqueda debe tener al menos un parámetro");
-            write_line_fd(rsp_fd, "<END>");
-            free(req);
+    request_t *req = malloc(sizeof *req + str_len[0] + str_len[1] + str_len[2] + str_len[3] + 4);
+    if (!req) return NULL;
+    req->type = m.hdr.type == PROTO_QUERY_SHM ? PROTO_QUERY : m.hdr.type;
+    req->pid = (int)pid;
+    req->shm = m.hdr.type == PROTO_QUERY_SHM || (flags & PROTO_FLAG_SHM) != 0;
+    req->field = field;
+    req->limit = limit;
+    char *s[4];
+    s[0] = (char *)(req + 1);
+    for (int i = 0; i < 4; ++i) {
+        if (i > 0) s[i] = s[i - 1] + str_len[i - 1] + 1;
+        if (str_len[i]) memcpy(s[i], str[i], str_len[i]);
+        s[i][str_len[i]] = '\0';
+    }
+    req->title = s[0];
+    req->author = s[1];
+    req->genres = s[2];
+    req->filter = s[3];
+    req->text = s[0];
+    return req;
+}
+
+/* copy the items of an answer, length-prefixed as on the wire, into the
+   cache; results bigger than the cache admits are not kept */
+static void cache_result(server_t *srv, uint64_t gen, const char *key, size_t key_len,
+    const void *const *items, const uint32_t *lens, uint32_t n)
+{
+    size_t length = 0;
+    for (uint32_t i = 0; i < n; ++i) length += sizeof(uint32_t) + lens[i];
+    if (!qcache_admits(&srv->cache, length)) return;
+    unsigned char *payload = malloc(length ? length : 1);
+    if (!payload) return;
+    size_t at = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        memcpy(payload + at, &lens[i], sizeof(uint32_t));
+        memcpy(payload + at + sizeof(uint32_t), items[i], lens[i]);
+        at += sizeof(uint32_t) + lens[i];
+    }
+    qcache_put(&srv->cache, gen, key, key_len, n, payload, length);
+    free(payload);
+}
+
+/* point items at the records of a fetched batch, as stored, skipping the
+   ones that do not decode. returns how many */
+static uint32_t batch_items(records_batch_t *batch, uint32_t count, record_t *rec,
+    const void **items, uint32_t *lens)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (records_batch_record(batch, i, rec) != 0) {
             continue;
         }
+        items[n] = batch->buf + batch->pos[i];
+        lens[n] = (uint32_t)batch->len[i];
+        n++;
+    }
+    return n;
+}
 
-        printf("Buscando título: '%s', autor: '%s'\n", title, author);
-        off_t *offs = NULL;
-        uint32_t count = 0;
-        int rc = lookup_by_title_author(&th, &ah, title, author, &offs, &count);
-        if (rc != 0) {
-            write_line_fd(rsp_fd, "ERR|Error interno en la búsqueda");
-            write_line_fd(rsp_fd, "<END>");
-            free(req);
-            continue;
+/* does row have every genre of allowed (when given) and pass preds */
+static int row_passes(server_t *srv, const bitmap_t *allowed, const numeric_pred_t *preds, int npreds, uint64_t row) {
+    if (allowed && bitmap_contains(allowed->buf, allowed->len, (uint32_t)row) != 1) return 0;
+    return numeric_test(srv->nums, preds, npreds, row);
+}
+
+/* keep the rows of offs that pass row_passes */
+static void filter_rows(server_t *srv, const bitmap_t *allowed, const numeric_pred_t *preds, int npreds,
+    off_t *offs, uint32_t *count)
+{
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < *count; ++i) {
+        if (row_passes(srv, allowed, preds, npreds, (uint64_t)offs[i])) offs[kept++] = offs[i];
+    }
+    *count = kept;
+}
+
+/* the first limit rows in the range of preds[0], by increasing value, that
+   pass the genres and the other predicates, into a malloc'd *offs. the range
+   is walked in the file and stops at limit, it is never copied whole.
+   returns 0, -1 when out of memory */
+static int range_rows(server_t *srv, const bitmap_t *allowed, const numeric_pred_t *preds, int npreds,
+    uint32_t limit, off_t **offs, uint32_t *count)
+{
+    const numeric_index_t *n = &srv->nums[preds[0].column];
+    uint64_t first, total;
+    numeric_range(n, preds[0].lo, preds[0].hi, &first, &total);
+    *count = 0;
+    *offs = malloc((size_t)limit * sizeof **offs);
+    if (!*offs) return -1;
+    for (uint64_t i = first; i < first + total && *count < limit; ++i) {
+        uint32_t row = numeric_row(n, i);
+        if (row_passes(srv, allowed, preds + 1, npreds - 1, row)) (*offs)[(*count)++] = (off_t)row;
+    }
+    return 0;
+}
+
+/* answer one query on out with a single message, only with the hits that
+   have every genre of genres and pass the numeric filter when they are not
+   empty. a filter alone answers the first RANGE_LIMIT_MAX rows that pass it;
+   batch and rec belong to the calling worker */
+static void serve_query(server_t *srv, proto_out_t *out, const char *title, const char *author,
+    const char *genres, const char *filter, records_batch_t *batch, record_t *rec)
+{
+    numeric_pred_t preds[NUMERIC_MAX_PREDS];
+    int npreds = 0;
+    if (filter[0] != '\0' && (npreds = numeric_parse_filter(filter, preds, NUMERIC_MAX_PREDS)) <= 0) {
+        proto_send_error(out, "Filtro numérico no válido");
+        return;
+    }
+    int by_range = (title[0] == '\0') && (author[0] == '\0');
+    if (by_range && npreds == 0) {
+        proto_send_error(out, "La búsqueda debe tener al menos un parámetro");
+        return;
+    }
+
+    printf("Buscando título: '%s', autor: '%s'\n", title, author);
+    if (genres[0] != '\0') printf("  con géneros: '%s'\n", genres);
+    if (npreds > 0) printf("  con filtro: '%s'\n", filter);
+
+    /* a repeated query is answered with the stored payload, without touching
+       the indices or records.dat (filtered queries are not kept) */
+    char key[QCACHE_KEY_MAX];
+    size_t key_len = qcache_make_key(title, author, key);
+    int cacheable = genres[0] == '\0' && npreds == 0;
+    const qcache_entry_t *hit = cacheable ? qcache_get(&srv->cache, key, key_len) : NULL;
+    if (hit) {
+        proto_send_payload(out, PROTO_RECORDS, hit->count, hit->payload, hit->length);
+        qcache_release(&srv->cache, hit);
+        return;
+    }
+
+    /* the batch holds a copy of the records, so the answer is sent after
+       releasing the lock; gen tells qcache_put whether a reload came since */
+    pthread_rwlock_rdlock(&srv->reload_lock);
+    uint64_t gen = qcache_generation(&srv->cache);
+    if (!srv->ready) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "Los índices no están disponibles");
+        return;
+    }
+    for (int i = 0; i < npreds; ++i) {
+        if (!srv->nums[preds[i].column].map) {
+            pthread_rwlock_unlock(&srv->reload_lock);
+            proto_send_error(out, "El índice numérico no está disponible");
+            return;
         }
-        
+    }
+    /* rows with every genre, tested on each hit */
+    bitmap_t allowed = {0};
+    if (genres[0] != '\0' && (!srv->gi.map || genres_match(&srv->gi, genres, &allowed) != 0)) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "El índice de géneros no está disponible");
+        bitmap_free(&allowed);
+        return;
+    }
+    const bitmap_t *with_genres = genres[0] != '\0' ? &allowed : NULL;
+    off_t *offs = NULL;
+    uint32_t count = 0;
+    int rc = by_range ? range_rows(srv, with_genres, preds, npreds, RANGE_LIMIT_MAX, &offs, &count)
+                      : lookup_by_title_author(&srv->th, &srv->ah, title, author, &offs, &count);
+    if (rc == 0 && !by_range && (with_genres || npreds > 0)) filter_rows(srv, with_genres, preds, npreds, offs, &count);
+    bitmap_free(&allowed);
+    if (rc != 0) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "Error interno en la búsqueda");
+        free(offs);
+        return;
+    }
 
-        if (count == 0) {
-            write_line_fd(rsp_fd, "OK");
-            write_line_fd(rsp_fd, "<END>");
-            free(req);
-            continue;
+    /* postings are row numbers in records.dat, all the hits are read in
+       a few merged reads and sent as they are stored, straight from the
+       batch buffer */
+    uint64_t *rows = NULL;
+    const void **items = NULL;
+    uint32_t *lens = NULL;
+    if (count > 0) {
+        rows = malloc((size_t)count * sizeof(uint64_t));
+        items = malloc((size_t)count * sizeof(void *));
+        lens = malloc((size_t)count * sizeof(uint32_t));
+        if (!rows || !items || !lens) {
+            pthread_rwlock_unlock(&srv->reload_lock);
+            proto_send_error(out, "Error interno en la búsqueda");
+            goto out;
         }
+        for (uint32_t i = 0; i < count; ++i) rows[i] = (uint64_t)offs[i];
+        if (records_fetch_batch(&srv->store, rows, count, batch) != 0) {
+            pthread_rwlock_unlock(&srv->reload_lock);
+            proto_send_error(out, "No se pueden leer los registros");
+            goto out;
+        }
+    }
+    pthread_rwlock_unlock(&srv->reload_lock);
+
+    uint32_t n = batch_items(batch, count, rec, items, lens);
+    if (cacheable) cache_result(srv, gen, key, key_len, items, lens, n);
+    proto_send(out, PROTO_RECORDS, items, lens, n);
+
+out:
+    free(lens);
+    free(items);
+    free(rows);
+    free(offs);
+}
+
+/* Rows gathered for a PROTO_FUZZY */
+typedef struct {
+    uint64_t *rows;
+    uint32_t n;
+    uint32_t cap;
+} row_list_t;
 
-        
-        if (!csvf) {
-            write_line_fd(rsp_fd, "ERR|No se puede abrir el archivo CSV");
-            write_line_fd(rsp_fd, "<END>");
-            free(offs);
+static int row_push(void *ctx, off_t row) {
+    row_list_t *l = ctx;
+    if (l->n == l->cap) {
+        uint32_t new_cap = l->cap ? l->cap * 2 : 64;
+        uint64_t *tmp = realloc(l->rows, (size_t)new_cap * sizeof *tmp);
+        if (!tmp) return -1;
+        l->rows = tmp;
+        l->cap = new_cap;
+    }
+    l->rows[l->n++] = (uint64_t)row;
+    return 0;
+}
+
+/* rows of the keys of h nearest to query, nearest key first. A row has one
+   key per column, so no row comes twice */
+static int fuzzy_rows(index_handle_t *h, const trigram_index_t *t, const char *query, row_list_t *out) {
+    trigram_match_t matches[FUZZY_MAX_KEYS];
+    int n = trigram_search(t, query, matches, FUZZY_MAX_KEYS);
+    for (int i = 0; i < n; ++i) {
+        char key[NORMALIZED_MAX_LEN + 1];
+        if (matches[i].key_len > NORMALIZED_MAX_LEN) continue;
+        memcpy(key, matches[i].key, matches[i].key_len);
+        key[matches[i].key_len] = '\0';
+        if (index_lookup_each(h, key, row_push, out) != 0) return -1;
+    }
+    return n < 0 ? -1 : 0;
+}
+
+static int cmp_row(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* answer a PROTO_FUZZY: the rows of the keys closest to each given field
+   (rows of both when both are given), in order of distance of the title */
+static void serve_fuzzy(server_t *srv, proto_out_t *out, const char *title, const char *author,
+    records_batch_t *batch, record_t *rec)
+{
+    if ((title[0] == '\0') && (author[0] == '\0')) {
+        proto_send_error(out, "La búsqueda debe tener al menos un parámetro");
+        return;
+    }
+
+    printf("Buscando aproximado título: '%s', autor: '%s'\n", title, author);
+
+    row_list_t tr = {0}, ar = {0};
+    const void **items = NULL;
+    uint32_t *lens = NULL;
+    pthread_rwlock_rdlock(&srv->reload_lock);
+    if (!srv->ready || (title[0] && !srv->tt.map) || (author[0] && !srv->at.map)) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "El índice aproximado no está disponible");
+        return;
+    }
+    if ((title[0] && fuzzy_rows(&srv->th, &srv->tt, title, &tr) != 0) ||
+        (author[0] && fuzzy_rows(&srv->ah, &srv->at, author, &ar) != 0)) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "Error interno en la búsqueda");
+        goto out;
+    }
+
+    /* both fields: keep the title rows (in their order) that the author
+       matched too */
+    row_list_t *res = title[0] ? &tr : &ar;
+    if (title[0] && author[0]) {
+        qsort(ar.rows, ar.n, sizeof *ar.rows, cmp_row);
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < tr.n; ++i) {
+            if (bsearch(&tr.rows[i], ar.rows, ar.n, sizeof *ar.rows, cmp_row)) tr.rows[n++] = tr.rows[i];
+        }
+        tr.n = n;
+    }
+
+    if (res->n > 0) {
+        items = malloc((size_t)res->n * sizeof(void *));
+        lens = malloc((size_t)res->n * sizeof(uint32_t));
+        if (!items || !lens) {
+            pthread_rwlock_unlock(&srv->reload_lock);
+            proto_send_error(out, "Error interno en la búsqueda");
+            goto out;
+        }
+        if (records_fetch_batch(&srv->store, res->rows, res->n, batch) != 0) {
+            pthread_rwlock_unlock(&srv->reload_lock);
+            proto_send_error(out, "No se pueden leer los registros");
+            goto out;
+        }
+    }
+    pthread_rwlock_unlock(&srv->reload_lock);
+
+    uint32_t n = batch_items(batch, res->n, rec, items, lens);
+    proto_send(out, PROTO_RECORDS, items, lens, n);
+
+out:
+    free(lens);
+    free(items);
+    free(ar.rows);
+    free(tr.rows);
+}
+
+/* answer a PROTO_TEXT with the limit rows whose descriptions score best for
+   the words in text, best first */
+static void serve_text(server_t *srv, proto_out_t *out, const char *text, uint32_t limit,
+    records_batch_t *batch, record_t *rec)
+{
+    if (limit == 0 || limit > TEXT_LIMIT_MAX) limit = TEXT_LIMIT_MAX;
+    printf("Buscando en descripciones: '%s'\n", text);
+
+    fulltext_hit_t hits[TEXT_LIMIT_MAX];
+    uint64_t rows[TEXT_LIMIT_MAX];
+    const void *items[TEXT_LIMIT_MAX];
+    uint32_t lens[TEXT_LIMIT_MAX];
+    pthread_rwlock_rdlock(&srv->reload_lock);
+    if (!srv->ready || !srv->ft.map) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "El índice de descripciones no está disponible");
+        return;
+    }
+    int n = fulltext_search(&srv->ft, text, hits, limit);
+    if (n < 0) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "Error interno en la búsqueda");
+        return;
+    }
+    for (int i = 0; i < n; ++i) rows[i] = hits[i].row;
+    if (n > 0 && records_fetch_batch(&srv->store, rows, (size_t)n, batch) != 0) {
+        pthread_rwlock_unlock(&srv->reload_lock);
+        proto_send_error(out, "No se pueden leer los registros");
+        return;
+    }
+    pthread_rwlock_unlock(&srv->reload_lock);
+
+    uint32_t count = batch_items(batch, (uint32_t)n, rec, items, lens);
+    proto_send(out, PROTO_RECORDS, items, lens, count);
+}
+
+typedef struct {
+    unsigned char *buf;    // rows + text of every completion, back to back
+    size_t len;
+    size_t cap;
+    uint32_t n;
+    const void *items[PREFIX_LIMIT_MAX];
+    uint32_t lens[PREFIX_LIMIT_MAX];
+} completions_t;
+
+static int add_completion(void *ctx, const char *text, size_t text_len, uint32_t rows) {
+    completions_t *c = ctx;
+    if (c->n == PREFIX_LIMIT_MAX || sizeof rows + text_len > c->cap - c->len) return -1;
+    c->items[c->n] = c->buf + c->len;
+    c->lens[c->n] = (uint32_t)(sizeof rows + text_len);
+    memcpy(c->buf + c->len, &rows, sizeof rows);
+    memcpy(c->buf + c->len + sizeof rows, text, text_len);
+    c->len += sizeof rows + text_len;
+    c->n++;
+    return 0;
+}
+
+/* answer a PROTO_PREFIX with the first limit values of the column that start
+   with text, in sorted order */
+static void serve_prefix(server_t *srv, proto_out_t *out, uint32_t field, const char *text, uint32_t limit) {
+    if (field != FIELD_TITLE && field != FIELD_AUTHOR) {
+        proto_send_error(out, "Campo no válido para sugerencias");
+        return;
+    }
+    if (limit == 0 || limit > PREFIX_LIMIT_MAX) limit = PREFIX_LIMIT_MAX;
+
+    /* texts are copied out of the mapping before the lock is released */
+    completions_t c;
+    c.cap = (size_t)limit * (sizeof(uint32_t) + PREFIX_TEXT_MAX);
+    c.buf = malloc(c.cap);
+    c.len = 0;
+    c.n = 0;
+    if (!c.buf) {
+        proto_send_error(out, "Error interno en la búsqueda");
+        return;
+    }
+    pthread_rwlock_rdlock(&srv->reload_lock);
+    const prefix_index_t *p = field == FIELD_TITLE ? &srv->tp : &srv->ap;
+    int rc = srv->ready && p->map ? prefix_complete(p, text, limit, add_completion, &c) : -1;
+    pthread_rwlock_unlock(&srv->reload_lock);
+    if (rc < 0) {
+        proto_send_error(out, "El índice de sugerencias no está disponible");
+        free(c.buf);
+        return;
+    }
+
+    proto_send(out, PROTO_COMPLETIONS, c.items, c.lens, c.n);
+    free(c.buf);
+}
+
+static void serve_request(server_t *srv, proto_out_t *out, const request_t *req,
+    records_batch_t *batch, record_t *rec)
+{
+    if (req->type == PROTO_PREFIX) {
+        serve_prefix(srv, out, req->field, req->text, req->limit);
+    } else if (req->type == PROTO_TEXT) {
+        serve_text(srv, out, req->text, req->limit, batch, rec);
+    } else if (req->type == PROTO_FUZZY) {
+        serve_fuzzy(srv, out, req->title, req->author, batch, rec);
+    } else {
+        serve_query(srv, out, req->title, req->author, req->genres, req->filter, batch, rec);
+    }
+}
+
+static void *worker_main(void *arg) {
+    server_t *srv = arg;
+    records_batch_t batch = {0};
+    record_t rec = {0};
+    request_t *req;
+    while ((req = workq_pop(&srv->queue)) != NULL) {
+        char path[64];
+        if (req->shm) {
+            /* records are copied once, straight into the client's ring */
+            shmring_t ring;
+            snprintf(path, sizeof(path), SHMRING_NAME_FMT, req->pid);
+            if (shmring_open(&ring, path) != 0) {
+                fprintf(stderr, "No se puede abrir la memoria compartida %s: %s\n", path, strerror(errno));
+            } else {
+                if (shmring_begin_write(&ring) != 0) {
+                    fprintf(stderr, "El cliente de %s ya no está o no lee sus respuestas\n", path);
+                } else {
+                    proto_out_t out = {-1, &ring, 0, 0};
+                    serve_request(srv, &out, req, &batch, &rec);
+                    if (out.cut) fprintf(stderr, "Respuesta incompleta en %s, anulada\n", path);
+                    shmring_end_write(&ring);
+                }
+                shmring_close(&ring);
+            }
             free(req);
             continue;
         }
+        /* the client opened its FIFO before sending the request; if it is
+           gone there is nobody to answer (ENOENT / ENXIO) */
+        snprintf(path, sizeof(path), RSP_FIFO_FMT, req->pid);
+        int fd = open(path, O_WRONLY | O_NONBLOCK);
+        if (fd < 0) {
+            fprintf(stderr, "No se puede abrir la FIFO de respuesta %s: %s\n", path, strerror(errno));
+        } else {
+            /* the fd stays non-blocking: a long answer waits for the client
+               while it reads, a stopped or stuck one loses it */
+            proto_out_t out = {fd, NULL, req->pid, 0};
+            serve_request(srv, &out, req, &batch, &rec);
+            close(fd);
+            if (out.cut) {
+                /* half an answer is left in the FIFO: nothing more goes
+                   after it, the client times out and makes a new one */
+                fprintf(stderr, "Respuesta incompleta en %s, se elimina la FIFO\n", path);
+                unlink(path);
+            }
+        }
+        free(req);
+    }
+    records_batch_free(&batch);
+    return NULL;
+}
+
+/* read everything available on the non-blocking fd and queue every complete
+   message. returns 0 once the FIFO is empty, -1 on a read error */
+static int drain_requests(server_t *srv, int fd, req_buf_t *rb) {
+    while (1) {
+        ssize_t r = read(fd, rb->buf + rb->len, sizeof(rb->buf) - rb->len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (r == 0) return 0;
+        rb->len += (size_t)r;
 
-        write_line_fd(rsp_fd, "OK");
-        for (uint32_t i = 0; i < count; ++i) {
-            off_t off = (off_t)offs[i];
-            if (fseeko(csvf, off, SEEK_SET) != 0) {
-                continue;
+        size_t start = 0;
+        proto_header_t hdr;
+        long size;
+        while ((size = proto_peek(rb->buf + start, rb->len - start, PIPE_BUF, &hdr)) > 0) {
+            request_t *req = parse_request(rb->buf + start, (size_t)size);
+            if (!req) {
+                fprintf(stderr, "Petición mal formada, descartada\n");
+            } else if (workq_push(&srv->queue, req) != 0) {
+                free(req);
             }
-            char *line = NULL;
-            size_t llen = 0;
-            ssize_t r = getline(&line, &llen, csvf);
-            if (r > 0) {
-                if (line[r-1] == '\n') line[r-1] = '\0';
-                write_line_fd(rsp_fd, line);
+            start += (size_t)size;
+        }
+        if (size < 0) {
+            /* every query is written atomically, so this is not a client of
+               ours: drop what was read */
+            fprintf(stderr, "Datos no válidos en la FIFO de peticiones, descartados\n");
+            start = rb->len;
+        }
+        rb->len -= start;
+        memmove(rb->buf, rb->buf + start, rb->len);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [--cache-mb N] [--block-cache-mb N]\n", prog);
+    fprintf(stderr, "  --cache-mb N        memoria para la caché de resultados (por defecto %d, 0 la desactiva)\n",
+            DEFAULT_CACHE_MB);
+    fprintf(stderr, "  --block-cache-mb N  leer los índices con pread y una caché de bloques de N MB\n"
+                    "                      por índice, en lugar de mapearlos (por defecto 0)\n");
+}
+
+int main(int argc, char **argv) {
+    long cache_mb = DEFAULT_CACHE_MB;
+    long block_cache_mb = 0;
+    for (int i = 1; i < argc; ++i) {
+        long *opt = NULL;
+        if (strcmp(argv[i], "--cache-mb") == 0) opt = &cache_mb;
+        else if (strcmp(argv[i], "--block-cache-mb") == 0) opt = &block_cache_mb;
+        if (opt && i + 1 < argc) {
+            char *end;
+            *opt = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || *opt < 0 || *opt > 1L << 20) {
+                usage(argv[0]);
+                return 1;
             }
-            free(line);
+        } else {
+            usage(argv[0]);
+            return 1;
         }
-        write_line_fd(rsp_fd, "<END>");
+    }
 
-        free(offs);
-        free(req);
+    static server_t srv;
+    srv.index_dir = INDEX_DIR;
+    srv.block_cache = (size_t)block_cache_mb << 20;
+    pthread_rwlock_init(&srv.reload_lock, NULL);
+    if (qcache_init(&srv.cache, (size_t)cache_mb << 20) != 0) {
+        fprintf(stderr, "Fallo al crear la caché de resultados\n");
+        return 1;
     }
-    fclose(csvf);
-    index_close(&th);
-    index_close(&ah);
+
+    if (ensure_fifo(REQ_FIFO) != 0) return 1;
+
+    /* O_RDWR: the FIFO always has a writer, so it never reports EOF */
+    int req_fd = open(REQ_FIFO, O_RDWR | O_NONBLOCK);
+    if (req_fd < 0) { printf("fifo de peticiones"); return 1; }
+    /* a client that goes away mid-answer must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* SIGINT and SIGTERM stop the server, SIGHUP reloads the indices and
+       SIGUSR1 prints the cache counters. they are read from a signalfd by the
+       event loop, blocked before any thread starts so the workers inherit
+       the mask */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    int sig_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (sig_fd < 0) { perror("signalfd"); close(req_fd); return 1; }
+
+    if (open_indices(&srv) != 0) {
+        close(req_fd);
+        return 1;
+    }
+
+    /* fixed pool, one worker per online CPU */
+    int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 2) num_workers = 2;
+    if (num_workers > MAX_WORKERS) num_workers = MAX_WORKERS;
+    pthread_t workers[MAX_WORKERS];
+    if (workq_init(&srv.queue, QUEUE_CAP) != 0) {
+        fprintf(stderr, "Fallo al crear la cola de peticiones\n");
+        return 1;
+    }
+    for (int i = 0; i < num_workers; ++i) {
+        if (pthread_create(&workers[i], NULL, worker_main, &srv) != 0) {
+            fprintf(stderr, "Fallo al crear los hilos de trabajo\n");
+            return 1;
+        }
+    }
+    printf("Esperando peticiones de busqueda (%d hilos)\n", num_workers);
+    fflush(stdout);
+
+    int ep_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = req_fd};
+    if (ep_fd < 0 || epoll_ctl(ep_fd, EPOLL_CTL_ADD, req_fd, &ev) != 0) {
+        perror("epoll");
+        return 1;
+    }
+    ev.data.fd = sig_fd;
+    if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, sig_fd, &ev) != 0) {
+        perror("epoll");
+        return 1;
+    }
+
+    /* queries are written with a single write of at most PIPE_BUF bytes, so
+       messages of concurrent clients never interleave in the FIFO */
+    static req_buf_t req_buf;
+    int running = 1;
+    while (running) {
+        struct epoll_event events[4];
+        int n = epoll_wait(ep_fd, events, 4, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == sig_fd) {
+                struct signalfd_siginfo si;
+                if (read(sig_fd, &si, sizeof si) != (ssize_t)sizeof si) continue;
+                if (si.ssi_signo == SIGHUP) {
+                    reload_indices(&srv);
+                } else if (si.ssi_signo == SIGUSR1) {
+                    print_cache_stats(&srv);
+                } else {
+                    printf("Señal %u recibida, cerrando el servidor\n", si.ssi_signo);
+                    running = 0;
+                }
+            } else if (drain_requests(&srv, req_fd, &req_buf) != 0) {
+                perror("leer fifo de peticiones");
+                running = 0;
+            }
+        }
+    }
+
+    /* queued requests are still answered before the workers exit */
+    workq_close(&srv.queue);
+    for (int i = 0; i < num_workers; ++i) pthread_join(workers[i], NULL);
+    workq_free(&srv.queue);
+    print_cache_stats(&srv);
+    qcache_free(&srv.cache);
+    close_indices(&srv);
+    pthread_rwlock_destroy(&srv.reload_lock);
+    close(ep_fd);
+    close(sig_fd);
     close(req_fd);
-    close(rsp_fd);
+    unlink(REQ_FIFO);
     return 0;
-}
\ No newline at end of file
+}
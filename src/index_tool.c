@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+#include "common.h"
+#include "reader.h"
+#include "index_ops.h"
+#include "records.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* index_tool: offline maintenance of the title/author indices
+ *
+ *   index_tool stats   <title|author> [index_dir]
+ *   index_tool compact <title|author> [index_dir]
+ *   index_tool resize  <title|author> <num_buckets|auto[:load_factor]> [index_dir]
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso:\n"
+            "  %s stats   <title|author> [dir_indices]\n"
+            "  %s compact <title|author> [dir_indices]\n"
+            "  %s resize  <title|author> <num_buckets|auto[:factor_carga]> [dir_indices]\n",
+            prog, prog, prog);
+}
+
+static int cmd_stats(const char *dir, const char *name) {
+    char buckets_path[1024], arrays_path[1024];
+    snprintf(buckets_path, sizeof(buckets_path), "%s/%s_buckets.dat", dir, name);
+    snprintf(arrays_path, sizeof(arrays_path), "%s/%s_arrays.dat", dir, name);
+
+    index_handle_t h;
+    if (index_open_mmap(&h, buckets_path, arrays_path) != 0 &&
+        index_open(&h, buckets_path, arrays_path) != 0) {
+        fprintf(stderr, "No se pudo abrir el índice %s/%s\n", dir, name);
+        return 1;
+    }
+    index_stats_t st;
+    int rc = index_compute_stats(&h, &st);
+    index_close(&h);
+    if (rc != 0) {
+        fprintf(stderr, "Error recorriendo el índice %s/%s\n", dir, name);
+        return 1;
+    }
+
+    printf("Índice: %s/%s\n", dir, name);
+    printf("- Buckets: %llu (usados %llu)\n", (unsigned long long)st.num_buckets, (unsigned long long)st.used_buckets);
+    printf("- Nodos: %llu\n", (unsigned long long)st.num_nodes);
+    printf("- Offsets: %llu\n", (unsigned long long)st.num_offsets);
+    printf("- Cadena media (buckets usados): %.2f\n",
+           st.used_buckets ? (double)st.num_nodes / (double)st.used_buckets : 0.0);
+    printf("- Cadena máxima: %llu\n", (unsigned long long)st.max_chain);
+    printf("- Factor de carga: %.2f\n", st.num_buckets ? (double)st.num_nodes / (double)st.num_buckets : 0.0);
+    printf("- Tamaño arrays.dat: %llu bytes\n", (unsigned long long)st.arrays_bytes);
+    printf("- Formato: %s%s%s\n", (st.flags & INDEX_FLAG_CLUSTERED) ? "agrupado por bucket" : "v1",
+           (st.flags & INDEX_FLAG_TAGGED) ? ", con etiquetas de hash" : "",
+           (st.flags & INDEX_FLAG_VARINT) ? ", offsets comprimidos (delta + varint)" : "");
+    printf("- Postings: %s\n", (st.flags & INDEX_FLAG_ROWIDS) ? "filas de " RECORDS_FILE : "offsets en el CSV");
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *cmd = argv[1];
+    const char *name = argv[2];
+    const char *dir = argc > 3 ? argv[3] : INDEX_DIR;
+
+    if (strcmp(cmd, "stats") == 0) {
+        return cmd_stats(dir, name);
+    }
+    if (strcmp(cmd, "compact") == 0) {
+        if (index_compact(dir, name) != 0) {
+            fprintf(stderr, "Fallo al compactar el índice %s/%s\n", dir, name);
+            return 1;
+        }
+        printf("Índice %s/%s compactado.\n", dir, name);
+        return cmd_stats(dir, name);
+    }
+    if (strcmp(cmd, "resize") == 0) {
+        if (argc < 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *size_arg = argv[3];
+        dir = argc > 4 ? argv[4] : INDEX_DIR;
+
+        uint64_t num_buckets = 0;
+        double load_factor = 0.0;
+        if (strncmp(size_arg, "auto", 4) == 0) {
+            if (size_arg[4] == ':') load_factor = strtod(size_arg + 5, NULL);
+            if (load_factor <= 0.0) load_factor = INDEX_DEFAULT_LOAD_FACTOR;
+        } else {
+            char *end = NULL;
+            num_buckets = strtoull(size_arg, &end, 10);
+            if (!end || *end != '\0' || num_buckets == 0) {
+                fprintf(stderr, "Número de buckets no válido: %s\n", size_arg);
+                return 1;
+            }
+        }
+        if (index_resize(dir, name, num_buckets, load_factor) != 0) {
+            fprintf(stderr, "Fallo al redimensionar el índice %s/%s\n", dir, name);
+            return 1;
+        }
+        printf("Índice %s/%s redimensionado.\n", dir, name);
+        return cmd_stats(dir, name);
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,215 @@
+#include "index_writer.h"
+#include "arrays.h"
+#include "buckets.h"
+#include "common.h"
+#include "hash.h"
+#include "varint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int index_writer_open(index_writer_t *w, const char *out_dir, const char *index_name,
+    uint64_t num_buckets, uint64_t hash_seed)
+{
+    return index_writer_open_flags(w, out_dir, index_name, num_buckets, hash_seed, 0);
+}
+
+int index_writer_open_flags(index_writer_t *w, const char *out_dir, const char *index_name,
+    uint64_t num_buckets, uint64_t hash_seed, uint16_t flags)
+{
+    memset(w, 0, sizeof *w);
+    w->buckets_fd = w->arrays_fd = -1;
+
+    char buckets_path[1024];
+    char arrays_path[1024];
+    snprintf(buckets_path, sizeof(buckets_path), "%s/%s_buckets.dat", out_dir, index_name);
+    snprintf(arrays_path, sizeof(arrays_path), "%s/%s_arrays.dat", out_dir, index_name);
+
+    if (buckets_create_flags(buckets_path, num_buckets, hash_seed, flags) != 0) {
+        fprintf(stderr, "Failed to create buckets file %s\n", buckets_path);
+        return -1;
+    }
+    if (arrays_create(arrays_path) != 0) {
+        fprintf(stderr, "Failed to create arrays file %s\n", arrays_path);
+        return -1;
+    }
+
+    w->buckets_fd = buckets_open_header(buckets_path, &w->hdr);
+    if (w->buckets_fd < 0) { fprintf(stderr,"open buckets failed\n"); return -1; }
+    w->arrays_fd = arrays_open(arrays_path);
+    if (w->arrays_fd < 0) { fprintf(stderr,"open arrays failed\n"); index_writer_close(w); return -1; }
+
+    w->entries = calloc((size_t)num_buckets, sizeof(bucket_entry_t));
+    w->buf = malloc(INDEX_WRITER_BUF_SIZE);
+    if (!w->entries || !w->buf) { index_writer_close(w); return -1; }
+    w->buf_cap = INDEX_WRITER_BUF_SIZE;
+    w->buf_off = (off_t)ARRAYS_HEADER_SIZE;
+    w->cur_bucket = UINT64_MAX;
+    return 0;
+}
+
+static int writer_flush(index_writer_t *w) {
+    if (w->buf_len == 0) return 0;
+    if (safe_pwrite(w->arrays_fd, w->buf, w->buf_len, w->buf_off) != (ssize_t)w->buf_len) return -1;
+    w->buf_off += (off_t)w->buf_len;
+    w->buf_len = 0;
+    return 0;
+}
+
+static int cmp_off(const void *a, const void *b) {
+    off_t x = *(const off_t *)a;
+    off_t y = *(const off_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* offsets in ascending order: the list itself when it already is, else a
+   sorted copy kept in the writer */
+static const off_t *writer_sorted(index_writer_t *w, const off_t *offsets, uint32_t list_len) {
+    uint32_t i = 1;
+    while (i < list_len && offsets[i - 1] <= offsets[i]) i++;
+    if (i >= list_len) return offsets;
+    if (list_len > w->sorted_cap) {
+        off_t *tmp = realloc(w->sorted, (size_t)list_len * sizeof(off_t));
+        if (!tmp) return NULL;
+        w->sorted = tmp;
+        w->sorted_cap = list_len;
+    }
+    memcpy(w->sorted, offsets, (size_t)list_len * sizeof(off_t));
+    qsort(w->sorted, list_len, sizeof(off_t), cmp_off);
+    return w->sorted;
+}
+
+/* clustered mode: point the previous node of the bucket at node_off */
+static int writer_link_previous(index_writer_t *w, off_t node_off) {
+    uint64_t v = (uint64_t)node_off;
+    if (w->last_next_pos >= w->buf_off) {
+        memcpy(w->buf + (w->last_next_pos - w->buf_off), &v, sizeof v);
+        return 0;
+    }
+    /* already flushed (the node was at the end of a full buffer) */
+    if (safe_pwrite(w->arrays_fd, &v, sizeof v, w->last_next_pos) != (ssize_t)sizeof v) return -1;
+    return 0;
+}
+
+off_t index_writer_add(index_writer_t *w, uint64_t hash, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len)
+{
+    uint64_t bucket = bucket_id_from_hash(hash, w->hdr.num_buckets - 1);
+    int clustered = (w->hdr.flags & INDEX_FLAG_CLUSTERED) != 0;
+    int tagged = (w->hdr.flags & INDEX_FLAG_TAGGED) != 0;
+    int varint = tagged && (w->hdr.flags & INDEX_FLAG_VARINT) != 0;
+    bucket_entry_t *e = &w->entries[bucket];
+    if (clustered && bucket != w->cur_bucket && e->head != 0) {
+        fprintf(stderr, "clustered index: nodes of bucket %llu are not contiguous\n", (unsigned long long)bucket);
+        return 0;
+    }
+
+    size_t node_size;
+    if (varint) {
+        offsets = writer_sorted(w, offsets, list_len);
+        if (!offsets) return 0;
+        size_t list_bytes = varint_delta_size(offsets, list_len);
+        if (list_bytes > UINT32_MAX) return 0;
+        node_size = arrays_calc_varint_node_size(key_len, (uint32_t)list_bytes);
+    } else if (tagged) {
+        node_size = arrays_calc_tagged_node_size(key_len, list_len);
+    } else {
+        node_size = arrays_calc_node_size(key_len, list_len);
+    }
+    if (clustered && (uint64_t)e->extent_len + node_size > UINT32_MAX) return 0;
+    if (w->buf_len + node_size > w->buf_cap) {
+        if (writer_flush(w) != 0) return 0;
+        if (node_size > w->buf_cap) {
+            unsigned char *tmp = realloc(w->buf, node_size);
+            if (!tmp) return 0;
+            w->buf = tmp;
+            w->buf_cap = node_size;
+        }
+    }
+
+    off_t node_off = w->buf_off + (off_t)w->buf_len;
+    off_t next = clustered ? 0 : e->head;
+    if (varint) {
+        arrays_encode_varint_node(w->buf + w->buf_len, hash_tag(hash), key, key_len, offsets, list_len, next);
+        e->tag_filter |= buckets_tag_bits(hash_tag(hash));
+    } else if (tagged) {
+        arrays_encode_tagged_node(w->buf + w->buf_len, hash_tag(hash), key, key_len, offsets, list_len, next);
+        e->tag_filter |= buckets_tag_bits(hash_tag(hash));
+    } else {
+        arrays_encode_node(w->buf + w->buf_len, key, key_len, offsets, list_len, next);
+    }
+    w->buf_len += node_size;
+
+    if (clustered) {
+        if (e->head == 0) {
+            e->head = node_off;
+        } else if (writer_link_previous(w, node_off) != 0) {
+            return 0;
+        }
+        e->extent_len += (uint32_t)node_size;
+        w->cur_bucket = bucket;
+        w->last_next_pos = tagged ? node_off + ARRAYS_TAGGED_NEXT_POS : node_off + (off_t)node_size - (off_t)sizeof(uint64_t);
+    } else {
+        e->head = node_off;
+    }
+    w->num_nodes++;
+    return node_off;
+}
+
+int index_writer_close(index_writer_t *w) {
+    int rc = 0;
+    if (w->arrays_fd >= 0 && w->buf && writer_flush(w) != 0) rc = -1;
+    if (w->buckets_fd >= 0 && w->entries && rc == 0) {
+        if (buckets_write_entries(w->buckets_fd, &w->hdr, w->entries) != 0) rc = -1;
+    }
+    if (w->buckets_fd >= 0) close(w->buckets_fd);
+    if (w->arrays_fd >= 0) close(w->arrays_fd);
+    free(w->entries);
+    free(w->buf);
+    free(w->sorted);
+    w->entries = NULL;
+    w->buf = NULL;
+    w->sorted = NULL;
+    w->sorted_cap = 0;
+    w->buckets_fd = w->arrays_fd = -1;
+    return rc;
+}
+
+int index_writer_write_keymap(const keymap_t *map, const char *out_dir, const char *index_name,
+    uint64_t num_buckets, uint64_t hash_seed, uint16_t flags)
+{
+    uint64_t mask = num_buckets - 1;
+
+    /* counting sort of entry indices by bucket */
+    size_t *start = calloc((size_t)num_buckets + 1, sizeof(size_t));
+    uint32_t *order = malloc((map->count ? map->count : 1) * sizeof(uint32_t));
+    if (!start || !order) { free(start); free(order); return -1; }
+    for (size_t i = 0; i < map->count; ++i) {
+        start[bucket_id_from_hash(map->entries[i].hash, mask) + 1]++;
+    }
+    for (uint64_t b = 0; b < num_buckets; ++b) start[b + 1] += start[b];
+    for (size_t i = 0; i < map->count; ++i) {
+        order[start[bucket_id_from_hash(map->entries[i].hash, mask)]++] = (uint32_t)i;
+    }
+    free(start);
+
+    index_writer_t w;
+    if (index_writer_open_flags(&w, out_dir, index_name, num_buckets, hash_seed, flags | INDEX_FLAG_CLUSTERED) != 0) {
+        free(order);
+        return -1;
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < map->count; ++i) {
+        const keymap_entry_t *e = &map->entries[order[i]];
+        if (index_writer_add(&w, e->hash, e->key, e->key_len, e->offsets, e->count) == 0) {
+            fprintf(stderr, "failed append node\n");
+            rc = -1;
+            break;
+        }
+    }
+    free(order);
+    if (index_writer_close(&w) != 0) rc = -1;
+    return rc;
+}
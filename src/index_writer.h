@@ -0,0 +1,67 @@
+#ifndef INDEX_WRITER_H
+#define INDEX_WRITER_H
+
+#include <stdint.h>
+#include "common.h"
+#include "buckets.h"
+#include "keymap.h"
+
+/* index_writer.h
+ *
+ * Build-time writer for a buckets/arrays pair. The bucket table is kept in
+ * RAM and nodes are serialized into a large append buffer whose file offset
+ * is tracked, so adding a node costs no syscall; the buffer is flushed with
+ * one pwrite when full and buckets.dat is written once on close.
+ *
+ * Without flags every node is linked in front of its bucket chain (v1 layout).
+ * With INDEX_FLAG_CLUSTERED nodes must be added grouped by bucket: each node is
+ * linked after the previous one of the same bucket and the bucket entry records
+ * the extent [head, head + extent_len) covering the whole chain.
+ * With INDEX_FLAG_TAGGED nodes are written tagged and every bucket entry gets
+ * the tag filter of its chain; adding INDEX_FLAG_VARINT stores their offsets
+ * sorted and delta + varint coded.
+ */
+
+#define INDEX_WRITER_BUF_SIZE (1u << 20)
+
+typedef struct {
+    int buckets_fd;
+    int arrays_fd;
+    buckets_header_t hdr;
+    bucket_entry_t *entries; // table of every bucket
+    unsigned char *buf;      // pending nodes, buf[0] goes at buf_off
+    size_t buf_len;
+    size_t buf_cap;
+    off_t buf_off;
+    uint64_t num_nodes;
+    /* clustered mode: bucket being written and where its last next_ptr lives */
+    uint64_t cur_bucket;
+    off_t last_next_pos;
+    /* varint mode: sorted copy of an unsorted offsets list */
+    off_t *sorted;
+    size_t sorted_cap;
+} index_writer_t;
+
+/* create <out_dir>/<index_name>_{buckets,arrays}.dat and start writing them */
+int index_writer_open(index_writer_t *w, const char *out_dir, const char *index_name,
+    uint64_t num_buckets, uint64_t hash_seed);
+
+/* same with layout flags (INDEX_FLAG_*) */
+int index_writer_open_flags(index_writer_t *w, const char *out_dir, const char *index_name,
+    uint64_t num_buckets, uint64_t hash_seed, uint16_t flags);
+
+/* add a node to the chain of the bucket of hash (hash_key_prefix of key),
+   returns its offset in arrays.dat (0 on error) */
+off_t index_writer_add(index_writer_t *w, uint64_t hash, const char *key, uint16_t key_len,
+    const off_t *offsets, uint32_t list_len);
+
+/* flush pending nodes, write the bucket table and close the files */
+int index_writer_close(index_writer_t *w);
+
+/* Write a whole grouped index from a keymap: one node per entry, ordered by
+   bucket (insertion order within a bucket) and clustered, with the layout
+   flags (INDEX_LAYOUT_DEFAULT for the usual ones; CLUSTERED is always set) */
+int index_writer_write_keymap(const keymap_t *map, const char *out_dir, const char *index_name,
+    uint64_t num_buckets, uint64_t hash_seed, uint16_t flags);
+
+#endif // INDEX_WRITER_H
@@ -0,0 +1,93 @@
+#include "keymap.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYMAP_INITIAL_SLOTS 1024
+
+int keymap_init(keymap_t *m, uint64_t hash_seed) {
+    memset(m, 0, sizeof *m);
+    m->hash_seed = hash_seed;
+    m->num_slots = KEYMAP_INITIAL_SLOTS;
+    m->slots = calloc(m->num_slots, sizeof(uint32_t));
+    if (!m->slots) return -1;
+    arena_init(&m->arena, 0);
+    return 0;
+}
+
+/* double the slot table once it is half full */
+static int keymap_grow_slots(keymap_t *m) {
+    size_t num_slots = m->num_slots * 2;
+    uint32_t *slots = calloc(num_slots, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (size_t i = 0; i < m->count; ++i) {
+        size_t s = (size_t)m->entries[i].hash & (num_slots - 1);
+        while (slots[s] != 0) s = (s + 1) & (num_slots - 1);
+        slots[s] = (uint32_t)(i + 1);
+    }
+    free(m->slots);
+    m->slots = slots;
+    m->num_slots = num_slots;
+    return 0;
+}
+
+keymap_entry_t *keymap_get(keymap_t *m, const char *key, size_t len) {
+    return keymap_get_hashed(m, key, len, hash_key_prefix(key, len, m->hash_seed));
+}
+
+keymap_entry_t *keymap_get_hashed(keymap_t *m, const char *key, size_t len, uint64_t h) {
+    if (len > UINT16_MAX) return NULL;
+    size_t s = (size_t)h & (m->num_slots - 1);
+    while (m->slots[s] != 0) {
+        keymap_entry_t *e = &m->entries[m->slots[s] - 1];
+        if (e->hash == h && e->key_len == len && memcmp(e->key, key, len) == 0) return e;
+        s = (s + 1) & (m->num_slots - 1);
+    }
+
+    /* insert */
+    if (m->count >= UINT32_MAX - 1) return NULL;
+    if (m->count == m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 1024;
+        keymap_entry_t *tmp = realloc(m->entries, cap * sizeof *tmp);
+        if (!tmp) return NULL;
+        m->entries = tmp;
+        m->cap = cap;
+    }
+    keymap_entry_t *e = &m->entries[m->count];
+    e->key = arena_strndup(&m->arena, key, len);
+    if (!e->key) return NULL;
+    e->key_len = (uint16_t)len;
+    e->hash = h;
+    e->offsets = NULL;
+    e->count = 0;
+    e->cap = 0;
+    m->slots[s] = (uint32_t)(++m->count);
+
+    if (m->count * 2 > m->num_slots) {
+        size_t idx = m->count - 1;
+        if (keymap_grow_slots(m) != 0) return NULL;
+        return &m->entries[idx];
+    }
+    return e;
+}
+
+int keymap_push(keymap_t *m, keymap_entry_t *e, off_t offset) {
+    if (e->count == e->cap) {
+        if (e->cap >= UINT32_MAX / 2) return -1;
+        uint32_t cap = e->cap ? e->cap * 2 : 1;
+        off_t *tmp = arena_alloc(&m->arena, sizeof(off_t) * cap);
+        if (!tmp) return -1;
+        if (e->count) memcpy(tmp, e->offsets, sizeof(off_t) * e->count);
+        e->offsets = tmp;
+        e->cap = cap;
+    }
+    e->offsets[e->count++] = offset;
+    return 0;
+}
+
+void keymap_free(keymap_t *m) {
+    free(m->entries);
+    free(m->slots);
+    arena_free(&m->arena);
+    memset(m, 0, sizeof *m);
+}
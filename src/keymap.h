@@ -0,0 +1,54 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+#include "arena.h"
+
+/* keymap.h
+ *
+ * In-memory map from normalized key to the list of record offsets that have
+ * that key, used to group postings before writing them to arrays.dat (one node
+ * per distinct key instead of one node per row).
+ *
+ * Open addressing over a slot table of entry indices; entries are kept in
+ * insertion order. Keys and offsets lists live in the map arena: a list that
+ * grows is copied to a block twice its size (the old one is abandoned), so no
+ * per-key malloc/free is needed.
+ */
+
+typedef struct {
+    const char *key;     // NUL-terminated, arena owned
+    uint16_t key_len;
+    uint64_t hash;       // hash_key_prefix(key) with the map seed
+    off_t *offsets;      // arena owned, in insertion order
+    uint32_t count;
+    uint32_t cap;
+} keymap_entry_t;
+
+typedef struct {
+    keymap_entry_t *entries;
+    size_t count;
+    size_t cap;
+    uint32_t *slots;     // index + 1 into entries, 0 = empty
+    size_t num_slots;    // power of two
+    uint64_t hash_seed;
+    arena_t arena;
+} keymap_t;
+
+int keymap_init(keymap_t *m, uint64_t hash_seed);
+
+/* find the entry for key (len bytes, already normalized), inserting an empty one if missing.
+   the pointer is only valid until the next keymap_get */
+keymap_entry_t *keymap_get(keymap_t *m, const char *key, size_t len);
+
+/* same as keymap_get when hash_key_prefix(key) is already known */
+keymap_entry_t *keymap_get_hashed(keymap_t *m, const char *key, size_t len, uint64_t hash);
+
+/* append an offset to an entry's list */
+int keymap_push(keymap_t *m, keymap_entry_t *e, off_t offset);
+
+void keymap_free(keymap_t *m);
+
+#endif // KEYMAP_H
@@ -0,0 +1,273 @@
+#include "numeric.h"
+#include "records.h"
+#include "util.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* largest magnitude of a scaled value, well within the exact integers of a double */
+#define NUMERIC_VALUE_MAX 1e15
+
+const numeric_column_t numeric_columns[NUMERIC_NUM_COLUMNS] = {
+    {"pages", "num_pages", 3, 1},
+    {"rating", "average_rating", 4, 100},
+    {"reviews", "text_review_count", 5, 1},
+    {"ratings", "total_rating_counts", 12, 1},
+};
+
+typedef struct numeric_entry {
+    int64_t value;
+    uint32_t row;
+} entry_t;
+
+static int cmp_entry(const void *pa, const void *pb) {
+    const entry_t *a = pa, *b = pb;
+    if (a->value != b->value) return a->value < b->value ? -1 : 1;
+    return (a->row > b->row) - (a->row < b->row);
+}
+
+/* number in the NUL-terminated s (spaces around it allowed) times scale.
+   returns 0, -1 if s is not a number */
+static int parse_value(const char *s, uint32_t scale, int64_t *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s) return -1;
+    while (isspace((unsigned char)*end)) end++;
+    if (*end != '\0' || !isfinite(v) || fabs(v * scale) > NUMERIC_VALUE_MAX) return -1;
+    *out = llround(v * scale);
+    return 0;
+}
+
+int numeric_builder_init(numeric_builder_t *b, uint64_t num_rows, uint32_t scale) {
+    memset(b, 0, sizeof *b);
+    if (num_rows > UINT32_MAX || scale == 0) return -1;
+    b->num_rows = (uint32_t)num_rows;
+    b->scale = scale;
+    b->entries = malloc(((size_t)b->num_rows + 1) * sizeof *b->entries);
+    b->values = malloc(((size_t)b->num_rows + 1) * sizeof *b->values);
+    if (!b->entries || !b->values) return -1;
+    for (uint32_t i = 0; i < b->num_rows; ++i) b->values[i] = NUMERIC_NONE;
+    return 0;
+}
+
+int numeric_builder_add(uint64_t row, const char *field, size_t len, void *ctx) {
+    numeric_builder_t *b = ctx;
+    int64_t v;
+    (void)len;
+    if (row >= b->num_rows) return -1;
+    /* rows without a number in the column never match a range */
+    if (parse_value(field, b->scale, &v) != 0) return 0;
+    b->entries[b->n].value = v;
+    b->entries[b->n].row = (uint32_t)row;
+    b->n++;
+    b->values[row] = v;
+    return 0;
+}
+
+void numeric_builder_free(numeric_builder_t *b) {
+    if (!b) return;
+    free(b->entries);
+    free(b->values);
+    memset(b, 0, sizeof *b);
+}
+
+int numeric_build(const char *records_path, int field_idx, uint32_t scale, const char *out_path) {
+    if (field_idx < 0 || field_idx >= NUM_DATASET_FIELDS) return -1;
+    records_t r;
+    if (records_open(&r, records_path) != 0) return -1;
+    numeric_builder_t b;
+    int rc = numeric_builder_init(&b, r.num_rows, scale);
+    if (rc == 0) rc = records_for_each_field(&r, field_idx, numeric_builder_add, &b);
+    records_close(&r);
+    if (rc == 0) rc = numeric_builder_write(&b, out_path);
+    numeric_builder_free(&b);
+    return rc;
+}
+
+int numeric_builder_write(numeric_builder_t *b, const char *out_path) {
+    entry_t *entries = b->entries;
+    uint64_t n = b->n;
+    uint64_t num_rows = b->num_rows;
+    size_t values_off = NUMERIC_HEADER_SIZE + (size_t)n * NUMERIC_ENTRY_SIZE;
+    size_t len = values_off + (size_t)num_rows * sizeof(int64_t);
+    qsort(entries, n, sizeof *entries, cmp_entry);
+    unsigned char *buf = calloc(1, len);
+    int rc = buf ? 0 : -1;
+    if (rc == 0) {
+        uint16_t version = NUMERIC_VERSION;
+        memcpy(buf, NUMERIC_MAGIC, 4);
+        memcpy(buf + 4, &version, sizeof version);
+        memcpy(buf + 8, &b->scale, sizeof b->scale);
+        memcpy(buf + 16, &n, sizeof n);
+        memcpy(buf + 24, &num_rows, sizeof num_rows);
+        unsigned char *p = buf + NUMERIC_HEADER_SIZE;
+        for (uint64_t i = 0; i < n; ++i, p += NUMERIC_ENTRY_SIZE) {
+            memcpy(p, &entries[i].value, sizeof entries[i].value);
+            memcpy(p + 8, &entries[i].row, sizeof entries[i].row);
+        }
+        memcpy(buf + values_off, b->values, (size_t)num_rows * sizeof(int64_t));
+        int fd = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0) {
+            rc = -1;
+        } else {
+            if (safe_pwrite(fd, buf, len, 0) != (ssize_t)len) rc = -1;
+            if (close(fd) != 0) rc = -1;
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+int numeric_open(numeric_index_t *n, const char *path) {
+    memset(n, 0, sizeof *n);
+    n->fd = -1;
+    if (map_file(path, NUMERIC_HEADER_SIZE, &n->fd, &n->map, &n->map_len) != 0) return -1;
+
+    uint16_t version;
+    memcpy(&version, n->map + 4, sizeof version);
+    memcpy(&n->scale, n->map + 8, sizeof n->scale);
+    memcpy(&n->num_entries, n->map + 16, sizeof n->num_entries);
+    memcpy(&n->num_rows, n->map + 24, sizeof n->num_rows);
+    size_t avail = n->map_len - NUMERIC_HEADER_SIZE;
+    if (memcmp(n->map, NUMERIC_MAGIC, 4) != 0 || version != NUMERIC_VERSION || n->scale == 0 ||
+        n->num_entries > avail / NUMERIC_ENTRY_SIZE || n->num_entries > n->num_rows ||
+        n->num_rows > (avail - n->num_entries * NUMERIC_ENTRY_SIZE) / sizeof(int64_t)) {
+        numeric_close(n);
+        return -1;
+    }
+    n->entries = n->map + NUMERIC_HEADER_SIZE;
+    n->values = n->entries + n->num_entries * NUMERIC_ENTRY_SIZE;
+    return 0;
+}
+
+void numeric_close(numeric_index_t *n) {
+    if (!n) return;
+    unmap_file(n->fd, n->map, n->map_len);
+    memset(n, 0, sizeof *n);
+    n->fd = -1;
+}
+
+static int64_t value_at(const numeric_index_t *n, uint64_t i) {
+    int64_t v;
+    memcpy(&v, n->entries + i * NUMERIC_ENTRY_SIZE, sizeof v);
+    return v;
+}
+
+uint32_t numeric_row(const numeric_index_t *n, uint64_t i) {
+    uint32_t row;
+    memcpy(&row, n->entries + i * NUMERIC_ENTRY_SIZE + 8, sizeof row);
+    return row;
+}
+
+/* first entry with a value above v (inclusive: at least v) */
+static uint64_t bound(const numeric_index_t *n, int64_t v, int inclusive) {
+    uint64_t lo = 0, hi = n->num_entries;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        int64_t x = value_at(n, mid);
+        if (x < v || (!inclusive && x == v)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void numeric_range(const numeric_index_t *n, int64_t lo, int64_t hi, uint64_t *first, uint64_t *count) {
+    *first = 0;
+    *count = 0;
+    if (!n->map || lo > hi) return;
+    uint64_t a = bound(n, lo, 1), b = bound(n, hi, 0);
+    *first = a;
+    *count = b > a ? b - a : 0;
+}
+
+static const char *skip_spaces(const char *p) {
+    while (isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+static int is_ident(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+int numeric_parse_filter(const char *filter, numeric_pred_t *out, int max) {
+    const char *p = skip_spaces(filter);
+    int n = 0;
+    while (*p != '\0') {
+        if (n == max) return -1;
+        const char *name = p;
+        while (is_ident(*p)) p++;
+        size_t name_len = (size_t)(p - name);
+        int column = -1;
+        for (int c = 0; c < NUMERIC_NUM_COLUMNS && name_len > 0; ++c) {
+            if ((strlen(numeric_columns[c].name) == name_len && strncasecmp(name, numeric_columns[c].name, name_len) == 0) ||
+                (strlen(numeric_columns[c].column) == name_len && strncasecmp(name, numeric_columns[c].column, name_len) == 0)) {
+                column = c;
+            }
+        }
+        if (column < 0) return -1;
+
+        p = skip_spaces(p);
+        char op[3] = {0};
+        if (*p == '<' || *p == '>' || *p == '=') {
+            op[0] = *p++;
+            if (*p == '=') op[1] = *p++;
+        }
+        if (op[0] == '\0') return -1;
+
+        /* compare on the scaled integers: v * scale is rounded towards the
+           values that satisfy the operator */
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p || !isfinite(v) || fabs(v * numeric_columns[column].scale) > NUMERIC_VALUE_MAX) return -1;
+        p = end;
+        double x = v * numeric_columns[column].scale;
+        numeric_pred_t *pred = &out[n++];
+        pred->column = column;
+        pred->lo = INT64_MIN;
+        pred->hi = INT64_MAX;
+        if (op[0] == '>') {
+            pred->lo = op[1] == '=' ? (int64_t)ceil(x - 1e-6) : (int64_t)floor(x + 1e-6) + 1;
+        } else if (op[0] == '<') {
+            pred->hi = op[1] == '=' ? (int64_t)floor(x + 1e-6) : (int64_t)ceil(x - 1e-6) - 1;
+        } else {
+            pred->lo = (int64_t)ceil(x - 1e-6);
+            pred->hi = (int64_t)floor(x + 1e-6);
+        }
+
+        /* AND, && or ',' before the next predicate */
+        p = skip_spaces(p);
+        if (*p == '\0') break;
+        if (*p == ',') {
+            p++;
+        } else if (p[0] == '&' && p[1] == '&') {
+            p += 2;
+        } else if (strncasecmp(p, "and", 3) == 0 && !is_ident(p[3])) {
+            p += 3;
+        } else {
+            return -1;
+        }
+        p = skip_spaces(p);
+        if (*p == '\0') return -1;
+    }
+    return n;
+}
+
+int numeric_value(const numeric_index_t *n, uint64_t row, int64_t *v) {
+    if (!n->map || row >= n->num_rows) return -1;
+    memcpy(v, n->values + row * sizeof *v, sizeof *v);
+    return *v == NUMERIC_NONE ? -1 : 0;
+}
+
+int numeric_test(const numeric_index_t *idx, const numeric_pred_t *preds, int n, uint64_t row) {
+    for (int i = 0; i < n; ++i) {
+        int64_t v;
+        if (numeric_value(&idx[preds[i].column], row, &v) != 0 || v < preds[i].lo || v > preds[i].hi) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,113 @@
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* numeric.h
+ *
+ * Sorted column files for range predicates over the numeric columns
+ * (<dir>/<name>_numeric.dat): one (value, row) entry per row of records.dat
+ * with a number in the column, sorted by value then row, followed by the
+ * value of every row in row order. Values are kept as integers, the number
+ * times the scale of the column (100 for the rating), so comparisons are
+ * exact. A range is two binary searches and walks rows in value order; a
+ * given row is tested with one read of the value column.
+ *
+ * File layout (host byte order):
+ * - header (NUMERIC_HEADER_SIZE bytes):
+ *   magic "NUM1", version u16, reserved u16, scale u32, reserved u32,
+ *   num_entries u64, num_rows u64
+ * - entries: value i64, row u32 (NUMERIC_ENTRY_SIZE bytes each)
+ * - values: i64 per row, NUMERIC_NONE for the rows without a number
+ *
+ * Filters are written as "rating >= 4.2 AND pages < 300": predicates
+ * joined by AND (or ','), each a column, an operator (<, <=, >, >=, =) and
+ * a number.
+ */
+
+#define NUMERIC_MAGIC "NUM1"
+#define NUMERIC_VERSION 2
+#define NUMERIC_HEADER_SIZE 32
+#define NUMERIC_ENTRY_SIZE 12
+#define NUMERIC_SUFFIX "_numeric.dat"
+#define NUMERIC_NUM_COLUMNS 4
+#define NUMERIC_MAX_PREDS 8
+#define NUMERIC_NONE INT64_MIN
+
+/* An indexed column: file and filter name, dataset column, scale */
+typedef struct {
+    const char *name;
+    const char *column;     // header of the column in the CSV, also accepted in filters
+    int field_idx;
+    uint32_t scale;
+} numeric_column_t;
+
+extern const numeric_column_t numeric_columns[NUMERIC_NUM_COLUMNS];
+
+typedef struct {
+    int fd;
+    const unsigned char *map;
+    size_t map_len;
+    uint32_t scale;
+    uint64_t num_entries;
+    uint64_t num_rows;
+    const unsigned char *entries;
+    const unsigned char *values;    // num_rows i64, by row
+} numeric_index_t;
+
+/* lo <= value <= hi on column numeric_columns[column], scaled */
+typedef struct {
+    int column;
+    int64_t lo;
+    int64_t hi;
+} numeric_pred_t;
+
+/* write out_path from the field field_idx of every record of records_path,
+   numbers times scale. returns 0 or -1 */
+int numeric_build(const char *records_path, int field_idx, uint32_t scale, const char *out_path);
+
+/* numeric_build split up for a shared scan of records.dat: init, then
+   numeric_builder_add (a records_field_cb) the column of every record,
+   then numeric_builder_write */
+typedef struct {
+    struct numeric_entry *entries;   // room for one per row
+    uint64_t n;
+    int64_t *values;                 // by row
+    uint32_t num_rows;
+    uint32_t scale;
+} numeric_builder_t;
+
+/* returns 0, or -1 (bad scale, too many rows, out of memory) */
+int numeric_builder_init(numeric_builder_t *b, uint64_t num_rows, uint32_t scale);
+
+int numeric_builder_add(uint64_t row, const char *field, size_t len, void *b);
+
+/* returns 0 or -1 */
+int numeric_builder_write(numeric_builder_t *b, const char *out_path);
+
+void numeric_builder_free(numeric_builder_t *b);
+
+/* map a column file read-only. returns 0 or -1 */
+int numeric_open(numeric_index_t *n, const char *path);
+
+void numeric_close(numeric_index_t *n);
+
+/* entries [*first, *first + *count) have lo <= value <= hi */
+void numeric_range(const numeric_index_t *n, int64_t lo, int64_t hi, uint64_t *first, uint64_t *count);
+
+/* row of entry i */
+uint32_t numeric_row(const numeric_index_t *n, uint64_t i);
+
+/* parse a filter into at most max predicates. returns how many, -1 if it
+   is not valid */
+int numeric_parse_filter(const char *filter, numeric_pred_t *out, int max);
+
+/* value of row in the column into v. returns 0, -1 when the row has none */
+int numeric_value(const numeric_index_t *n, uint64_t row, int64_t *v);
+
+/* 1 if row passes every predicate, 0 if not (a missing value fails), idx
+   being the files of every column (numeric_columns order) */
+int numeric_test(const numeric_index_t *idx, const numeric_pred_t *preds, int n, uint64_t row);
+
+#endif // NUMERIC_H
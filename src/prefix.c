@@ -0,0 +1,292 @@
+#include "prefix.h"
+#include "records.h"
+#include "arena.h"
+#include "varint.h"
+#include "util.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef struct prefix_entry {
+    const char *key;     // normalized, arena owned
+    const char *text;    // as stored in the record, arena owned
+    uint64_t row;
+    uint16_t key_len;
+    uint16_t text_len;
+} prefix_entry_t;
+
+/* by key, then by row so the first row of a value comes first */
+static int cmp_entry(const void *pa, const void *pb) {
+    const prefix_entry_t *a = pa, *b = pb;
+    int c = cmp_keys(a->key, a->key_len, b->key, b->key_len);
+    if (c != 0) return c;
+    return (a->row > b->row) - (a->row < b->row);
+}
+
+void prefix_builder_init(prefix_builder_t *b) {
+    memset(b, 0, sizeof *b);
+    arena_init(&b->arena, 0);
+}
+
+/* collect (normalized value, text, row) of one record */
+int prefix_builder_add(uint64_t row, const char *f, size_t flen, void *ctx) {
+    prefix_builder_t *b = ctx;
+    char key[PREFIX_KEY_MAX + 1];
+    size_t key_len = normalize_text(f, flen, key, sizeof key);
+    if (key_len == 0) return 0;
+
+    /* long texts are cut on a character boundary */
+    size_t text_len = flen < PREFIX_TEXT_MAX ? flen : PREFIX_TEXT_MAX;
+    while (text_len > 0 && text_len < flen && ((unsigned char)f[text_len] & 0xc0) == 0x80) text_len--;
+
+    if (b->n == b->cap) {
+        size_t new_cap = b->cap ? b->cap * 2 : 4096;
+        prefix_entry_t *tmp = realloc(b->entries, new_cap * sizeof *tmp);
+        if (!tmp) return -1;
+        b->entries = tmp;
+        b->cap = new_cap;
+    }
+    prefix_entry_t *e = &b->entries[b->n];
+    e->key = arena_strndup(&b->arena, key, key_len);
+    e->text = arena_strndup(&b->arena, f, text_len);
+    if (!e->key || !e->text) return -1;
+    e->key_len = (uint16_t)key_len;
+    e->text_len = (uint16_t)text_len;
+    e->row = row;
+    b->n++;
+    return 0;
+}
+
+void prefix_builder_free(prefix_builder_t *b) {
+    if (!b) return;
+    free(b->entries);
+    arena_free(&b->arena);
+    memset(b, 0, sizeof *b);
+}
+
+/* front code the sorted entries, one entry per distinct key, into o after
+   the header; block offsets go to *table_out */
+static int encode_blocks(const prefix_entry_t *entries, size_t n, out_buf_t *o,
+    uint64_t **table_out, uint32_t *num_keys_out, uint32_t *num_blocks_out)
+{
+    uint64_t *table = NULL;
+    size_t table_cap = 0;
+    uint32_t num_keys = 0, num_blocks = 0;
+    const prefix_entry_t *prev = NULL;
+
+    for (size_t i = 0; i < n;) {
+        const prefix_entry_t *e = &entries[i];
+        uint64_t rows = 0;
+        while (i < n && cmp_keys(entries[i].key, entries[i].key_len, e->key, e->key_len) == 0) {
+            rows++;
+            i++;
+        }
+
+        size_t shared = 0;
+        if (num_keys % PREFIX_BLOCK_KEYS == 0) {
+            if (num_blocks == table_cap) {
+                size_t new_cap = table_cap ? table_cap * 2 : 1024;
+                uint64_t *tmp = realloc(table, new_cap * sizeof *table);
+                if (!tmp) { free(table); return -1; }
+                table = tmp;
+                table_cap = new_cap;
+            }
+            table[num_blocks++] = o->len;
+        } else {
+            while (shared < prev->key_len && shared < e->key_len && prev->key[shared] == e->key[shared]) shared++;
+        }
+
+        size_t suffix = e->key_len - shared;
+        unsigned char *p = out_reserve(o, 4 * VARINT_MAX_BYTES + suffix + e->text_len);
+        if (!p) { free(table); return -1; }
+        p += varint_put(p, shared);
+        p += varint_put(p, suffix);
+        memcpy(p, e->key + shared, suffix);
+        p += suffix;
+        p += varint_put(p, e->text_len);
+        memcpy(p, e->text, e->text_len);
+        p += e->text_len;
+        p += varint_put(p, rows);
+        o->len = (size_t)(p - o->buf);
+        prev = e;
+        num_keys++;
+    }
+    *table_out = table;
+    *num_keys_out = num_keys;
+    *num_blocks_out = num_blocks;
+    return 0;
+}
+
+int prefix_build(const char *records_path, int field_idx, const char *out_path) {
+    if (field_idx < 0 || field_idx >= NUM_DATASET_FIELDS) return -1;
+    records_t r;
+    if (records_open(&r, records_path) != 0) return -1;
+    prefix_builder_t b;
+    prefix_builder_init(&b);
+    int rc = records_for_each_field(&r, field_idx, prefix_builder_add, &b);
+    records_close(&r);
+    if (rc == 0) rc = prefix_builder_write(&b, out_path);
+    prefix_builder_free(&b);
+    return rc;
+}
+
+int prefix_builder_write(prefix_builder_t *b, const char *out_path) {
+    prefix_entry_t *entries = b->entries;
+    size_t n = b->n;
+    out_buf_t o = {0};
+    uint64_t *table = NULL;
+    uint32_t num_keys = 0, num_blocks = 0;
+
+    qsort(entries, n, sizeof *entries, cmp_entry);
+    int rc = out_reserve(&o, PREFIX_HEADER_SIZE) ? 0 : -1;
+    if (rc == 0) {
+        memset(o.buf, 0, PREFIX_HEADER_SIZE);
+        o.len = PREFIX_HEADER_SIZE;
+        rc = encode_blocks(entries, n, &o, &table, &num_keys, &num_blocks);
+    }
+    uint64_t table_off = o.len;
+    size_t table_len = (size_t)num_blocks * sizeof(uint64_t);
+    if (rc == 0 && !out_reserve(&o, table_len)) rc = -1;
+    if (rc == 0) {
+        if (table_len) memcpy(o.buf + o.len, table, table_len);
+        o.len += table_len;
+
+        unsigned char *h = o.buf;
+        uint16_t version = PREFIX_VERSION;
+        uint32_t block_keys = PREFIX_BLOCK_KEYS;
+        uint64_t data_off = PREFIX_HEADER_SIZE;
+        memcpy(h, PREFIX_MAGIC, 4);
+        memcpy(h + 4, &version, sizeof version);
+        memcpy(h + 8, &num_keys, sizeof num_keys);
+        memcpy(h + 12, &block_keys, sizeof block_keys);
+        memcpy(h + 16, &num_blocks, sizeof num_blocks);
+        memcpy(h + 24, &table_off, sizeof table_off);
+        memcpy(h + 32, &data_off, sizeof data_off);
+
+        int fd = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0) {
+            rc = -1;
+        } else {
+            if (safe_pwrite(fd, o.buf, o.len, 0) != (ssize_t)o.len) rc = -1;
+            if (close(fd) != 0) rc = -1;
+        }
+    }
+
+    free(table);
+    free(o.buf);
+    return rc;
+}
+
+int prefix_open(prefix_index_t *p, const char *path) {
+    memset(p, 0, sizeof *p);
+    p->fd = -1;
+    if (map_file(path, PREFIX_HEADER_SIZE, &p->fd, &p->map, &p->map_len) != 0) return -1;
+
+    uint16_t version;
+    uint64_t table_off, data_off;
+    memcpy(&version, p->map + 4, sizeof version);
+    memcpy(&p->num_keys, p->map + 8, sizeof p->num_keys);
+    memcpy(&p->block_keys, p->map + 12, sizeof p->block_keys);
+    memcpy(&p->num_blocks, p->map + 16, sizeof p->num_blocks);
+    memcpy(&table_off, p->map + 24, sizeof table_off);
+    memcpy(&data_off, p->map + 32, sizeof data_off);
+    if (memcmp(p->map, PREFIX_MAGIC, 4) != 0 || version != PREFIX_VERSION || p->block_keys == 0 ||
+        data_off < PREFIX_HEADER_SIZE || table_off < data_off || table_off > p->map_len ||
+        (p->map_len - table_off) / sizeof(uint64_t) < p->num_blocks) {
+        prefix_close(p);
+        return -1;
+    }
+    p->table = p->map + table_off;
+    return 0;
+}
+
+void prefix_close(prefix_index_t *p) {
+    if (!p) return;
+    unmap_file(p->fd, p->map, p->map_len);
+    memset(p, 0, sizeof *p);
+    p->fd = -1;
+}
+
+/* Forward decoder over the entries, from the start of a block */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    char key[PREFIX_KEY_MAX];
+    size_t key_len;
+    const char *text;
+    size_t text_len;
+    uint32_t rows;
+} entry_cursor_t;
+
+static int block_cursor(const prefix_index_t *p, uint32_t block, entry_cursor_t *c) {
+    uint64_t off;
+    memcpy(&off, p->table + (size_t)block * sizeof off, sizeof off);
+    const unsigned char *end = p->table;
+    if (off < PREFIX_HEADER_SIZE || off > (uint64_t)(end - p->map)) return -1;
+    c->p = p->map + off;
+    c->end = end;
+    c->key_len = 0;
+    return 0;
+}
+
+/* returns 1 with the next entry decoded, 0 at the end, -1 if corrupt */
+static int entry_next(entry_cursor_t *c) {
+    if (c->p == c->end) return 0;
+    uint64_t shared, suffix, text_len, rows;
+    size_t u;
+    if ((u = varint_get(c->p, c->end, &shared)) == 0) return -1;
+    c->p += u;
+    if ((u = varint_get(c->p, c->end, &suffix)) == 0) return -1;
+    c->p += u;
+    if (shared > c->key_len || suffix > PREFIX_KEY_MAX - shared || suffix > (uint64_t)(c->end - c->p)) return -1;
+    memcpy(c->key + shared, c->p, suffix);
+    c->key_len = shared + suffix;
+    c->p += suffix;
+    if ((u = varint_get(c->p, c->end, &text_len)) == 0) return -1;
+    c->p += u;
+    /* the builder keeps at most PREFIX_TEXT_MAX bytes, callers size for that */
+    if (text_len > PREFIX_TEXT_MAX || text_len > (uint64_t)(c->end - c->p)) return -1;
+    c->text = (const char *)c->p;
+    c->text_len = text_len;
+    c->p += text_len;
+    if ((u = varint_get(c->p, c->end, &rows)) == 0 || rows > UINT32_MAX) return -1;
+    c->p += u;
+    c->rows = (uint32_t)rows;
+    return 1;
+}
+
+int prefix_complete(const prefix_index_t *p, const char *query, uint32_t limit,
+    prefix_visit_fn fn, void *ctx)
+{
+    if (!p || !p->map || !fn) return -1;
+    char q[PREFIX_KEY_MAX + 1];
+    size_t qlen = normalize_text(query, query ? strlen(query) : 0, q, sizeof q);
+    if (p->num_blocks == 0 || limit == 0) return 0;
+
+    /* last block whose first key sorts before the query: the first
+       completion is in it or at the start of the next one */
+    entry_cursor_t c;
+    uint32_t lo = 0, hi = p->num_blocks;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (block_cursor(p, mid, &c) != 0 || entry_next(&c) != 1) return -1;
+        if (cmp_keys(c.key, c.key_len, q, qlen) < 0) lo = mid;
+        else hi = mid;
+    }
+
+    /* blocks are contiguous, so the walk simply carries on into the next ones */
+    if (block_cursor(p, lo, &c) != 0) return -1;
+    int visited = 0;
+    int rc = 0;
+    while ((uint32_t)visited < limit && (rc = entry_next(&c)) == 1) {
+        if (cmp_keys(c.key, c.key_len, q, qlen) < 0) continue;
+        if (c.key_len < qlen || memcmp(c.key, q, qlen) != 0) break;
+        visited++;
+        if (fn(ctx, c.text, c.text_len, c.rows) != 0) break;
+    }
+    if ((uint32_t)visited < limit && rc < 0) return -1;
+    return visited;
+}
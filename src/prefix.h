@@ -0,0 +1,88 @@
+#ifndef PREFIX_H
+#define PREFIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "arena.h"
+
+/* prefix.h
+ *
+ * Sorted key index for autocompletion (<dir>/<name>_prefix.dat): every
+ * distinct normalized value of a column, in byte order, with the text of its
+ * first row and the number of rows that have it. Unlike the hash index the
+ * whole value is normalized (up to PREFIX_KEY_MAX characters), so any prefix
+ * of it can be completed.
+ *
+ * File layout:
+ * - header (PREFIX_HEADER_SIZE bytes):
+ *   magic "PFX1", version u16, reserved u16, num_keys u32,
+ *   block_keys u32, num_blocks u32, reserved u32,
+ *   table_off u64 (block table), data_off u64 (first block)
+ * - blocks of block_keys entries, front coded: the first entry of a block
+ *   shares nothing with the previous one, so a block is decoded on its own.
+ *   entry: shared varint (bytes in common with the previous key),
+ *          suffix_len varint, suffix bytes,
+ *          text_len varint, text bytes, rows varint
+ * - block table: u64 offset of every block
+ *
+ * A lookup binary searches the block table on the first key of each block,
+ * then decodes forward: O(log n + k) for k completions.
+ */
+
+#define PREFIX_MAGIC "PFX1"
+#define PREFIX_VERSION 1
+#define PREFIX_HEADER_SIZE 64
+#define PREFIX_BLOCK_KEYS 16
+#define PREFIX_KEY_MAX 64      // normalized characters kept per value
+#define PREFIX_TEXT_MAX 255    // bytes of text kept per value
+#define PREFIX_SUFFIX "_prefix.dat"
+
+typedef struct {
+    int fd;
+    const unsigned char *map;
+    size_t map_len;
+    uint32_t num_keys;
+    uint32_t num_blocks;
+    uint32_t block_keys;
+    const unsigned char *table;  // num_blocks u64 block offsets
+} prefix_index_t;
+
+/* write out_path from the field field_idx of every record of records_path.
+   returns 0 or -1 */
+int prefix_build(const char *records_path, int field_idx, const char *out_path);
+
+/* The same build fed one record at a time, so one scan of records.dat can
+   feed several files: prefix_builder_add (a records_field_cb) every record
+   in row order, then prefix_builder_write */
+typedef struct {
+    arena_t arena;
+    struct prefix_entry *entries;
+    size_t n;
+    size_t cap;
+} prefix_builder_t;
+
+void prefix_builder_init(prefix_builder_t *b);
+
+int prefix_builder_add(uint64_t row, const char *field, size_t len, void *b);
+
+/* sort the collected values and write out_path. returns 0 or -1 */
+int prefix_builder_write(prefix_builder_t *b, const char *out_path);
+
+void prefix_builder_free(prefix_builder_t *b);
+
+/* map a prefix file read-only. returns 0 or -1 */
+int prefix_open(prefix_index_t *p, const char *path);
+
+void prefix_close(prefix_index_t *p);
+
+/* called for every completion in key order: text of the first row with that
+   value (at most PREFIX_TEXT_MAX bytes) and how many rows have it. non-zero
+   stops the walk */
+typedef int (*prefix_visit_fn)(void *ctx, const char *text, size_t text_len, uint32_t rows);
+
+/* values whose normalized form starts with the normalized query, at most
+   limit of them. returns how many were visited, or -1 on a corrupt file */
+int prefix_complete(const prefix_index_t *p, const char *query, uint32_t limit,
+    prefix_visit_fn fn, void *ctx);
+
+#endif // PREFIX_H
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "proto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void proto_encode_header(unsigned char *out, uint16_t type, uint32_t count, uint32_t length) {
+    uint16_t magic = PROTO_MAGIC;
+    memcpy(out + 0, &magic, sizeof magic);
+    memcpy(out + 2, &type, sizeof type);
+    memcpy(out + 4, &count, sizeof count);
+    memcpy(out + 8, &length, sizeof length);
+}
+
+long proto_peek(const unsigned char *buf, size_t len, size_t max_size, proto_header_t *hdr) {
+    if (len < 2) return 0;
+    uint16_t magic;
+    memcpy(&magic, buf, sizeof magic);
+    if (magic != PROTO_MAGIC) return -1;
+    if (len < PROTO_HEADER_SIZE) return 0;
+    memcpy(&hdr->type, buf + 2, sizeof hdr->type);
+    memcpy(&hdr->count, buf + 4, sizeof hdr->count);
+    memcpy(&hdr->length, buf + 8, sizeof hdr->length);
+    size_t size = PROTO_HEADER_SIZE + (size_t)hdr->length;
+    if (size > max_size) return -1;
+    return len >= size ? (long)size : 0;
+}
+
+/* wait for room on the non-blocking fd read by pid; *waited_ms adds up the
+   slices without room. returns 0, -1 once the reader is gone or too slow */
+static int wait_writable(int fd, int pid, int *waited_ms) {
+    if (*waited_ms >= PROTO_WRITE_TIMEOUT_MS) return -1;
+    struct pollfd p = {.fd = fd, .events = POLLOUT};
+    int r = poll(&p, 1, SHMRING_POLL_MS);
+    if (r < 0 && errno != EINTR) return -1;
+    if (r == 0) *waited_ms += SHMRING_POLL_MS;
+    if (kill(pid, 0) != 0 && errno == ESRCH) return -1;
+    return 0;
+}
+
+int proto_writev_all(int fd, int pid, struct iovec *iov, int iovcnt) {
+    int waited_ms = 0, started = 0;
+    while (iovcnt > 0) {
+        int n = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && pid > 0 && wait_writable(fd, pid, &waited_ms) == 0) continue;
+            return started ? -2 : -1;
+        }
+        waited_ms = 0;
+        if (w > 0) started = 1;
+        /* skip what was written, the rest of a partial vector stays */
+        while (iovcnt > 0 && (size_t)w >= iov->iov_len) {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+    return 0;
+}
+
+int proto_send(proto_out_t *out, uint16_t type, const void *const *items, const uint32_t *lens, uint32_t n) {
+    size_t length = 0;
+    for (uint32_t i = 0; i < n; ++i) length += sizeof(uint32_t) + lens[i];
+    if (length > UINT32_MAX) return -1;
+
+    unsigned char header[PROTO_HEADER_SIZE];
+    proto_encode_header(header, type, n, (uint32_t)length);
+    struct iovec *iov = malloc((1 + 2 * (size_t)n) * sizeof *iov);
+    if (!iov) return -1;
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof header;
+    for (uint32_t i = 0; i < n; ++i) {
+        /* the length prefixes are sent straight from lens */
+        iov[1 + 2 * i].iov_base = (void *)&lens[i];
+        iov[1 + 2 * i].iov_len = sizeof(uint32_t);
+        iov[2 + 2 * i].iov_base = (void *)items[i];
+        iov[2 + 2 * i].iov_len = lens[i];
+    }
+    int rc = out->ring ? shmring_writev(out->ring, iov, 1 + 2 * (int)n)
+                       : proto_writev_all(out->fd, out->pid, iov, 1 + 2 * (int)n);
+    free(iov);
+    if (rc == -2) out->cut = 1;
+    return rc < 0 ? -1 : 0;
+}
+
+int proto_send_payload(proto_out_t *out, uint16_t type, uint32_t count,
+    const unsigned char *payload, size_t length)
+{
+    if (length > UINT32_MAX) return -1;
+    unsigned char header[PROTO_HEADER_SIZE];
+    proto_encode_header(header, type, count, (uint32_t)length);
+    struct iovec iov[2] = {
+        {header, sizeof header},
+        {(void *)payload, length},
+    };
+    int rc = out->ring ? shmring_writev(out->ring, iov, 2) : proto_writev_all(out->fd, out->pid, iov, 2);
+    if (rc == -2) out->cut = 1;
+    return rc < 0 ? -1 : 0;
+}
+
+int proto_send_error(proto_out_t *out, const char *msg) {
+    const void *items[1] = {msg};
+    uint32_t lens[1] = {(uint32_t)strlen(msg)};
+    return proto_send(out, PROTO_ERROR, items, lens, 1);
+}
+
+void proto_reader_init(proto_reader_t *r, int fd) {
+    r->fd = fd;
+    r->ring = NULL;
+    r->timeout_ms = 0;
+    r->start = 0;
+    r->end = 0;
+}
+
+void proto_reader_init_ring(proto_reader_t *r, shmring_t *ring) {
+    proto_reader_init(r, -1);
+    r->ring = ring;
+}
+
+/* one read from the source of r, retried on EINTR. returns the count, or
+   0 / -1 on EOF / error */
+static ssize_t reader_read(proto_reader_t *r, void *buf, size_t len) {
+    if (r->ring) return shmring_read(r->ring, buf, len, r->timeout_ms);
+    while (1) {
+        if (r->timeout_ms > 0) {
+            struct pollfd p = {.fd = r->fd, .events = POLLIN};
+            int ready = poll(&p, 1, r->timeout_ms);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready == 0) errno = ETIMEDOUT;
+            if (ready <= 0) return -1;
+        }
+        ssize_t n = read(r->fd, buf, len);
+        if (n >= 0 || errno != EINTR) return n;
+    }
+}
+
+/* read more bytes into the buffer. returns 0, or -1 on EOF or error */
+static int reader_fill(proto_reader_t *r) {
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    ssize_t n = reader_read(r, r->buf + r->end, sizeof(r->buf) - r->end);
+    if (n <= 0) return -1;
+    r->end += (size_t)n;
+    return 0;
+}
+
+int proto_read(proto_reader_t *r, proto_msg_t *msg) {
+    while (r->end - r->start < PROTO_HEADER_SIZE) {
+        if (reader_fill(r) != 0) return -1;
+    }
+    const unsigned char *h = r->buf + r->start;
+    uint16_t magic;
+    memcpy(&magic, h, sizeof magic);
+    if (magic != PROTO_MAGIC) {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(&msg->hdr.type, h + 2, sizeof msg->hdr.type);
+    memcpy(&msg->hdr.count, h + 4, sizeof msg->hdr.count);
+    memcpy(&msg->hdr.length, h + 8, sizeof msg->hdr.length);
+    r->start += PROTO_HEADER_SIZE;
+
+    size_t length = msg->hdr.length;
+    if (length > msg->cap) {
+        unsigned char *tmp = realloc(msg->payload, length);
+        if (!tmp) return -1;
+        msg->payload = tmp;
+        msg->cap = length;
+    }
+    /* buffered bytes first, the rest is read straight into the payload */
+    size_t have = r->end - r->start;
+    if (have > length) have = length;
+    if (have > 0) memcpy(msg->payload, r->buf + r->start, have);
+    r->start += have;
+    while (have < length) {
+        ssize_t n = reader_read(r, msg->payload + have, length - have);
+        if (n <= 0) return -1;
+        have += (size_t)n;
+    }
+    return 0;
+}
+
+void proto_msg_free(proto_msg_t *msg) {
+    if (!msg) return;
+    free(msg->payload);
+    msg->payload = NULL;
+    msg->cap = 0;
+}
+
+void proto_items_init(proto_items_t *it, const proto_msg_t *msg) {
+    it->p = msg->payload;
+    it->end = msg->payload + msg->hdr.length;
+}
+
+int proto_items_next(proto_items_t *it, const unsigned char **data, uint32_t *len) {
+    if (it->p == it->end) return 0;
+    if ((size_t)(it->end - it->p) < sizeof(uint32_t)) return -1;
+    memcpy(len, it->p, sizeof *len);
+    it->p += sizeof *len;
+    if ((size_t)(it->end - it->p) < *len) return -1;
+    *data = it->p;
+    it->p += *len;
+    return 1;
+}
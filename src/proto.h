@@ -0,0 +1,166 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include "shmring.h"
+
+/* proto.h
+ *
+ * Framed messages between ui_client and index_server. Every message is a
+ * fixed header followed by length bytes of payload; the payload is a list of
+ * count items, each one a uint32 byte length and the bytes. Nothing in the
+ * payload is escaped, so fields may hold any byte ('\n' and '|' included).
+ *
+ * Header (PROTO_HEADER_SIZE bytes, host byte order: both ends run on the
+ * same machine):
+ * - magic    : uint16  (PROTO_MAGIC)
+ * - type     : uint16  (PROTO_*)
+ * - count    : uint32  number of items in the payload
+ * - length   : uint32  payload bytes
+ *
+ * Messages:
+ * - PROTO_QUERY   client -> server, items: pid (4 bytes), title, author and
+ *                 optionally genres (comma separated; only books with all
+ *                 of them are answered, see genres.h) and a numeric filter
+ *                 ("rating >= 4.2 AND pages < 300", see numeric.h; genres
+ *                 may then be empty). With a filter title and author may
+ *                 both be empty: the first rows that pass it are answered.
+ *                 Must fit in PIPE_BUF bytes so it is written atomically to
+ *                 the request FIFO shared by every client. The answer goes
+ *                 to the client's response FIFO.
+ * - PROTO_QUERY_SHM same items; the answer goes to the client's shared
+ *                 memory ring (shmring.h) instead.
+ * - PROTO_RECORDS server -> client, one item per hit: the record as stored
+ *                 in records.dat (decode with record_decode).
+ * - PROTO_ERROR   server -> client, one item: the message.
+ * - PROTO_PREFIX  client -> server, items: pid (4 bytes), flags (uint32,
+ *                 PROTO_FLAG_*), column (uint32, FIELD_TITLE or
+ *                 FIELD_AUTHOR), prefix, limit (uint32). Same size rule as a
+ *                 query; answered with PROTO_COMPLETIONS.
+ * - PROTO_COMPLETIONS server -> client, one item per completion in sorted
+ *                 order: rows (uint32, rows with that value) followed by the
+ *                 text of the value.
+ * - PROTO_FUZZY   client -> server, items: pid (4 bytes), flags (uint32,
+ *                 PROTO_FLAG_*), title, author. Like a query, but each given
+ *                 field also matches keys a few typos away (trigram.h).
+ *                 Same size rule; answered with PROTO_RECORDS.
+ * - PROTO_TEXT    client -> server, items: pid (4 bytes), flags (uint32,
+ *                 PROTO_FLAG_*), words, limit (uint32). The limit rows whose
+ *                 descriptions best match the words (BM25, fulltext.h).
+ *                 Same size rule; answered with PROTO_RECORDS, best first.
+ */
+
+#define PROTO_MAGIC 0x5849  // "IX"
+#define PROTO_HEADER_SIZE 12
+#define PROTO_READ_BUF 65536
+
+enum {
+    PROTO_QUERY = 1,
+    PROTO_RECORDS = 2,
+    PROTO_ERROR = 3,
+    PROTO_QUERY_SHM = 4,
+    PROTO_PREFIX = 5,
+    PROTO_COMPLETIONS = 6,
+    PROTO_FUZZY = 7,
+    PROTO_TEXT = 8,
+};
+
+/* flags of the requests that carry them */
+#define PROTO_FLAG_SHM 0x1   // answer on the client's ring, not its FIFO
+
+/* a non-blocking fd (or a ring) that stays full this long is given up on */
+#define PROTO_WRITE_TIMEOUT_MS SHMRING_WRITE_TIMEOUT_MS
+/* a client waits this long for the next bytes of an answer */
+#define PROTO_READ_TIMEOUT_MS 10000
+
+/* Where messages are sent: the shared memory ring when ring is set,
+   otherwise the fd. With pid set the fd is non-blocking and read by that
+   process: a full pipe is waited for in SHMRING_POLL_MS slices while it is
+   alive, and the message dropped after PROTO_WRITE_TIMEOUT_MS without room.
+   cut is then set if part of it was already written: the stream of the fd
+   is out of sync and must not be written to again */
+typedef struct {
+    int fd;
+    shmring_t *ring;
+    int pid;
+    int cut;
+} proto_out_t;
+
+typedef struct {
+    uint16_t type;
+    uint32_t count;
+    uint32_t length;
+} proto_header_t;
+
+/* One received message; payload is reused across reads */
+typedef struct {
+    proto_header_t hdr;
+    unsigned char *payload;
+    size_t cap;
+} proto_msg_t;
+
+/* Walks the items of a payload */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} proto_items_t;
+
+/* Buffered reader of messages from a blocking fd, or from a ring; with
+   timeout_ms set a read that gets no byte for that long fails (ETIMEDOUT) */
+typedef struct {
+    int fd;
+    shmring_t *ring;
+    int timeout_ms;
+    unsigned char buf[PROTO_READ_BUF];
+    size_t start;
+    size_t end;
+} proto_reader_t;
+
+void proto_encode_header(unsigned char *out, uint16_t type, uint32_t count, uint32_t length);
+
+/* Parse the message at the start of buf (len bytes available).
+   returns the message size when it is complete, 0 when more bytes are
+   needed, -1 when buf does not start with a valid header or the message
+   would exceed max_size */
+long proto_peek(const unsigned char *buf, size_t len, size_t max_size, proto_header_t *hdr);
+
+/* writev every iovec, retrying partial writes (at most IOV_MAX per call);
+   pid as in proto_out_t, 0 for a blocking fd. returns 0, -1 if nothing was
+   written, -2 if it failed after the first byte */
+int proto_writev_all(int fd, int pid, struct iovec *iov, int iovcnt);
+
+/* Send a message whose items are the n buffers items[i] of lens[i] bytes:
+   header, length prefixes and items in a single writev when they fit in
+   IOV_MAX vectors, or copied once into the ring. returns 0 or -1 */
+int proto_send(proto_out_t *out, uint16_t type, const void *const *items, const uint32_t *lens, uint32_t n);
+
+/* Send a message whose payload (count items, already length-prefixed) is
+   stored contiguously, e.g. one kept from an earlier proto_send.
+   returns 0 or -1 */
+int proto_send_payload(proto_out_t *out, uint16_t type, uint32_t count,
+    const unsigned char *payload, size_t length);
+
+/* Send a PROTO_ERROR message */
+int proto_send_error(proto_out_t *out, const char *msg);
+
+void proto_reader_init(proto_reader_t *r, int fd);
+
+/* read messages from the consumer side of a ring */
+void proto_reader_init_ring(proto_reader_t *r, shmring_t *ring);
+
+/* read the next message into msg. returns 0, or -1 on EOF, read error,
+   timeout or malformed message (EPROTO); after an error mid message the
+   stream is out of sync and the source has to be reopened */
+int proto_read(proto_reader_t *r, proto_msg_t *msg);
+
+void proto_msg_free(proto_msg_t *msg);
+
+void proto_items_init(proto_items_t *it, const proto_msg_t *msg);
+
+/* next item of the payload. returns 1 with *data and *len set, 0 at the end,
+   -1 if the payload is truncated */
+int proto_items_next(proto_items_t *it, const unsigned char **data, uint32_t *len);
+
+#endif // PROTO_H
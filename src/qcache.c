@@ -0,0 +1,172 @@
+#include "qcache.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a over the whole key (cache keys are short) */
+static uint64_t key_hash(const char *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int qcache_init(qcache_t *c, size_t budget) {
+    memset(c, 0, sizeof *c);
+    /* about one slot per KiB of budget */
+    size_t slots = (size_t)next_pow2(budget / 1024 > 1024 ? budget / 1024 : 1024);
+    c->table = calloc(slots, sizeof *c->table);
+    if (!c->table) return -1;
+    c->table_mask = slots - 1;
+    c->budget = budget;
+    c->stats.budget = budget;
+    pthread_mutex_init(&c->lock, NULL);
+    return 0;
+}
+
+static void lru_unlink(qcache_t *c, qcache_entry_t *e) {
+    if (e->prev) e->prev->next = e->next; else c->lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else c->lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(qcache_t *c, qcache_entry_t *e) {
+    e->prev = NULL;
+    e->next = c->lru_head;
+    if (c->lru_head) c->lru_head->prev = e;
+    c->lru_head = e;
+    if (!c->lru_tail) c->lru_tail = e;
+}
+
+/* take e out of the table and the LRU list; freed now or by its last release */
+static void entry_remove(qcache_t *c, qcache_entry_t *e) {
+    qcache_entry_t **pp = &c->table[e->hash & c->table_mask];
+    while (*pp != e) pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    lru_unlink(c, e);
+    e->linked = 0;
+    c->bytes -= e->charge;
+    c->stats.entries--;
+    if (e->refs == 0) free(e);
+}
+
+void qcache_free(qcache_t *c) {
+    if (!c || !c->table) return;
+    while (c->lru_head) entry_remove(c, c->lru_head);
+    free(c->table);
+    c->table = NULL;
+    pthread_mutex_destroy(&c->lock);
+}
+
+/* '=' marks a field that was given: "!!" normalizes to nothing but is still
+   looked up, unlike an empty field */
+static size_t key_field(const char *s, char *out) {
+    if (!s || s[0] == '\0') return 0;
+    out[0] = '=';
+    return 1 + normalize_prefix(s, strlen(s), out + 1);
+}
+
+size_t qcache_make_key(const char *title, const char *author, char *out) {
+    size_t n = key_field(title, out);
+    out[n++] = '|';
+    n += key_field(author, out + n);
+    return n;
+}
+
+const qcache_entry_t *qcache_get(qcache_t *c, const char *key, size_t key_len) {
+    if (c->budget == 0) return NULL;
+    uint64_t h = key_hash(key, key_len);
+    pthread_mutex_lock(&c->lock);
+    qcache_entry_t *e = c->table[h & c->table_mask];
+    while (e && !(e->hash == h && e->key_len == key_len && memcmp(e->key, key, key_len) == 0)) e = e->hnext;
+    if (e) {
+        e->refs++;
+        lru_unlink(c, e);
+        lru_push_front(c, e);
+        c->stats.hits++;
+    } else {
+        c->stats.misses++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return e;
+}
+
+void qcache_release(qcache_t *c, const qcache_entry_t *ce) {
+    if (!ce) return;
+    qcache_entry_t *e = (qcache_entry_t *)ce;
+    pthread_mutex_lock(&c->lock);
+    if (--e->refs == 0 && !e->linked) free(e);
+    pthread_mutex_unlock(&c->lock);
+}
+
+uint64_t qcache_generation(qcache_t *c) {
+    pthread_mutex_lock(&c->lock);
+    uint64_t g = c->generation;
+    pthread_mutex_unlock(&c->lock);
+    return g;
+}
+
+int qcache_admits(const qcache_t *c, size_t length) {
+    return c->budget > 0 && length <= c->budget / 8;
+}
+
+int qcache_put(qcache_t *c, uint64_t generation, const char *key, size_t key_len,
+    uint32_t count, const unsigned char *payload, size_t length)
+{
+    if (!qcache_admits(c, length) || key_len > UINT32_MAX) return -1;
+    size_t charge = sizeof(qcache_entry_t) + key_len + length;
+    qcache_entry_t *e = malloc(charge);
+    if (!e) return -1;
+    e->hash = key_hash(key, key_len);
+    e->charge = charge;
+    e->refs = 0;
+    e->linked = 1;
+    e->key_len = (uint32_t)key_len;
+    e->count = count;
+    e->length = length;
+    memcpy(e->key, key, key_len);
+    e->payload = (const unsigned char *)e->key + key_len;
+    if (length > 0) memcpy((unsigned char *)e->key + key_len, payload, length);
+
+    pthread_mutex_lock(&c->lock);
+    if (generation != c->generation) {
+        pthread_mutex_unlock(&c->lock);
+        free(e);
+        return -1;
+    }
+    /* another worker may have answered the same query meanwhile */
+    qcache_entry_t *old = c->table[e->hash & c->table_mask];
+    while (old && !(old->hash == e->hash && old->key_len == key_len && memcmp(old->key, key, key_len) == 0)) {
+        old = old->hnext;
+    }
+    if (old) entry_remove(c, old);
+    while (c->lru_tail && c->bytes + charge > c->budget) {
+        entry_remove(c, c->lru_tail);
+        c->stats.evictions++;
+    }
+    qcache_entry_t **slot = &c->table[e->hash & c->table_mask];
+    e->hnext = *slot;
+    *slot = e;
+    lru_push_front(c, e);
+    c->bytes += charge;
+    c->stats.entries++;
+    c->stats.inserts++;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+void qcache_invalidate(qcache_t *c) {
+    pthread_mutex_lock(&c->lock);
+    while (c->lru_head) entry_remove(c, c->lru_head);
+    c->generation++;
+    pthread_mutex_unlock(&c->lock);
+}
+
+void qcache_get_stats(qcache_t *c, qcache_stats_t *out) {
+    pthread_mutex_lock(&c->lock);
+    *out = c->stats;
+    out->bytes = c->bytes;
+    pthread_mutex_unlock(&c->lock);
+}
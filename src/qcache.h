@@ -0,0 +1,93 @@
+#ifndef QCACHE_H
+#define QCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* qcache.h
+ *
+ * Result cache of index_server: normalized "title|author" -> the payload of
+ * the PROTO_RECORDS answer, ready to be sent again without touching the
+ * indices or records.dat. Shared by the workers behind one mutex.
+ *
+ * Entries are charged their key and payload bytes against a memory budget and
+ * evicted least recently used first. A hit holds a reference, so an entry
+ * evicted while it is being sent is only freed when released.
+ *
+ * qcache_invalidate drops everything and bumps the generation: a worker that
+ * looked up the old indices passes the generation it read before the lookup to
+ * qcache_put, and its stale result is not inserted.
+ */
+
+typedef struct qcache_entry {
+    struct qcache_entry *hnext;    // hash chain
+    struct qcache_entry *prev;     // LRU list, head = most recent
+    struct qcache_entry *next;
+    uint64_t hash;
+    size_t charge;
+    uint32_t refs;
+    int linked;                    // still in the table
+    uint32_t key_len;
+    uint32_t count;                // items in the payload
+    size_t length;                 // payload bytes
+    const unsigned char *payload;  // stored after the key
+    char key[];
+} qcache_entry_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t entries;
+    size_t bytes;
+    size_t budget;
+} qcache_stats_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    qcache_entry_t **table;
+    size_t table_mask;
+    qcache_entry_t *lru_head;
+    qcache_entry_t *lru_tail;
+    size_t bytes;
+    size_t budget;                 // 0: cache disabled
+    uint64_t generation;
+    qcache_stats_t stats;
+} qcache_t;
+
+/* cache of at most budget bytes (0 disables it). returns 0 or -1 */
+int qcache_init(qcache_t *c, size_t budget);
+
+void qcache_free(qcache_t *c);
+
+/* build the key of a query from the normalized title and author prefixes
+   (what the indices compare), into out (at least QCACHE_KEY_MAX bytes).
+   returns its length */
+#define QCACHE_KEY_MAX 64
+size_t qcache_make_key(const char *title, const char *author, char *out);
+
+/* entry for key with a reference held, or NULL (a miss) */
+const qcache_entry_t *qcache_get(qcache_t *c, const char *key, size_t key_len);
+
+void qcache_release(qcache_t *c, const qcache_entry_t *e);
+
+/* generation to pass to qcache_put, read before doing the lookup */
+uint64_t qcache_generation(qcache_t *c);
+
+/* 1 if a payload of length bytes would be kept (bigger ones are not worth
+   the copy: they would push out many smaller entries) */
+int qcache_admits(const qcache_t *c, size_t length);
+
+/* insert a copy of payload under key. returns 0, or -1 when not inserted
+   (disabled, too big, out of memory or generation outdated) */
+int qcache_put(qcache_t *c, uint64_t generation, const char *key, size_t key_len,
+    uint32_t count, const unsigned char *payload, size_t length);
+
+/* drop every entry (the indices changed) */
+void qcache_invalidate(qcache_t *c);
+
+void qcache_get_stats(qcache_t *c, qcache_stats_t *out);
+
+#endif // QCACHE_H
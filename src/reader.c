@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "reader.h"
 #include "buckets.h"
 #include "arrays.h"
@@ -8,87 +9,188 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 int index_open(index_handle_t *h, const char *buckets_path, const char *arrays_path) {
-    uint64_t num_buckets = 0, hash_seed = 0;
-    int bfd = buckets_open_readwrite(buckets_path, &num_buckets, &hash_seed);
+    buckets_header_t hdr;
+    int bfd = buckets_open_header(buckets_path, &hdr);
     if (bfd < 0) return -1;
     int afd = arrays_open(arrays_path);
     if (afd < 0) { close(bfd); return -1; }
     h->buckets_fd = bfd;
     h->arrays_fd = afd;
-    h->num_buckets = num_buckets;
-    h->hash_seed = hash_seed;
+    h->num_buckets = hdr.num_buckets;
+    h->hash_seed = hdr.hash_seed;
+    h->flags = hdr.flags;
+    h->entry_size = hdr.entry_size;
+    h->buckets_map = NULL;
+    h->buckets_map_len = 0;
+    h->arrays_map = NULL;
+    h->arrays_map_len = 0;
+    h->cache = NULL;
+    return 0;
+}
+
+/* map a whole file read-only, returns NULL on failure */
+static const unsigned char *map_fd(int fd, size_t *len_out) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) return NULL;
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return NULL;
+    *len_out = (size_t)st.st_size;
+    return (const unsigned char *)p;
+}
+
+int index_open_mmap(index_handle_t *h, const char *buckets_path, const char *arrays_path) {
+    if (index_open(h, buckets_path, arrays_path) != 0) return -1;
+
+    h->buckets_map = map_fd(h->buckets_fd, &h->buckets_map_len);
+    h->arrays_map = map_fd(h->arrays_fd, &h->arrays_map_len);
+    if (!h->buckets_map || !h->arrays_map ||
+        h->buckets_map_len < (size_t)buckets_entry_pos(h->num_buckets, h->entry_size)) {
+        index_close(h);
+        return -1;
+    }
+    /* chains are followed through next_ptr, readahead would only waste cache */
+    madvise((void *)h->arrays_map, h->arrays_map_len, MADV_RANDOM);
+    return 0;
+}
+
+int index_set_cache(index_handle_t *h, size_t bytes) {
+    if (h->cache) {
+        bcache_free(h->cache);
+        free(h->cache);
+        h->cache = NULL;
+    }
+    if (bytes == 0) return 0;
+    bcache_t *c = malloc(sizeof *c);
+    if (!c || bcache_init(c, bytes) != 0) {
+        free(c);
+        return -1;
+    }
+    h->cache = c;
     return 0;
 }
 
 void index_close(index_handle_t *h) {
     if (!h) return;
+    index_set_cache(h, 0);
+    if (h->buckets_map) munmap((void *)h->buckets_map, h->buckets_map_len);
+    if (h->arrays_map) munmap((void *)h->arrays_map, h->arrays_map_len);
+    h->buckets_map = h->arrays_map = NULL;
+    h->buckets_map_len = h->arrays_map_len = 0;
     if (h->buckets_fd >= 0) close(h->buckets_fd);
     if (h->arrays_fd >= 0) close(h->arrays_fd);
     h->buckets_fd = h->arrays_fd = -1;
     h->num_buckets = 0;
     h->hash_seed = 0;
+    h->flags = 0;
+    h->entry_size = 0;
 }
 
-int index_lookup(index_handle_t *h, const char *key, off_t **out_offsets, uint32_t *out_count) {
-    if (!h || !key || !out_offsets || !out_count) return -1;
-    *out_offsets = NULL;
-    *out_count = 0;
+int index_read_bucket(index_handle_t *h, uint64_t bucket, bucket_entry_t *entry) {
+    if (bucket >= h->num_buckets) return -1;
+    if (h->buckets_map) {
+        buckets_decode_entry(h->buckets_map + buckets_entry_pos(bucket, h->entry_size), h->entry_size, entry);
+        return 0;
+    }
+    if (h->cache) {
+        unsigned char buf[BUCKET_ENTRY_SIZE_EXT];
+        off_t pos = buckets_entry_pos(bucket, h->entry_size);
+        if (h->entry_size > sizeof buf ||
+            bcache_pread(h->cache, h->buckets_fd, buf, h->entry_size, pos) != (ssize_t)h->entry_size) {
+            return -1;
+        }
+        buckets_decode_entry(buf, h->entry_size, entry);
+        return 0;
+    }
+    buckets_header_t hdr = { 0, h->flags, h->num_buckets, h->hash_seed, h->entry_size };
+    return buckets_read_entry(h->buckets_fd, &hdr, bucket, entry);
+}
+
+void index_chain_open(index_handle_t *h, const bucket_entry_t *entry, arrays_cursor_t *cur) {
+    arrays_cursor_init(cur, h->arrays_fd, h->arrays_map, h->arrays_map_len, entry->head, h->flags);
+    arrays_cursor_set_cache(cur, h->cache);
+    if (!h->arrays_map && entry->extent_len > 0) {
+        /* on failure the cursor simply reads node by node */
+        arrays_cursor_load(cur, entry->head, entry->extent_len);
+    }
+}
+
+int index_lookup_each(index_handle_t *h, const char *key, index_visit_fn fn, void *ctx) {
+    if (!h || !key || !fn) return -1;
+
+    /* normalize the query once, node keys are normalized on the fly while comparing */
+    char qnorm[NORMALIZED_MAX_LEN + 1];
+    size_t qlen = normalize_prefix(key, strlen(key), qnorm);
 
-    uint64_t hval = hash_key_prefix(key, strlen(key), h->hash_seed);
+    uint64_t hval = hash_key_prefix(qnorm, qlen, h->hash_seed);
     uint64_t mask = h->num_buckets - 1;
     uint64_t bucket = bucket_id_from_hash(hval, mask);
-    off_t head = buckets_read_head(h->buckets_fd, h->num_buckets, bucket);
-    if (head == 0) return 0;
-
-    /* dynamic array for results */
-    uint32_t cap = 16;
-    uint32_t cnt = 0;
-    off_t *results = malloc(sizeof(off_t) * cap);
-    if (!results) return -1;
-
-    off_t cur = head;
-    while (cur != 0) {
-        arrays_node_t node = {0, NULL, 0, NULL, 0};
-        if (arrays_read_node_full(h->arrays_fd, cur, &node) != 0) {
-            break;
-        }
+    bucket_entry_t entry;
+    if (index_read_bucket(h, bucket, &entry) != 0 || entry.head == 0) return 0;
 
-        off_t next = node.next_ptr; /* save next before freeing node */
-
-        if (node.key) {
-            if (normalized_strcmp(node.key, key) == 0) {
-                for (uint32_t i = 0; i < node.list_len; ++i) {
-                    if (cnt >= cap) {
-                        uint32_t new_cap = cap * 2;
-                        off_t *tmp = realloc(results, sizeof(off_t) * new_cap);
-                        if (!tmp) {
-                            arrays_free_node(&node);
-                            free(results);
-                            return -1;
-                        }
-                        results = tmp;
-                        cap = new_cap;
-                    }
-                    results[cnt++] = node.offsets[i];
-                }
-            }
+    /* tagged layouts: a key whose tag is missing from the bucket filter is not
+       there, and nodes with another tag are skipped without touching their key */
+    int tagged = (h->flags & INDEX_FLAG_TAGGED) != 0;
+    uint32_t qtag = hash_tag(hval);
+    if (tagged && (entry.tag_filter & buckets_tag_bits(qtag)) != buckets_tag_bits(qtag)) return 0;
+
+    arrays_cursor_t cur;
+    arrays_node_view_t view;
+    int rc = 0;
+    index_chain_open(h, &entry, &cur);
+    if (tagged) arrays_cursor_match_tag(&cur, qtag);
+    while (rc == 0 && arrays_cursor_next(&cur, &view) == 1) {
+        if (normalized_strncmp(view.key, view.key_len, qnorm, qlen) != 0) continue;
+        /* offsets are decoded in small batches on the stack */
+        arrays_offset_iter_t it;
+        uint64_t batch[64];
+        int n;
+        arrays_offset_iter_init(&it, &view);
+        while (rc == 0 && (n = arrays_offset_iter_next(&it, batch, 64)) != 0) {
+            if (n < 0) { rc = -1; break; }
+            for (int i = 0; i < n && rc == 0; ++i) rc = fn(ctx, (off_t)batch[i]);
         }
+    }
+    arrays_cursor_release(&cur);
+    return rc < 0 ? -1 : 0;
+}
 
-        /* free node buffers */
-        arrays_free_node(&node);
-        cur = next;
+typedef struct {
+    off_t *results;
+    uint32_t cnt;
+    uint32_t cap;
+} lookup_results_t;
+
+/* append one offset to a growing result array */
+static int results_push(void *ctx, off_t off) {
+    lookup_results_t *r = ctx;
+    if (r->cnt >= r->cap) {
+        uint32_t new_cap = r->cap ? r->cap * 2 : 16;
+        off_t *tmp = realloc(r->results, sizeof(off_t) * new_cap);
+        if (!tmp) return -1;
+        r->results = tmp;
+        r->cap = new_cap;
     }
+    r->results[r->cnt++] = off;
+    return 0;
+}
 
-    if (cnt == 0) {
-        free(results);
-        *out_offsets = NULL;
-        *out_count = 0;
-    } else {
-        *out_offsets = results;
-        *out_count = cnt;
+int index_lookup(index_handle_t *h, const char *key, off_t **out_offsets, uint32_t *out_count) {
+    if (!h || !key || !out_offsets || !out_count) return -1;
+    *out_offsets = NULL;
+    *out_count = 0;
+
+    /* dynamic array for results, allocated on the first hit */
+    lookup_results_t r = {NULL, 0, 0};
+    if (index_lookup_each(h, key, results_push, &r) != 0) {
+        free(r.results);
+        return -1;
     }
+    *out_offsets = r.results;
+    *out_count = r.cnt;
     return 0;
 }
 
@@ -2,20 +2,56 @@
 #define READER_H
 
 #include "common.h"
+#include "buckets.h"
+#include "arrays.h"
+#include "bcache.h"
 
 typedef struct {
     int buckets_fd;
     int arrays_fd;
     uint64_t num_buckets;
     uint64_t hash_seed;
+    uint16_t flags;        // INDEX_FLAG_* of the buckets header
+    uint32_t entry_size;
+    /* read-only mappings, NULL unless opened with index_open_mmap */
+    const unsigned char *buckets_map;
+    size_t buckets_map_len;
+    const unsigned char *arrays_map;
+    size_t arrays_map_len;
+    /* block cache of the pread mode, NULL unless set with index_set_cache */
+    bcache_t *cache;
 } index_handle_t;
 
 /* Open an index given paths to buckets and arrays files */
 int index_open(index_handle_t *h, const char *buckets_path, const char *arrays_path);
 
+/* Open an index and mmap both files read-only: lookups walk the chains directly
+   over the mapping (no pread per node, page cache shared between processes). */
+int index_open_mmap(index_handle_t *h, const char *buckets_path, const char *arrays_path);
+
+/* pread mode: serve bucket and node reads from a block cache of about bytes
+   (0 drops it), shared by every thread using the handle. returns 0 or -1 */
+int index_set_cache(index_handle_t *h, size_t bytes);
+
 /* Close index */
 void index_close(index_handle_t *h);
 
+/* Read the entry of a bucket (from the mapping or with one pread) */
+int index_read_bucket(index_handle_t *h, uint64_t bucket, bucket_entry_t *entry);
+
+/* Start a cursor on the chain of a bucket entry: over the mapping when the
+   index is mapped, otherwise with one pread per ARRAYS_VIEW_WINDOW of the
+   extent of a clustered bucket, or one pread per node. Release it with arrays_cursor_release. */
+void index_chain_open(index_handle_t *h, const bucket_entry_t *entry, arrays_cursor_t *cur);
+
+/* Called for each offset found by index_lookup_each; a non-zero return stops
+   the walk (negative values are reported as an error) */
+typedef int (*index_visit_fn)(void *ctx, off_t offset);
+
+/* Lookup key without building a result array: no heap allocation at all in
+   mmap mode, nor in pread mode unless a node exceeds ARRAYS_VIEW_WINDOW. */
+int index_lookup_each(index_handle_t *h, const char *key, index_visit_fn fn, void *ctx);
+
 /* Lookup key: returns array of offsets (malloc'd) and count via out_count. Caller frees *out_offsets. */
 int index_lookup(index_handle_t *h, const char *key, off_t **out_offsets, uint32_t *out_count);
 
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include "records.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* make room for need more bytes in the chunk buffer */
+static int chunk_reserve(records_chunk_t *c, size_t need) {
+    if (c->len + need <= c->cap) return 0;
+    size_t cap = c->cap ? c->cap : (1u << 20);
+    while (cap < c->len + need) cap *= 2;
+    unsigned char *tmp = realloc(c->buf, cap);
+    if (!tmp) return -1;
+    c->buf = tmp;
+    c->cap = cap;
+    return 0;
+}
+
+int records_chunk_add(records_chunk_t *c, const csv_span_t *spans, int nfields) {
+    if (c->rows >= c->rows_cap) {
+        size_t cap = c->rows_cap ? c->rows_cap * 2 : 4096;
+        uint64_t *tmp = realloc(c->starts, cap * sizeof(uint64_t));
+        if (!tmp) return -1;
+        c->starts = tmp;
+        c->rows_cap = cap;
+    }
+
+    /* unescaping never makes a field longer than its span */
+    size_t head = NUM_DATASET_FIELDS * sizeof(uint32_t);
+    size_t need = head;
+    for (int i = 0; i < nfields && i < NUM_DATASET_FIELDS; ++i) need += spans[i].len + 1;
+    need += NUM_DATASET_FIELDS; /* NULs of missing fields */
+    if (chunk_reserve(c, need) != 0) return -1;
+
+    unsigned char *rec = c->buf + c->len;
+    unsigned char *data = rec + head;
+    uint32_t pos = 0;
+    for (int i = 0; i < NUM_DATASET_FIELDS; ++i) {
+        memcpy(rec + (size_t)i * sizeof(uint32_t), &pos, sizeof pos);
+        if (i < nfields) {
+            const csv_span_t *sp = &spans[i];
+            for (size_t k = 0; k < sp->len; ++k) {
+                data[pos++] = (unsigned char)sp->start[k];
+                if (sp->quoted && sp->start[k] == '"') k++; /* "" -> " */
+            }
+        }
+        data[pos++] = '\0';
+    }
+    c->starts[c->rows++] = c->len;
+    c->len += head + pos;
+    return 0;
+}
+
+void records_chunk_free(records_chunk_t *c) {
+    if (!c) return;
+    free(c->buf);
+    free(c->starts);
+    memset(c, 0, sizeof *c);
+}
+
+int records_write(const char *path, const records_chunk_t *chunks, size_t num_chunks) {
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("open records");
+        return -1;
+    }
+
+    uint64_t num_rows = 0;
+    for (size_t i = 0; i < num_chunks; ++i) num_rows += chunks[i].rows;
+    uint64_t *table = malloc((size_t)(num_rows + 1) * sizeof(uint64_t));
+    if (!table) { close(fd); return -1; }
+
+    int rc = 0;
+    uint64_t pos = RECORDS_HEADER_SIZE;
+    uint64_t row = 0;
+    for (size_t i = 0; i < num_chunks && rc == 0; ++i) {
+        const records_chunk_t *c = &chunks[i];
+        if (c->len > 0 && safe_pwrite(fd, c->buf, c->len, (off_t)pos) != (ssize_t)c->len) rc = -1;
+        for (size_t r = 0; r < c->rows; ++r) table[row++] = pos + c->starts[r];
+        pos += c->len;
+    }
+    table[num_rows] = pos;
+
+    size_t table_len = (size_t)(num_rows + 1) * sizeof(uint64_t);
+    if (rc == 0 && safe_pwrite(fd, table, table_len, (off_t)pos) != (ssize_t)table_len) rc = -1;
+    free(table);
+
+    unsigned char header[RECORDS_HEADER_SIZE];
+    memset(header, 0, sizeof header);
+    memcpy(header + 0, RECORDS_MAGIC, 4);
+    uint16_t version = RECORDS_VERSION;
+    uint32_t num_fields = NUM_DATASET_FIELDS;
+    memcpy(header + 4, &version, sizeof version);
+    memcpy(header + 8, &num_fields, sizeof num_fields);
+    memcpy(header + 12, &num_rows, sizeof num_rows);
+    memcpy(header + 20, &pos, sizeof pos);
+    if (rc == 0 && safe_pwrite(fd, header, sizeof header, 0) != (ssize_t)sizeof header) rc = -1;
+
+    fsync(fd);
+    close(fd);
+    return rc;
+}
+
+int records_open(records_t *r, const char *path) {
+    memset(r, 0, sizeof *r);
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) return -1;
+
+    unsigned char header[RECORDS_HEADER_SIZE];
+    uint16_t version;
+    uint64_t table_off;
+    if (safe_pread(r->fd, header, sizeof header, 0) != (ssize_t)sizeof header ||
+        memcmp(header, RECORDS_MAGIC, 4) != 0) {
+        records_close(r);
+        return -1;
+    }
+    memcpy(&version, header + 4, sizeof version);
+    memcpy(&r->num_fields, header + 8, sizeof r->num_fields);
+    memcpy(&r->num_rows, header + 12, sizeof r->num_rows);
+    memcpy(&table_off, header + 20, sizeof table_off);
+    if (version != RECORDS_VERSION || r->num_fields != NUM_DATASET_FIELDS) {
+        records_close(r);
+        return -1;
+    }
+
+    /* the row table must lie within the file: a mapping past its end would
+       fault on first access */
+    struct stat st;
+    uint64_t size = 0;
+    if (fstat(r->fd, &st) == 0 && st.st_size > 0) size = (uint64_t)st.st_size;
+    if (table_off < RECORDS_HEADER_SIZE || table_off > size ||
+        r->num_rows >= (size - table_off) / sizeof(uint64_t)) {
+        records_close(r);
+        return -1;
+    }
+
+    /* map the row table (mmap needs a page aligned start) */
+    off_t page = (off_t)sysconf(_SC_PAGESIZE);
+    off_t map_off = (off_t)table_off & ~(page - 1);
+    size_t lead = (size_t)((off_t)table_off - map_off);
+    r->table_map_len = lead + (size_t)(r->num_rows + 1) * sizeof(uint64_t);
+    void *map = mmap(NULL, r->table_map_len, PROT_READ, MAP_SHARED, r->fd, map_off);
+    if (map == MAP_FAILED) {
+        records_close(r);
+        return -1;
+    }
+    r->table_map = map;
+    r->table = (const uint64_t *)((const unsigned char *)map + lead);
+    return 0;
+}
+
+void records_close(records_t *r) {
+    if (!r) return;
+    if (r->table_map) munmap(r->table_map, r->table_map_len);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof *r);
+    r->fd = -1;
+}
+
+int record_decode(record_t *rec, const unsigned char *p, size_t len, uint32_t num_fields) {
+    /* fields are stored in order, each one NUL-terminated */
+    size_t head = (size_t)num_fields * sizeof(uint32_t);
+    if (len < head) return -1;
+    const char *data = (const char *)p + head;
+    size_t data_len = len - head;
+    if (data_len == 0 || data[data_len - 1] != '\0') return -1;
+    rec->num_fields = num_fields;
+    for (uint32_t i = 0; i < num_fields; ++i) {
+        uint32_t start, next;
+        memcpy(&start, p + (size_t)i * sizeof(uint32_t), sizeof start);
+        if (i + 1 < num_fields) {
+            memcpy(&next, p + (size_t)(i + 1) * sizeof(uint32_t), sizeof next);
+        } else {
+            next = (uint32_t)data_len;
+        }
+        if (start >= next || next > data_len) return -1;
+        rec->field[i] = data + start;
+        rec->len[i] = next - start - 1;
+    }
+    return 0;
+}
+
+int records_fetch(records_t *r, uint64_t row, record_t *rec) {
+    if (!r || !rec || row >= r->num_rows) return -1;
+    uint64_t off = r->table[row];
+    uint64_t end = r->table[row + 1];
+    size_t head = (size_t)r->num_fields * sizeof(uint32_t);
+    if (end < off + head) return -1;
+    size_t len = (size_t)(end - off);
+
+    if (len > rec->cap) {
+        unsigned char *tmp = realloc(rec->buf, len);
+        if (!tmp) return -1;
+        rec->buf = tmp;
+        rec->cap = len;
+    }
+    if (safe_pread(r->fd, rec->buf, len, (off_t)off) != (ssize_t)len) return -1;
+    return record_decode(rec, rec->buf, len, r->num_fields);
+}
+
+static int batch_item_cmp(const void *a, const void *b) {
+    const records_batch_item_t *x = a, *y = b;
+    if (x->row != y->row) return x->row < y->row ? -1 : 1;
+    return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+static int batch_reserve(records_batch_t *b, size_t n) {
+    if (n > b->n_cap) {
+        size_t *pos = realloc(b->pos, n * sizeof *pos);
+        if (!pos) return -1;
+        b->pos = pos;
+        size_t *len = realloc(b->len, n * sizeof *len);
+        if (!len) return -1;
+        b->len = len;
+        records_batch_item_t *items = realloc(b->items, n * sizeof *items);
+        if (!items) return -1;
+        b->items = items;
+        b->n_cap = n;
+    }
+    if (!b->gap) {
+        b->gap = malloc(RECORDS_COALESCE_GAP);
+        if (!b->gap) return -1;
+    }
+    return 0;
+}
+
+/* one read of a run of merged records: iov alternates records and gaps.
+   A failed or short preadv falls back to one pread per record */
+static int batch_read_run(records_t *r, records_batch_t *b, struct iovec *iov, int iovcnt,
+    const uint64_t *iov_off, uint64_t start, size_t run_len)
+{
+    b->ios++;
+    ssize_t got = preadv(r->fd, iov, iovcnt, (off_t)start);
+    if (got == (ssize_t)run_len) return 0;
+    for (int k = 0; k < iovcnt; ++k) {
+        if (iov[k].iov_base == b->gap) continue;
+        b->ios++;
+        if (safe_pread(r->fd, iov[k].iov_base, iov[k].iov_len, (off_t)iov_off[k]) != (ssize_t)iov[k].iov_len) return -1;
+    }
+    return 0;
+}
+
+int records_fetch_batch(records_t *r, const uint64_t *rows, size_t n, records_batch_t *b) {
+    if (!r || !b || (n > 0 && !rows)) return -1;
+    b->n = 0;
+    b->ios = 0;
+    b->num_fields = r->num_fields;
+    if (n == 0) return 0;
+    if (batch_reserve(b, n) != 0) return -1;
+
+    /* file order; a row asked for twice is read once */
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (rows[i] >= r->num_rows) return -1;
+        b->items[i].row = rows[i];
+        b->items[i].idx = i;
+    }
+    qsort(b->items, n, sizeof *b->items, batch_item_cmp);
+    for (size_t i = 0; i < n; ++i) {
+        if (i > 0 && b->items[i].row == b->items[i - 1].row) continue;
+        uint64_t row = b->items[i].row;
+        if (r->table[row + 1] < r->table[row]) return -1;
+        total += (size_t)(r->table[row + 1] - r->table[row]);
+    }
+    if (total > b->cap) {
+        unsigned char *tmp = realloc(b->buf, total);
+        if (!tmp) return -1;
+        b->buf = tmp;
+        b->cap = total;
+    }
+
+    struct iovec iov[IOV_MAX];
+    uint64_t iov_off[IOV_MAX];
+    int iovcnt = 0;
+    uint64_t run_start = 0, run_end = 0;
+    size_t fill = 0;
+    for (size_t i = 0; i < n; ++i) {
+        records_batch_item_t *it = &b->items[i];
+        if (i > 0 && it->row == b->items[i - 1].row) {
+            size_t prev = b->items[i - 1].idx;
+            b->pos[it->idx] = b->pos[prev];
+            b->len[it->idx] = b->len[prev];
+            continue;
+        }
+        uint64_t off = r->table[it->row];
+        size_t len = (size_t)(r->table[it->row + 1] - off);
+        uint64_t gap = off - run_end;
+        int merge = iovcnt > 0 && gap <= RECORDS_COALESCE_GAP &&
+                    off + len - run_start <= RECORDS_MAX_IO && iovcnt + 2 <= IOV_MAX;
+        if (iovcnt > 0 && !merge) {
+            if (batch_read_run(r, b, iov, iovcnt, iov_off, run_start, (size_t)(run_end - run_start)) != 0) return -1;
+            iovcnt = 0;
+        }
+        if (iovcnt == 0) {
+            run_start = off;
+        } else if (gap > 0) {
+            iov[iovcnt].iov_base = b->gap;
+            iov[iovcnt].iov_len = (size_t)gap;
+            iov_off[iovcnt++] = run_end;
+        }
+        iov[iovcnt].iov_base = b->buf + fill;
+        iov[iovcnt].iov_len = len;
+        iov_off[iovcnt++] = off;
+        run_end = off + len;
+        b->pos[it->idx] = fill;
+        b->len[it->idx] = len;
+        fill += len;
+    }
+    if (iovcnt > 0 && batch_read_run(r, b, iov, iovcnt, iov_off, run_start, (size_t)(run_end - run_start)) != 0) return -1;
+    b->n = n;
+    return 0;
+}
+
+int records_batch_record(const records_batch_t *b, size_t i, record_t *rec) {
+    if (!b || !rec || i >= b->n) return -1;
+    return record_decode(rec, b->buf + b->pos[i], b->len[i], b->num_fields);
+}
+
+void records_batch_free(records_batch_t *b) {
+    if (!b) return;
+    free(b->buf);
+    free(b->pos);
+    free(b->len);
+    free(b->items);
+    free(b->gap);
+    memset(b, 0, sizeof *b);
+}
+
+void record_free(record_t *rec) {
+    if (!rec) return;
+    free(rec->buf);
+    rec->buf = NULL;
+    rec->cap = 0;
+    rec->num_fields = 0;
+}
+
+int records_for_each(records_t *r, records_row_cb cb, void *ctx) {
+    if (!r || !cb) return -1;
+    records_batch_t batch = {0};
+    record_t rec = {0};
+    uint64_t *rows = malloc(RECORDS_SCAN_BATCH * sizeof(uint64_t));
+    int rc = rows ? 0 : -1;
+    for (uint64_t start = 0; rc == 0 && start < r->num_rows; start += RECORDS_SCAN_BATCH) {
+        size_t count = r->num_rows - start < RECORDS_SCAN_BATCH ? (size_t)(r->num_rows - start) : RECORDS_SCAN_BATCH;
+        for (size_t i = 0; i < count; ++i) rows[i] = start + i;
+        if (records_fetch_batch(r, rows, count, &batch) != 0) { rc = -1; break; }
+        for (size_t i = 0; rc == 0 && i < count; ++i) {
+            if (records_batch_record(&batch, i, &rec) != 0) continue;
+            rc = cb(start + i, &rec, ctx);
+        }
+    }
+    records_batch_free(&batch);
+    record_free(&rec);
+    free(rows);
+    return rc;
+}
+
+typedef struct {
+    int field_idx;
+    records_field_cb cb;
+    void *ctx;
+} field_scan_t;
+
+static int field_scan_row(uint64_t row, const record_t *rec, void *ctx) {
+    const field_scan_t *f = ctx;
+    if ((uint32_t)f->field_idx >= rec->num_fields) return 0;
+    return f->cb(row, rec->field[f->field_idx], rec->len[f->field_idx], f->ctx);
+}
+
+int records_for_each_field(records_t *r, int field_idx, records_field_cb cb, void *ctx) {
+    if (!cb || field_idx < 0) return -1;
+    field_scan_t f = { field_idx, cb, ctx };
+    return records_for_each(r, field_scan_row, &f);
+}
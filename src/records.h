@@ -0,0 +1,145 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+#include "csv_scan.h"
+
+/* records.h
+ *
+ * records.dat: the CSV rows, already split and unescaped, so a record can be
+ * fetched with one pread of a known length and its fields used as they are.
+ * Written by the grouped builders next to the indices, whose postings are
+ * then row numbers into this file (INDEX_FLAG_ROWIDS).
+ *
+ * File layout:
+ * - header (RECORDS_HEADER_SIZE bytes)
+ *   - magic       : 4 bytes  ("REC1")
+ *   - version     : uint16
+ *   - reserved    : uint16
+ *   - num_fields  : uint32
+ *   - num_rows    : uint64
+ *   - table_off   : uint64   // absolute offset of the row table
+ * - records, back to back from RECORDS_HEADER_SIZE. Each one is
+ *   - starts[]    : uint32 * num_fields -> start of every field in data
+ *   - data        : the fields, each followed by a NUL byte
+ * - row table     : uint64 * (num_rows + 1) -> absolute offset of every
+ *                   record, the last entry being the end of the last record
+ */
+
+#define RECORDS_MAGIC "REC1"
+#define RECORDS_VERSION 1
+#define RECORDS_HEADER_SIZE 4096
+#define RECORDS_FILE "records.dat"
+
+/* Records of one build chunk, serialized in memory (offsets relative to buf) */
+typedef struct {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    uint64_t *starts;    // start of every record in buf
+    size_t rows;
+    size_t rows_cap;
+} records_chunk_t;
+
+/* Open store */
+typedef struct {
+    int fd;
+    uint32_t num_fields;
+    uint64_t num_rows;
+    const uint64_t *table;   // num_rows + 1 entries, mapped
+    void *table_map;
+    size_t table_map_len;
+} records_t;
+
+/* One fetched record: field[i] is NUL-terminated, len[i] its length */
+typedef struct {
+    uint32_t num_fields;
+    const char *field[NUM_DATASET_FIELDS];
+    uint32_t len[NUM_DATASET_FIELDS];
+    unsigned char *buf;
+    size_t cap;
+} record_t;
+
+/* append one row (nfields spans, missing fields are stored empty) */
+int records_chunk_add(records_chunk_t *c, const csv_span_t *spans, int nfields);
+
+void records_chunk_free(records_chunk_t *c);
+
+/* write <path> from the chunks, in order (row ids follow the same order) */
+int records_write(const char *path, const records_chunk_t *chunks, size_t num_chunks);
+
+/* open a records file, returns 0 or -1 */
+int records_open(records_t *r, const char *path);
+
+void records_close(records_t *r);
+
+/* read record row into rec with a single pread (rec->buf is reused across
+   calls, zero-initialize rec before the first one). returns 0 or -1 */
+int records_fetch(records_t *r, uint64_t row, record_t *rec);
+
+void record_free(record_t *rec);
+
+/* point the fields of rec into an encoded record (as stored in records.dat,
+   len bytes at p). rec->buf is not used. returns 0 or -1 */
+int record_decode(record_t *rec, const unsigned char *p, size_t len, uint32_t num_fields);
+
+/* Batched fetch: the rows of a query are read in file order, neighbouring
+   records (no more than RECORDS_COALESCE_GAP bytes apart) are merged into one
+   preadv of at most RECORDS_MAX_IO bytes, which scatters each record into the
+   batch buffer and the gaps between them into a scratch buffer. A query thus
+   costs a few large reads instead of one per result. The gap is one page:
+   bytes skipped inside a page are read from disk anyway, while longer gaps
+   cost more copying than the syscalls they save once the file is cached. */
+#define RECORDS_COALESCE_GAP (4u << 10)
+#define RECORDS_MAX_IO (1u << 20)
+
+typedef struct {
+    uint64_t row;
+    size_t idx;              // position in the request
+} records_batch_item_t;
+
+typedef struct {
+    unsigned char *buf;      // fetched records, packed in file order
+    size_t cap;
+    size_t *pos;             // start in buf of the record of request i
+    size_t *len;             // and its length
+    records_batch_item_t *items; // scratch: the request sorted by row
+    size_t n;
+    size_t n_cap;
+    unsigned char *gap;      // sink for the bytes between merged records
+    uint32_t num_fields;
+    uint64_t ios;            // reads issued by the last fetch
+} records_batch_t;
+
+/* fetch rows[0..n) into b (zero-initialize b before the first call, it is
+   reused across calls). returns 0 or -1 */
+int records_fetch_batch(records_t *r, const uint64_t *rows, size_t n, records_batch_t *b);
+
+/* point rec at the fields of request i of the last batch fetch (rec->buf is
+   not used, the fields live in b->buf). returns 0 or -1 */
+int records_batch_record(const records_batch_t *b, size_t i, record_t *rec);
+
+void records_batch_free(records_batch_t *b);
+
+/* rows fetched at a time by records_for_each */
+#define RECORDS_SCAN_BATCH 4096
+
+/* called with every record (its fields point into the batch buffer and are
+   only valid during the call), returns 0 to go on or -1 to stop the scan */
+typedef int (*records_row_cb)(uint64_t row, const record_t *rec, void *ctx);
+
+/* call cb on every record in row order, fetching the rows
+   RECORDS_SCAN_BATCH at a time. returns 0, or -1 when a fetch fails or cb
+   stops the scan */
+int records_for_each(records_t *r, records_row_cb cb, void *ctx);
+
+/* called with field field_idx of row (NUL-terminated, len bytes), returns 0
+   to go on or -1 to stop the scan */
+typedef int (*records_field_cb)(uint64_t row, const char *field, size_t len, void *ctx);
+
+/* records_for_each on a single field (records without it are skipped) */
+int records_for_each_field(records_t *r, int field_idx, records_field_cb cb, void *ctx);
+
+#endif // RECORDS_H
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include "shmring.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* the segment is shared between processes: no FUTEX_PRIVATE_FLAG */
+static void futex_wait(_Atomic uint32_t *word, uint32_t expected, int timeout_ms) {
+    struct timespec ts = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, expected, &ts, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static int peer_alive(int32_t pid) {
+    return pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static int map_segment(shmring_t *r, int fd, size_t len) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+    r->sh = p;
+    r->map_len = len;
+    return 0;
+}
+
+int shmring_create(shmring_t *r, const char *name, uint32_t size) {
+    memset(r, 0, sizeof *r);
+    uint32_t cap = 4096;
+    while (cap < size) cap <<= 1;
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    shm_unlink(name); /* left over by a dead client with the same pid */
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return -1;
+    size_t len = sizeof(shmring_shared_t) + cap;
+    if (ftruncate(fd, (off_t)len) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    if (map_segment(r, fd, len) != 0) {
+        shm_unlink(name);
+        return -1;
+    }
+    /* ftruncate zero-filled the counters; the server only maps the segment
+       after our first request, so plain stores are enough here */
+    r->sh->size = cap;
+    r->sh->client_pid = (int32_t)getpid();
+    r->sh->magic = SHMRING_MAGIC;
+    r->owner = 1;
+    return 0;
+}
+
+int shmring_open(shmring_t *r, const char *name) {
+    memset(r, 0, sizeof *r);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(shmring_shared_t)) {
+        close(fd);
+        return -1;
+    }
+    if (map_segment(r, fd, (size_t)st.st_size) != 0) return -1;
+    uint32_t size = r->sh->size;
+    if (r->sh->magic != SHMRING_MAGIC || size == 0 || (size & (size - 1)) != 0 ||
+        sizeof(shmring_shared_t) + size > r->map_len) {
+        shmring_close(r);
+        return -1;
+    }
+    atomic_store(&r->sh->server_pid, (int32_t)getpid());
+    return 0;
+}
+
+void shmring_close(shmring_t *r) {
+    if (!r || !r->sh) return;
+    munmap(r->sh, r->map_len);
+    if (r->owner) shm_unlink(r->name);
+    r->sh = NULL;
+}
+
+int shmring_begin_write(shmring_t *r) {
+    uint32_t expected = 0;
+    int waited_ms = 0;
+    while (!atomic_compare_exchange_strong(&r->sh->writer_busy, &expected, 1)) {
+        /* the answer to a previous query is still being finished */
+        if (waited_ms >= SHMRING_WRITE_TIMEOUT_MS) return -1;
+        futex_wait(&r->sh->writer_busy, expected, SHMRING_POLL_MS);
+        waited_ms += SHMRING_POLL_MS;
+        if (!peer_alive(r->sh->client_pid)) return -1;
+        expected = 0;
+    }
+    if (atomic_load(&r->sh->aborted)) {
+        shmring_end_write(r);
+        return -1;
+    }
+    return 0;
+}
+
+void shmring_end_write(shmring_t *r) {
+    atomic_store(&r->sh->writer_busy, 0);
+    futex_wake(&r->sh->writer_busy);
+}
+
+/* make the bytes up to head visible and wake the consumer if it sleeps */
+static void publish(shmring_shared_t *sh, uint64_t head) {
+    atomic_store(&sh->head, head);
+    atomic_fetch_add(&sh->data_seq, 1);
+    if (atomic_load(&sh->consumer_waiting)) futex_wake(&sh->data_seq);
+}
+
+int shmring_writev(shmring_t *r, const struct iovec *iov, int iovcnt) {
+    shmring_shared_t *sh = r->sh;
+    uint64_t size = sh->size;
+    uint64_t head = atomic_load_explicit(&sh->head, memory_order_relaxed);
+    uint64_t start = head;
+    int waited_ms = 0;
+    for (int k = 0; k < iovcnt; ++k) {
+        const unsigned char *src = iov[k].iov_base;
+        size_t left = iov[k].iov_len;
+        while (left > 0) {
+            uint64_t tail = atomic_load(&sh->tail);
+            uint64_t room = size - (head - tail);
+            if (room == 0) {
+                /* full: show what we have, then sleep until the consumer reads */
+                publish(sh, head);
+                uint32_t seq = atomic_load(&sh->space_seq);
+                atomic_store(&sh->producer_waiting, 1);
+                if (atomic_load(&sh->tail) == tail) {
+                    futex_wait(&sh->space_seq, seq, SHMRING_POLL_MS);
+                }
+                atomic_store(&sh->producer_waiting, 0);
+                if (atomic_load(&sh->tail) != tail) {
+                    waited_ms = 0;
+                    continue;
+                }
+                waited_ms += SHMRING_POLL_MS;
+                if (peer_alive(sh->client_pid) && waited_ms < SHMRING_WRITE_TIMEOUT_MS) continue;
+                if (head == start) return -1;
+                /* half a message is in the ring: tell the consumer */
+                atomic_store(&sh->aborted, 1);
+                publish(sh, head);
+                return -2;
+            }
+            size_t n = left < room ? left : (size_t)room;
+            size_t at = (size_t)(head & (size - 1));
+            size_t first = n < size - at ? n : (size_t)(size - at);
+            memcpy(sh->data + at, src, first);
+            memcpy(sh->data, src + first, n - first);
+            head += n;
+            src += n;
+            left -= n;
+        }
+    }
+    publish(sh, head);
+    return 0;
+}
+
+ssize_t shmring_read(shmring_t *r, void *buf, size_t len, int timeout_ms) {
+    shmring_shared_t *sh = r->sh;
+    uint64_t size = sh->size;
+    uint64_t tail = atomic_load_explicit(&sh->tail, memory_order_relaxed);
+    uint64_t head;
+    int waited_ms = 0;
+    while (1) {
+        if (atomic_load(&sh->aborted)) {
+            errno = EPIPE;
+            return -1;
+        }
+        if ((head = atomic_load(&sh->head)) != tail) break;
+        if (timeout_ms > 0 && waited_ms >= timeout_ms) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        uint32_t seq = atomic_load(&sh->data_seq);
+        atomic_store(&sh->consumer_waiting, 1);
+        if (atomic_load(&sh->head) == tail) {
+            futex_wait(&sh->data_seq, seq, SHMRING_POLL_MS);
+        }
+        atomic_store(&sh->consumer_waiting, 0);
+        waited_ms += SHMRING_POLL_MS;
+        if (atomic_load(&sh->head) == tail && atomic_load(&sh->writer_busy) &&
+            !peer_alive(atomic_load(&sh->server_pid))) {
+            return -1;
+        }
+    }
+    size_t avail = (size_t)(head - tail);
+    size_t n = len < avail ? len : avail;
+    size_t at = (size_t)(tail & (size - 1));
+    size_t first = n < size - at ? n : (size_t)(size - at);
+    memcpy(buf, sh->data + at, first);
+    memcpy((unsigned char *)buf + first, sh->data, n - first);
+
+    atomic_store(&sh->tail, tail + n);
+    atomic_fetch_add(&sh->space_seq, 1);
+    if (atomic_load(&sh->producer_waiting)) futex_wake(&sh->space_seq);
+    return (ssize_t)n;
+}
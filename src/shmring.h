@@ -0,0 +1,87 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* shmring.h
+ *
+ * Single-producer single-consumer byte ring in a POSIX shared memory segment
+ * (shm_open), used to carry responses from index_server to one ui_client
+ * without going through a pipe: the server copies records once, straight
+ * into the mapping, and the client reads them from there.
+ *
+ * head and tail count bytes written and read since creation; the ring holds
+ * head - tail bytes. A side that has to wait sleeps on a futex word the other
+ * side bumps (data_seq after publishing, space_seq after consuming), and is
+ * only woken with a syscall when it said it is waiting. Waits time out every
+ * SHMRING_POLL_MS to check that the peer process is still alive.
+ *
+ * A producer gives up after SHMRING_WRITE_TIMEOUT_MS without progress, so a
+ * stopped client cannot hold a server thread. If part of the message was
+ * already in the ring it sets aborted: the stream is out of sync for good,
+ * every later read fails and the consumer has to make a new ring.
+ */
+
+#define SHMRING_MAGIC 0x52494e47u  // "RING"
+#define SHMRING_DEFAULT_SIZE (1u << 20)
+#define SHMRING_POLL_MS 1000
+#define SHMRING_WRITE_TIMEOUT_MS 5000
+#define SHMRING_NAME_FMT "/index_rsp.%d"   // one segment per client, %d = its pid
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;                 // data bytes, power of two
+    int32_t client_pid;            // creator, the consumer
+    _Atomic int32_t server_pid;    // last producer attached
+    _Atomic uint32_t writer_busy;  // a producer is writing a message
+    _Atomic uint32_t aborted;      // a message was left half written
+    _Atomic uint64_t head __attribute__((aligned(64)));
+    _Atomic uint32_t data_seq;
+    _Atomic uint32_t consumer_waiting;
+    _Atomic uint64_t tail __attribute__((aligned(64)));
+    _Atomic uint32_t space_seq;
+    _Atomic uint32_t producer_waiting;
+    unsigned char data[] __attribute__((aligned(64)));
+} shmring_shared_t;
+
+typedef struct {
+    shmring_shared_t *sh;
+    size_t map_len;
+    char name[64];
+    int owner;         // created the segment: unlinks it on close
+} shmring_t;
+
+/* create the segment name with size data bytes (rounded up to a power of
+   two) and map it; the caller is the consumer. returns 0 or -1 */
+int shmring_create(shmring_t *r, const char *name, uint32_t size);
+
+/* map an existing segment as its producer. returns 0 or -1 */
+int shmring_open(shmring_t *r, const char *name);
+
+/* unmap (and unlink when the segment was created by us) */
+void shmring_close(shmring_t *r);
+
+/* claim / release the producer side, so two writers never mix their
+   messages; waits while another producer holds it, for at most
+   SHMRING_WRITE_TIMEOUT_MS. returns 0, or -1 if the consumer went away
+   meanwhile, the wait timed out or the ring was aborted */
+int shmring_begin_write(shmring_t *r);
+void shmring_end_write(shmring_t *r);
+
+/* append every iovec, waiting while the ring is full.
+   returns 0, -1 if the consumer went away or did not make room within
+   SHMRING_WRITE_TIMEOUT_MS before anything was written, -2 if that
+   happened after the first byte (the ring is then aborted) */
+int shmring_writev(shmring_t *r, const struct iovec *iov, int iovcnt);
+
+/* read between 1 and len bytes, waiting while the ring is empty (at most
+   timeout_ms when it is not 0). returns the count, or -1 if the producer
+   went away mid-message, the ring was aborted (EPIPE) or the wait timed
+   out (ETIMEDOUT) */
+ssize_t shmring_read(shmring_t *r, void *buf, size_t len, int timeout_ms);
+
+#endif // SHMRING_H
@@ -0,0 +1,377 @@
+#include "trigram.h"
+#include "arena.h"
+#include "arrays.h"
+#include "common.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* longest key looked at, longer ones (none with the hash index
+   normalization) are left out */
+#define TRIGRAM_KEY_MAX 64
+#define TRIGRAM_KEY_GRAMS (TRIGRAM_KEY_MAX + 1)
+
+typedef struct {
+    const char *key;
+    uint32_t len;
+} key_ref_t;
+
+/* candidate of a search, by key id */
+typedef struct {
+    uint32_t id;
+    uint32_t dist;
+    uint32_t shared;
+} candidate_t;
+
+static uint32_t get_u32(const unsigned char *base, size_t i) {
+    uint32_t v;
+    memcpy(&v, base + i * sizeof v, sizeof v);
+    return v;
+}
+
+static int symbol(unsigned char c) {
+    if (c == '^') return 0;
+    if (c == '$') return 1;
+    if (c >= 'a' && c <= 'z') return 2 + (c - 'a');
+    if (c >= '0' && c <= '9') return 28 + (c - '0');
+    return -1;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* distinct trigrams of "^^" key "$", sorted; returns how many (0 if the key
+   holds characters outside the normalized alphabet) */
+static uint32_t key_grams(const char *key, size_t len, uint32_t *out) {
+    if (len == 0 || len > TRIGRAM_KEY_MAX) return 0;
+    int sym[TRIGRAM_KEY_MAX + 3];
+    sym[0] = sym[1] = symbol('^');
+    for (size_t i = 0; i < len; ++i) {
+        if ((sym[i + 2] = symbol((unsigned char)key[i])) < 0) return 0;
+    }
+    sym[len + 2] = symbol('$');
+    uint32_t n = 0;
+    for (size_t i = 0; i + 2 < len + 3; ++i) {
+        out[n++] = (uint32_t)((sym[i] * TRIGRAM_SYMBOLS + sym[i + 1]) * TRIGRAM_SYMBOLS + sym[i + 2]);
+    }
+    qsort(out, n, sizeof *out, cmp_u32);
+    uint32_t d = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (d == 0 || out[d - 1] != out[i]) out[d++] = out[i];
+    }
+    return d;
+}
+
+static int cmp_key_ref(const void *pa, const void *pb) {
+    const key_ref_t *a = pa, *b = pb;
+    int c = memcmp(a->key, b->key, a->len < b->len ? a->len : b->len);
+    if (c != 0) return c;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+/* every distinct key of the index, sorted */
+static int collect_keys(index_handle_t *h, arena_t *arena, key_ref_t **out, uint32_t *out_n) {
+    key_ref_t *keys = NULL;
+    size_t n = 0, cap = 0;
+    arrays_cursor_t cur;
+    arrays_node_view_t view;
+    int rc = 0;
+    for (uint64_t b = 0; rc == 0 && b < h->num_buckets; ++b) {
+        bucket_entry_t entry;
+        if (index_read_bucket(h, b, &entry) != 0) { rc = -1; break; }
+        if (entry.head == 0) continue;
+        int r;
+        index_chain_open(h, &entry, &cur);
+        while ((r = arrays_cursor_next(&cur, &view)) == 1) {
+            if (view.key_len == 0 || view.key_len > TRIGRAM_KEY_MAX) continue;
+            if (n == cap) {
+                size_t new_cap = cap ? cap * 2 : 4096;
+                key_ref_t *tmp = realloc(keys, new_cap * sizeof *keys);
+                if (!tmp) { r = -1; break; }
+                keys = tmp;
+                cap = new_cap;
+            }
+            keys[n].key = arena_strndup(arena, view.key, view.key_len);
+            keys[n].len = view.key_len;
+            if (!keys[n].key) { r = -1; break; }
+            n++;
+        }
+        arrays_cursor_release(&cur);
+        if (r < 0) rc = -1;
+    }
+    if (rc != 0 || n > UINT32_MAX) {
+        free(keys);
+        return -1;
+    }
+    qsort(keys, n, sizeof *keys, cmp_key_ref);
+    size_t d = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (d == 0 || cmp_key_ref(&keys[d - 1], &keys[i]) != 0) keys[d++] = keys[i];
+    }
+    *out = keys;
+    *out_n = (uint32_t)d;
+    return 0;
+}
+
+int trigram_build(index_handle_t *h, const char *out_path) {
+    arena_t arena;
+    arena_init(&arena, 0);
+    key_ref_t *keys = NULL;
+    uint32_t n = 0;
+    if (collect_keys(h, &arena, &keys, &n) != 0) {
+        arena_free(&arena);
+        return -1;
+    }
+
+    /* counting pass, then fill: keys are visited in id order, so every
+       posting list comes out sorted */
+    uint32_t *gram_offs = calloc(TRIGRAM_NUM_GRAMS + 1, sizeof(uint32_t));
+    uint32_t *key_offs = malloc(((size_t)n + 1) * sizeof(uint32_t));
+    uint32_t grams[TRIGRAM_KEY_GRAMS];
+    uint32_t *postings = NULL;
+    int rc = gram_offs && key_offs ? 0 : -1;
+    uint64_t total = 0, blob_len = 0;
+    for (uint32_t i = 0; rc == 0 && i < n; ++i) {
+        uint32_t ng = key_grams(keys[i].key, keys[i].len, grams);
+        for (uint32_t g = 0; g < ng; ++g) gram_offs[grams[g] + 1]++;
+        total += ng;
+        key_offs[i] = (uint32_t)blob_len;
+        blob_len += keys[i].len;
+    }
+    if (rc == 0 && (total > UINT32_MAX || blob_len > UINT32_MAX)) rc = -1;
+    if (rc == 0) {
+        key_offs[n] = (uint32_t)blob_len;
+        for (uint32_t g = 0; g < TRIGRAM_NUM_GRAMS; ++g) gram_offs[g + 1] += gram_offs[g];
+        postings = malloc((total ? total : 1) * sizeof(uint32_t));
+        if (!postings) rc = -1;
+    }
+    if (rc == 0) {
+        uint32_t *fill = malloc(TRIGRAM_NUM_GRAMS * sizeof(uint32_t));
+        if (!fill) {
+            rc = -1;
+        } else {
+            memcpy(fill, gram_offs, TRIGRAM_NUM_GRAMS * sizeof(uint32_t));
+            for (uint32_t i = 0; i < n; ++i) {
+                uint32_t ng = key_grams(keys[i].key, keys[i].len, grams);
+                for (uint32_t g = 0; g < ng; ++g) postings[fill[grams[g]]++] = i;
+            }
+            free(fill);
+        }
+    }
+
+    if (rc == 0) {
+        unsigned char header[TRIGRAM_HEADER_SIZE] = {0};
+        uint16_t version = TRIGRAM_VERSION;
+        uint32_t num_grams = TRIGRAM_NUM_GRAMS;
+        uint64_t keys_off = TRIGRAM_HEADER_SIZE;
+        uint64_t grams_off = keys_off + ((uint64_t)n + 1) * sizeof(uint32_t);
+        uint64_t postings_off = grams_off + ((uint64_t)TRIGRAM_NUM_GRAMS + 1) * sizeof(uint32_t);
+        uint64_t blob_off = postings_off + total * sizeof(uint32_t);
+        memcpy(header, TRIGRAM_MAGIC, 4);
+        memcpy(header + 4, &version, sizeof version);
+        memcpy(header + 8, &n, sizeof n);
+        memcpy(header + 12, &num_grams, sizeof num_grams);
+        memcpy(header + 16, &keys_off, sizeof keys_off);
+        memcpy(header + 24, &grams_off, sizeof grams_off);
+        memcpy(header + 32, &postings_off, sizeof postings_off);
+        memcpy(header + 40, &blob_off, sizeof blob_off);
+
+        int fd = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0) {
+            rc = -1;
+        } else {
+            size_t keys_len = ((size_t)n + 1) * sizeof(uint32_t);
+            size_t grams_len = ((size_t)TRIGRAM_NUM_GRAMS + 1) * sizeof(uint32_t);
+            size_t postings_len = (size_t)total * sizeof(uint32_t);
+            if (safe_pwrite(fd, header, sizeof header, 0) != (ssize_t)sizeof header ||
+                safe_pwrite(fd, key_offs, keys_len, (off_t)keys_off) != (ssize_t)keys_len ||
+                safe_pwrite(fd, gram_offs, grams_len, (off_t)grams_off) != (ssize_t)grams_len ||
+                (postings_len && safe_pwrite(fd, postings, postings_len, (off_t)postings_off) != (ssize_t)postings_len)) {
+                rc = -1;
+            }
+            for (uint32_t i = 0; rc == 0 && i < n; ++i) {
+                if (safe_pwrite(fd, keys[i].key, keys[i].len, (off_t)(blob_off + key_offs[i])) != (ssize_t)keys[i].len) rc = -1;
+            }
+            if (close(fd) != 0) rc = -1;
+        }
+    }
+
+    free(postings);
+    free(key_offs);
+    free(gram_offs);
+    free(keys);
+    arena_free(&arena);
+    return rc;
+}
+
+int trigram_open(trigram_index_t *t, const char *path) {
+    memset(t, 0, sizeof *t);
+    t->fd = -1;
+    if (map_file(path, TRIGRAM_HEADER_SIZE, &t->fd, &t->map, &t->map_len) != 0) return -1;
+
+    uint16_t version;
+    uint32_t num_grams;
+    uint64_t keys_off, grams_off, postings_off, blob_off;
+    memcpy(&version, t->map + 4, sizeof version);
+    memcpy(&t->num_keys, t->map + 8, sizeof t->num_keys);
+    memcpy(&num_grams, t->map + 12, sizeof num_grams);
+    memcpy(&keys_off, t->map + 16, sizeof keys_off);
+    memcpy(&grams_off, t->map + 24, sizeof grams_off);
+    memcpy(&postings_off, t->map + 32, sizeof postings_off);
+    memcpy(&blob_off, t->map + 40, sizeof blob_off);
+    int ok = memcmp(t->map, TRIGRAM_MAGIC, 4) == 0 && version == TRIGRAM_VERSION &&
+             num_grams == TRIGRAM_NUM_GRAMS &&
+             keys_off + ((uint64_t)t->num_keys + 1) * sizeof(uint32_t) == grams_off &&
+             grams_off + ((uint64_t)num_grams + 1) * sizeof(uint32_t) == postings_off &&
+             postings_off <= blob_off && blob_off <= t->map_len &&
+             (blob_off - postings_off) % sizeof(uint32_t) == 0;
+    if (ok) {
+        t->key_offs = t->map + keys_off;
+        t->gram_offs = t->map + grams_off;
+        t->postings = t->map + postings_off;
+        t->num_postings = (uint32_t)((blob_off - postings_off) / sizeof(uint32_t));
+        t->blob = (const char *)t->map + blob_off;
+        t->blob_len = t->map_len - blob_off;
+        ok = get_u32(t->key_offs, t->num_keys) <= t->blob_len &&
+             get_u32(t->gram_offs, TRIGRAM_NUM_GRAMS) == t->num_postings;
+    }
+    if (!ok) {
+        trigram_close(t);
+        return -1;
+    }
+    return 0;
+}
+
+void trigram_close(trigram_index_t *t) {
+    if (!t) return;
+    unmap_file(t->fd, t->map, t->map_len);
+    memset(t, 0, sizeof *t);
+    t->fd = -1;
+}
+
+/* Levenshtein distance of a and b, or max + 1 as soon as it exceeds max */
+static uint32_t bounded_distance(const char *a, size_t a_len, const char *b, size_t b_len, uint32_t max) {
+    uint32_t row[TRIGRAM_KEY_MAX + 1], prev[TRIGRAM_KEY_MAX + 1];
+    if (a_len > TRIGRAM_KEY_MAX || b_len > TRIGRAM_KEY_MAX) return max + 1;
+    for (size_t j = 0; j <= b_len; ++j) prev[j] = (uint32_t)j;
+    for (size_t i = 1; i <= a_len; ++i) {
+        row[0] = (uint32_t)i;
+        uint32_t best = row[0];
+        for (size_t j = 1; j <= b_len; ++j) {
+            uint32_t sub = prev[j - 1] + (a[i - 1] != b[j - 1]);
+            uint32_t del = prev[j] + 1;
+            uint32_t ins = row[j - 1] + 1;
+            uint32_t v = sub < del ? sub : del;
+            row[j] = v < ins ? v : ins;
+            if (row[j] < best) best = row[j];
+        }
+        if (best > max) return max + 1;
+        memcpy(prev, row, (b_len + 1) * sizeof *row);
+    }
+    return prev[b_len];
+}
+
+/* Cursor over one posting list, kept in a min-heap on the current id */
+typedef struct {
+    uint32_t pos;
+    uint32_t end;
+    uint32_t id;
+} list_cursor_t;
+
+static void heap_down(list_cursor_t *h, uint32_t n, uint32_t i) {
+    while (1) {
+        uint32_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && h[l].id < h[m].id) m = l;
+        if (r < n && h[r].id < h[m].id) m = r;
+        if (m == i) return;
+        list_cursor_t tmp = h[i];
+        h[i] = h[m];
+        h[m] = tmp;
+        i = m;
+    }
+}
+
+static int cmp_candidate(const void *pa, const void *pb) {
+    const candidate_t *a = pa, *b = pb;
+    if (a->dist != b->dist) return a->dist < b->dist ? -1 : 1;
+    if (a->shared != b->shared) return a->shared > b->shared ? -1 : 1;
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+int trigram_search(const trigram_index_t *t, const char *query, trigram_match_t *out, uint32_t max) {
+    if (!t || !t->map || !out) return -1;
+    char q[NORMALIZED_MAX_LEN + 1];
+    size_t qlen = normalize_prefix(query, query ? strlen(query) : 0, q);
+    uint32_t grams[TRIGRAM_KEY_GRAMS];
+    uint32_t ng = key_grams(q, qlen, grams);
+    if (ng == 0 || max == 0) return 0;
+    uint32_t max_dist = qlen <= 4 ? 1 : TRIGRAM_MAX_DIST;
+    uint32_t need = ng > 3 * max_dist ? ng - 3 * max_dist : 1;
+
+    /* k-way merge of the sorted lists: equal ids come out together, and
+       their count is the number of shared trigrams */
+    list_cursor_t heap[TRIGRAM_KEY_GRAMS];
+    uint32_t hn = 0;
+    for (uint32_t g = 0; g < ng; ++g) {
+        uint32_t start = get_u32(t->gram_offs, grams[g]);
+        uint32_t end = get_u32(t->gram_offs, grams[g] + 1);
+        if (start >= end || end > t->num_postings) continue;
+        heap[hn].pos = start;
+        heap[hn].end = end;
+        heap[hn].id = get_u32(t->postings, start);
+        hn++;
+    }
+    for (uint32_t i = hn; i-- > 0;) heap_down(heap, hn, i);
+
+    candidate_t *cand = NULL;
+    size_t nc = 0, cap = 0;
+    while (hn > 0) {
+        uint32_t id = heap[0].id;
+        uint32_t shared = 0;
+        while (hn > 0 && heap[0].id == id) {
+            shared++;
+            if (++heap[0].pos < heap[0].end) {
+                heap[0].id = get_u32(t->postings, heap[0].pos);
+            } else {
+                heap[0] = heap[--hn];
+            }
+            heap_down(heap, hn, 0);
+        }
+        if (shared < need || id >= t->num_keys) continue;
+
+        uint32_t ko = get_u32(t->key_offs, id), kend = get_u32(t->key_offs, id + 1);
+        if (kend < ko || kend > t->blob_len) continue;
+        size_t klen = kend - ko;
+        if ((klen > qlen ? klen - qlen : qlen - klen) > max_dist) continue;
+        uint32_t dist = bounded_distance(q, qlen, t->blob + ko, klen, max_dist);
+        if (dist > max_dist) continue;
+        if (nc == cap) {
+            size_t new_cap = cap ? cap * 2 : 64;
+            candidate_t *tmp = realloc(cand, new_cap * sizeof *cand);
+            if (!tmp) { free(cand); return -1; }
+            cand = tmp;
+            cap = new_cap;
+        }
+        cand[nc].id = id;
+        cand[nc].dist = dist;
+        cand[nc].shared = shared;
+        nc++;
+    }
+
+    qsort(cand, nc, sizeof *cand, cmp_candidate);
+    uint32_t n = nc < max ? (uint32_t)nc : max;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t ko = get_u32(t->key_offs, cand[i].id);
+        out[i].key = t->blob + ko;
+        out[i].key_len = get_u32(t->key_offs, cand[i].id + 1) - ko;
+        out[i].dist = cand[i].dist;
+        out[i].shared = cand[i].shared;
+    }
+    free(cand);
+    return (int)n;
+}
@@ -0,0 +1,75 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "reader.h"
+
+/* trigram.h
+ *
+ * Trigram index for typo tolerant lookups (<dir>/<name>_trigram.dat): every
+ * distinct normalized key of a hash index, and for every trigram the sorted
+ * ids of the keys that contain it. Keys are padded as "^^" key "$" so their
+ * first and last characters count as much as the middle ones.
+ *
+ * A search merges the sorted posting lists of the query trigrams, keeps the
+ * keys that share enough of them to be within the allowed edit distance
+ * (an edit changes at most three trigrams) and verifies those with a bounded
+ * Levenshtein distance. Keys sharing no trigram with the query are never
+ * found, which only matters for queries of one or two characters.
+ *
+ * File layout (u32 and u64 in host order):
+ * - header (TRIGRAM_HEADER_SIZE bytes):
+ *   magic "TRG1", version u16, reserved u16, num_keys u32, num_grams u32,
+ *   keys_off u64, grams_off u64, postings_off u64, blob_off u64
+ * - keys: num_keys + 1 u32 offsets into the blob (key i is [off[i], off[i+1]))
+ * - grams: num_grams + 1 u32 offsets into the postings
+ * - postings: u32 key ids, ascending within each trigram
+ * - blob: the keys, sorted, not NUL-terminated
+ */
+
+#define TRIGRAM_MAGIC "TRG1"
+#define TRIGRAM_VERSION 1
+#define TRIGRAM_HEADER_SIZE 64
+#define TRIGRAM_SYMBOLS 38          // '^', '$', a-z, 0-9
+#define TRIGRAM_NUM_GRAMS (TRIGRAM_SYMBOLS * TRIGRAM_SYMBOLS * TRIGRAM_SYMBOLS)
+#define TRIGRAM_MAX_DIST 2
+#define TRIGRAM_SUFFIX "_trigram.dat"
+
+typedef struct {
+    int fd;
+    const unsigned char *map;
+    size_t map_len;
+    uint32_t num_keys;
+    const unsigned char *key_offs;   // num_keys + 1 u32
+    const unsigned char *gram_offs;  // TRIGRAM_NUM_GRAMS + 1 u32
+    const unsigned char *postings;
+    uint32_t num_postings;
+    const char *blob;
+    size_t blob_len;
+} trigram_index_t;
+
+/* One key close to the query; key points into the mapping */
+typedef struct {
+    const char *key;
+    uint32_t key_len;
+    uint32_t dist;       // edit distance to the normalized query
+    uint32_t shared;     // trigrams in common
+} trigram_match_t;
+
+/* write out_path with the keys of every node of an open index.
+   returns 0 or -1 */
+int trigram_build(index_handle_t *h, const char *out_path);
+
+/* map a trigram file read-only. returns 0 or -1 */
+int trigram_open(trigram_index_t *t, const char *path);
+
+void trigram_close(trigram_index_t *t);
+
+/* the keys closest to the normalized query (same normalization as the hash
+   index), nearest first, at most max of them into out. The allowed distance
+   is 1 for queries of up to 4 characters, TRIGRAM_MAX_DIST above.
+   returns how many, or -1 on error */
+int trigram_search(const trigram_index_t *t, const char *query, trigram_match_t *out, uint32_t max);
+
+#endif // TRIGRAM_H
@@ -1,6 +1,9 @@
 #define _GNU_SOURCE
 #include "common.h"
 #include "ui.h"
+#include "records.h"
+#include "proto.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,13 +27,63 @@ const char *display_or_empty(const char *s) {
     return (s != NULL && s[0] != '\0') ? s : "(vacío)";
 }
 
-/* write a line (without trailing newline) to fd and append '\n' */
-int write_line_fd(int fd, const char *s) {
-    size_t len = strlen(s);
-    ssize_t w = write(fd, s, len);
-    if (w != (ssize_t)len) return -1;
-    if (write(fd, "\n", 1) != 1) return -1;
-    return 0;
+/* Send a query (type PROTO_QUERY or PROTO_QUERY_SHM) for title/author,
+   restricted to the comma separated genres and to the numeric filter
+   ("rating >= 4.2 AND pages < 300") unless they are empty; the message
+   is kept within PIPE_BUF bytes so it reaches the shared request FIFO in one
+   piece. returns 0, -1 on a write error, -2 if the query is too long */
+int send_query(int req_fd, uint16_t type, const char *title, const char *author, const char *genres,
+    const char *filter)
+{
+    uint32_t pid = (uint32_t)getpid();
+    const void *items[5] = {&pid, title, author, genres, filter};
+    uint32_t lens[5] = {sizeof pid, (uint32_t)strlen(title), (uint32_t)strlen(author), (uint32_t)strlen(genres),
+                        (uint32_t)strlen(filter)};
+    uint32_t count = filter[0] != '\0' ? 5 : genres[0] != '\0' ? 4 : 3;
+    size_t size = PROTO_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; ++i) size += sizeof(uint32_t) + lens[i];
+    if (size > PIPE_BUF) return -2;
+    proto_out_t out = {req_fd, NULL, 0, 0};
+    return proto_send(&out, type, items, lens, count);
+}
+
+/* Ask for up to limit completions of prefix in a column (FIELD_TITLE or
+   FIELD_AUTHOR); flags carry PROTO_FLAG_SHM. same returns as send_query */
+int send_prefix(int req_fd, uint32_t flags, uint32_t field, const char *prefix, uint32_t limit) {
+    uint32_t pid = (uint32_t)getpid();
+    const void *items[5] = {&pid, &flags, &field, prefix, &limit};
+    uint32_t lens[5] = {sizeof pid, sizeof flags, sizeof field, (uint32_t)strlen(prefix), sizeof limit};
+    size_t size = PROTO_HEADER_SIZE;
+    for (int i = 0; i < 5; ++i) size += sizeof(uint32_t) + lens[i];
+    if (size > PIPE_BUF) return -2;
+    proto_out_t out = {req_fd, NULL, 0, 0};
+    return proto_send(&out, PROTO_PREFIX, items, lens, 5);
+}
+
+/* Same as a query, but the server also matches titles and authors a few
+   typos away. same returns as send_query */
+int send_fuzzy(int req_fd, uint32_t flags, const char *title, const char *author) {
+    uint32_t pid = (uint32_t)getpid();
+    const void *items[4] = {&pid, &flags, title, author};
+    uint32_t lens[4] = {sizeof pid, sizeof flags, (uint32_t)strlen(title), (uint32_t)strlen(author)};
+    size_t size = PROTO_HEADER_SIZE;
+    for (int i = 0; i < 4; ++i) size += sizeof(uint32_t) + lens[i];
+    if (size > PIPE_BUF) return -2;
+    proto_out_t out = {req_fd, NULL, 0, 0};
+    return proto_send(&out, PROTO_FUZZY, items, lens, 4);
+}
+
+/* Ask for the limit books whose descriptions best match words. same returns
+   as send_query */
+int send_text(int req_fd, uint32_t flags, const char *words, uint32_t limit) {
+    uint32_t pid = (uint32_t)getpid();
+    const void *items[4] = {&pid, &flags, words, &limit};
+    uint32_t lens[4] = {sizeof pid, sizeof flags, (uint32_t)strlen(words), sizeof limit};
+    size_t size = PROTO_HEADER_SIZE;
+    for (int i = 0; i < 4; ++i) size += sizeof(uint32_t) + lens[i];
+    if (size > PIPE_BUF) return -2;
+    proto_out_t out = {req_fd, NULL, 0, 0};
+    return proto_send(&out, PROTO_TEXT, items, lens, 4);
 }
 
 void press_enter_to_continue() {
@@ -40,32 +93,12 @@ void press_enter_to_continue() {
     while ((c = getchar()) != '\n' && c != EOF) { }
 }
 
-void print_record(const char *record) {
-    if (!record) {
-        return;
-    }
-
-    char *copy = strdup(record);
-    if (!copy) {
-        printf("\t<OOM>\n");
-        return;
-    }
-
+void print_record(const record_t *rec) {
     /* Punteros a los 14 campos (0..12 primeros, 13 = genres) */
-    char *fields[NUM_DATASET_FIELDS];
-    for (int k = 0; k < NUM_DATASET_FIELDS; ++k) fields[k] = NULL;
-
-    char *p = copy;
-    char *comma;
-    for (int i = 0; i < NUM_DATASET_FIELDS - 1; ++i) {
-        comma = strchr(p, ',');
-        if (!comma) break;
-        *comma = '\0';
-        fields[i] = p;
-        p = comma + 1;
+    const char *fields[NUM_DATASET_FIELDS];
+    for (int k = 0; k < NUM_DATASET_FIELDS; ++k) {
+        fields[k] = k < (int)rec->num_fields ? rec->field[k] : NULL;
     }
-    /* todo lo que quede es genres (puede contener comas) */
-    fields[NUM_DATASET_FIELDS - 1] = p;
 
     /* imprimir tal cual (si un campo es NULL o vacío, se imprime vacío) */
     printf("- Titulo: %s\n", (fields[0] ? fields[0] : ""));
@@ -82,57 +115,104 @@ void print_record(const char *record) {
     printf("- Calificaciones 1 estrella: %s\n", (fields[11] ? fields[11] : ""));
     printf("- Total calificaciones: %s\n", (fields[12] ? fields[12] : ""));
     printf("- Generos: %s\n", (fields[13] ? fields[13] : ""));
-
-    free(copy);
 }
 
 
-/* Read response from rsp_fd and print until "<END>" is found.
-   Uses fdopen on a dup so it doesn't close original fd used elsewhere. */
-void read_and_print_response(int rsp_fd) {
-    int dupfd = dup(rsp_fd);
-    if (dupfd < 0) {
-        perror("dup(rsp_fd)");
-        return;
-    }
-    FILE *f = fdopen(dupfd, "r");
-    if (!f) {
-        perror("fdopen");
-        close(dupfd);
-        return;
-    }
-    char buf[MAX_LINE];
+/* Read one response message through r and print its records.
+   returns 0, -1 if no whole message came (r is then out of sync) */
+int read_and_print_response(proto_reader_t *r) {
+    static proto_msg_t msg;
+    proto_items_t it;
+    const unsigned char *data;
+    uint32_t len;
     int rec_count = 0;
-    bool header_printed = false;
-    while (fgets(buf, sizeof(buf), f)) {
-        rtrim_newline(buf);
-        if (strcmp(buf, "<END>") == 0) {
-            break; 
+    if (proto_read(r, &msg) != 0) {
+        if (errno == ETIMEDOUT) {
+            printf("El servidor no respondió a tiempo\n");
+        } else {
+            perror("Error leyendo respuesta");
         }
-        if (strncmp(buf, "ERR|", 4) == 0) {
-            printf("ERROR (server): %s\n", buf + 4);
-            continue;
+        press_enter_to_continue();
+        return -1;
+    } else if (msg.hdr.type == PROTO_ERROR) {
+        proto_items_init(&it, &msg);
+        if (proto_items_next(&it, &data, &len) > 0) {
+            printf("ERROR (server): %.*s\n", (int)len, (const char *)data);
         }
-        if (strcmp(buf, "OK") == 0) {
-            continue;
+    } else if (msg.hdr.type == PROTO_RECORDS) {
+        record_t rec = {0};
+        proto_items_init(&it, &msg);
+        while (proto_items_next(&it, &data, &len) > 0) {
+            if (record_decode(&rec, data, len, NUM_DATASET_FIELDS) != 0) continue;
+            rec_count++;
+            if (rec_count == 1) {
+                printf("\n\tSe encontraron los siguientes resultados:\n\n");
+            }
+            printf("Resultado %d:\n", rec_count);
+            print_record(&rec);
+            printf("\n");
         }
-        rec_count++;
-        if (!header_printed) {
-            printf("\n\tSe encontraron los siguientes resultados:\n\n");
-            header_printed = true;
+    } else if (msg.hdr.type == PROTO_COMPLETIONS) {
+        proto_items_init(&it, &msg);
+        while (proto_items_next(&it, &data, &len) > 0) {
+            uint32_t rows;
+            if (len < sizeof rows) continue;
+            memcpy(&rows, data, sizeof rows);
+            rec_count++;
+            if (rec_count == 1) {
+                printf("\n\tSugerencias:\n\n");
+            }
+            printf("  %.*s (%u)\n", (int)(len - sizeof rows), (const char *)data + sizeof rows, rows);
         }
-        printf("Resultado %d:\n", rec_count);
-        print_record(buf);
-        printf("\n");
-    }
-    if (ferror(f)) {
-        perror("Error leyendo respuesta");
     }
-    fclose(f);
     if (rec_count == 0) {
         printf("No se encontraron resultados\n");
     } 
     press_enter_to_continue();
+    return 0;
+}
+
+/* Create the response channel; any leftover of a dead client with the same
+   pid is removed first. returns 0, -1 with a message printed */
+int rsp_channel_open(rsp_channel_t *c, bool shm) {
+    c->shm = shm;
+    c->fd = -1;
+    if (shm) {
+        snprintf(c->path, sizeof(c->path), SHMRING_NAME_FMT, (int)getpid());
+        if (shmring_create(&c->ring, c->path, SHMRING_DEFAULT_SIZE) != 0) {
+            fprintf(stderr, "No pude crear la memoria compartida '%s': %s\n", c->path, strerror(errno));
+            return -1;
+        }
+        proto_reader_init_ring(&c->reader, &c->ring);
+    } else {
+        snprintf(c->path, sizeof(c->path), RSP_FIFO_FMT, (int)getpid());
+        unlink(c->path);
+        if (mkfifo(c->path, 0600) != 0) {
+            fprintf(stderr, "No pude crear FIFO de respuestas '%s': %s\n", c->path, strerror(errno));
+            return -1;
+        }
+        /* read-write: the FIFO never reports EOF between answers */
+        c->fd = open(c->path, O_RDWR);
+        if (c->fd < 0) {
+            fprintf(stderr, "No pude abrir FIFO de respuestas '%s': %s\n", c->path, strerror(errno));
+            unlink(c->path);
+            return -1;
+        }
+        proto_reader_init(&c->reader, c->fd);
+    }
+    c->reader.timeout_ms = PROTO_READ_TIMEOUT_MS;
+    return 0;
+}
+
+/* Remove the channel; whatever was left unread in it is dropped */
+void rsp_channel_close(rsp_channel_t *c) {
+    if (c->shm) {
+        shmring_close(&c->ring);
+    } else if (c->fd >= 0) {
+        close(c->fd);
+        unlink(c->path);
+        c->fd = -1;
+    }
 }
 
 /* Read a trimmed line from stdin (malloc'd). Caller must free.
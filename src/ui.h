@@ -3,6 +3,8 @@
 #define UI_H
 
 #include "common.h"
+#include "records.h"
+#include "proto.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,15 +15,32 @@
 #include <stdbool.h>
 
 #define REQ_FIFO "/tmp/index_req.fifo"
-#define RSP_FIFO "/tmp/index_rsp.fifo"
+#define RSP_FIFO_FMT "/tmp/index_rsp.%d.fifo"   // one per client, %d = its pid
 #define MAX_LINE 8192
 
+/* Response channel of a client, named after its pid: its own FIFO
+   (RSP_FIFO_FMT) or, with shm, a shared memory ring (SHMRING_NAME_FMT).
+   Reads give up after PROTO_READ_TIMEOUT_MS without data */
+typedef struct {
+    bool shm;
+    int fd;
+    shmring_t ring;
+    char path[64];
+    proto_reader_t reader;
+} rsp_channel_t;
+
 void rtrim_newline(char *s);
 const char *display_or_empty(const char *s);
-int write_line_fd(int fd, const char *s);
+int send_query(int req_fd, uint16_t type, const char *title, const char *author, const char *genres,
+    const char *filter);
+int send_prefix(int req_fd, uint32_t flags, uint32_t field, const char *prefix, uint32_t limit);
+int send_fuzzy(int req_fd, uint32_t flags, const char *title, const char *author);
+int send_text(int req_fd, uint32_t flags, const char *words, uint32_t limit);
 void press_enter_to_continue();
-void print_record(const char *record);
-void read_and_print_response(int rsp_fd);
+void print_record(const record_t *rec);
+int read_and_print_response(proto_reader_t *r);
+int rsp_channel_open(rsp_channel_t *c, bool shm);
+void rsp_channel_close(rsp_channel_t *c);
 char *getline_trimmed_stdin(void);
 
 #endif // UI_H
\ No newline at end of file
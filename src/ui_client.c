@@ -11,16 +11,34 @@
 #include <stdbool.h>
 
 #define REQ_FIFO "/tmp/index_req.fifo"
-#define RSP_FIFO "/tmp/index_rsp.fifo"
 #define MAX_LINE 8192
+#define SUGGESTIONS 10
+#define TEXT_RESULTS 10
 
 
-int main() {
-    /* Check FIFOs existence */
-    if (access(REQ_FIFO, F_OK) != 0 || access(RSP_FIFO, F_OK) != 0) {
-        fprintf(stderr, "Error: no se encuentran las FIFOs (%s, %s).\n"
-                        "Asegúrate de que index_server esté corriendo y haya creado las FIFOs.\n",
-                REQ_FIFO, RSP_FIFO);
+/* print the answer to the last request. when it did not come whole the
+   channel is made anew, so the rest of it (or a late answer) is not taken
+   for the next one. returns 0, -1 if the channel could not be made */
+static int receive(rsp_channel_t *rsp) {
+    if (read_and_print_response(&rsp->reader) == 0) return 0;
+    rsp_channel_close(rsp);
+    return rsp_channel_open(rsp, rsp->shm);
+}
+
+/* usage: ui_client [--shm]
+   --shm: answers come through a shared memory ring instead of a FIFO */
+int main(int argc, char **argv) {
+    bool use_shm = argc > 1 && strcmp(argv[1], "--shm") == 0;
+    if (argc > 1 && !use_shm) {
+        fprintf(stderr, "Uso: %s [--shm]\n", argv[0]);
+        return 1;
+    }
+
+    /* Check FIFO existence */
+    if (access(REQ_FIFO, F_OK) != 0) {
+        fprintf(stderr, "Error: no se encuentra la FIFO de peticiones (%s).\n"
+                        "Asegúrate de que index_server esté corriendo y haya creado la FIFO.\n",
+                REQ_FIFO);
         return -1;
     }
 
@@ -29,24 +47,38 @@ int main() {
         fprintf(stderr, "No pude abrir FIFO de peticiones '%s': %s\n", REQ_FIFO, strerror(errno));
         return 1;
     }
-    int rsp_fd = open(RSP_FIFO, O_RDWR);
-    if (rsp_fd < 0) {
-        fprintf(stderr, "No pude abrir FIFO de respuestas '%s': %s\n", RSP_FIFO, strerror(errno));
+
+    /* own response channel, named after our pid, which goes in every
+       request. Set up before any request is sent so the server finds it */
+    static rsp_channel_t rsp;
+    if (rsp_channel_open(&rsp, use_shm) != 0) {
         close(req_fd);
         return 1;
     }
+    uint16_t query_type = use_shm ? PROTO_QUERY_SHM : PROTO_QUERY;
 
     char *current_title = NULL;
     char *current_author = NULL;
+    char *current_genres = NULL;   // filter of option 3, comma separated
+    char *current_filter = NULL;   // numeric filter of option 3
 
+    bool lost = false;   // the response channel could not be made anew
     while (1) {
         printf("\n\tMenu de busqueda\n\n");
         printf("Título actual: %s\n", display_or_empty(current_title));
         printf("Autor actual : %s\n", display_or_empty(current_author));
+        if (current_genres) printf("Géneros      : %s\n", current_genres);
+        if (current_filter) printf("Filtro       : %s\n", current_filter);
         printf("\n1. Ingresar titulo\n");
         printf("2. Ingresar autor\n");
         printf("3. Realizar Busqueda\n");
         printf("4. Salir\n");
+        printf("5. Sugerir títulos\n");
+        printf("6. Sugerir autores\n");
+        printf("7. Búsqueda aproximada\n");
+        printf("8. Buscar en descripciones\n");
+        printf("9. Filtrar por géneros\n");
+        printf("10. Filtrar por valores (p. ej. rating >= 4.2 AND pages < 300)\n");
         printf("Selecciona una opción: ");
         fflush(stdout);
 
@@ -76,39 +108,89 @@ int main() {
             if (a && a[0] == '\0') { free(a); a = NULL; }
             free(current_author);
             current_author = a;
-        } else if (strcmp(opt, "3") == 0) {
+        } else if (strcmp(opt, "9") == 0) {
+            printf("Ingrese géneros separados por comas (enter para no filtrar): ");
+            char *g = getline_trimmed_stdin();
+            if (g && g[0] == '\0') { free(g); g = NULL; }
+            free(current_genres);
+            current_genres = g;
+        } else if (strcmp(opt, "10") == 0) {
+            printf("Ingrese el filtro con pages, rating, reviews o ratings (enter para no filtrar): ");
+            char *f = getline_trimmed_stdin();
+            if (f && f[0] == '\0') { free(f); f = NULL; }
+            free(current_filter);
+            current_filter = f;
+        } else if (strcmp(opt, "3") == 0 || strcmp(opt, "7") == 0) {
             const char *t = current_title ? current_title : "";
             const char *a = current_author ? current_author : "";
-            if (t[0] == '\0' && a[0] == '\0') {
+            /* a numeric filter alone is a query too, not for 7 */
+            if (t[0] == '\0' && a[0] == '\0' && (opt[0] == '7' || !current_filter)) {
                 printf("Error: la búsqueda debe tener al menos un parámetro (titulo o autor).\n");
                 free(opt);
                 continue;
             }
 
-            /* Compose request safely (use empty strings if NULL) */
-            char req[MAX_LINE];
-            snprintf(req, sizeof(req), "%s|%s", t, a);
-
-            if (write_line_fd(req_fd, req) != 0) {
+            /* Send the request (empty strings if NULL); 7 tolerates typos */
+            int rc = opt[0] == '7' ? send_fuzzy(req_fd, use_shm ? PROTO_FLAG_SHM : 0, t, a)
+                                   : send_query(req_fd, query_type, t, a, current_genres ? current_genres : "",
+                                                current_filter ? current_filter : "");
+            if (rc == -2) {
+                printf("Error: la búsqueda es demasiado larga.\n");
+            } else if (rc != 0) {
                 fprintf(stderr, "Error escribiendo petición en FIFO: %s\n", strerror(errno));
             } else {
                 /* Read response and print */
-                read_and_print_response(rsp_fd);
+                if (receive(&rsp) != 0) lost = true;
             }
         } else if (strcmp(opt, "4") == 0) {
             free(opt);
             break;
+        } else if (strcmp(opt, "5") == 0 || strcmp(opt, "6") == 0) {
+            uint32_t field = opt[0] == '5' ? FIELD_TITLE : FIELD_AUTHOR;
+            printf("Ingrese el comienzo del %s: ", field == FIELD_TITLE ? "título" : "autor");
+            char *prefix = getline_trimmed_stdin();
+            int rc = send_prefix(req_fd, use_shm ? PROTO_FLAG_SHM : 0, field, prefix ? prefix : "", SUGGESTIONS);
+            if (rc == -2) {
+                printf("Error: el texto es demasiado largo.\n");
+            } else if (rc != 0) {
+                fprintf(stderr, "Error escribiendo petición en FIFO: %s\n", strerror(errno));
+            } else {
+                if (receive(&rsp) != 0) lost = true;
+            }
+            free(prefix);
+        } else if (strcmp(opt, "8") == 0) {
+            printf("Ingrese palabras de la descripción: ");
+            char *words = getline_trimmed_stdin();
+            if (!words || words[0] == '\0') {
+                printf("Error: la búsqueda debe tener al menos una palabra.\n");
+            } else {
+                int rc = send_text(req_fd, use_shm ? PROTO_FLAG_SHM : 0, words, TEXT_RESULTS);
+                if (rc == -2) {
+                    printf("Error: el texto es demasiado largo.\n");
+                } else if (rc != 0) {
+                    fprintf(stderr, "Error escribiendo petición en FIFO: %s\n", strerror(errno));
+                } else {
+                    if (receive(&rsp) != 0) lost = true;
+                }
+            }
+            free(words);
         } else {
-            printf("Opción no válida. Por favor elige 1..4.\n");
+            printf("Opción no válida. Por favor elige 1..10.\n");
         }
 
         free(opt);
+        if (lost) {
+            fprintf(stderr, "Sin canal de respuestas, saliendo.\n");
+            break;
+        }
     }
 
     free(current_title);
     free(current_author);
+    free(current_genres);
+    free(current_filter);
     close(req_fd);
-    close(rsp_fd);
+    rsp_channel_close(&rsp);
     printf("Cliente finalizado.\n");
     return 0;
 }
@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 uint64_t next_pow2(uint64_t v) {
     if (v == 0) return 1;
@@ -17,89 +21,166 @@ uint64_t next_pow2(uint64_t v) {
     return v;
 }
 
-/* normalized_strcmp: compares normalized versions of a and b.
- * returns same semantics as strcmp.
- * handles NULL pointers (treat as empty).
- */
-int normalized_strcmp(const char *a, const char *b) {
-    char *na = normalize_string(a ? a : "");
-    char *nb = normalize_string(b ? b : "");
-    if (!na || !nb) {
-        if (na) free(na);
-        if (nb) free(nb);
-        return strcmp(a ? a : "", b ? b : "");
-    }
-    int r = strcmp(na, nb);
-    free(na);
-    free(nb);
-    return r;
+void normalize_iter_init(normalize_iter_t *it, const char *s, size_t len) {
+    it->s = (const unsigned char *)(s ? s : "");
+    it->len = s ? len : 0;
+    it->i = 0;
+    it->limit = KEY_PREFIX_LEN;
 }
 
-char *normalize_string(const char *s) {
-    if (!s) {
-        char *empty = malloc(1);
-        if (empty) empty[0] = '\0';
-        return empty;
-    }
+void normalize_iter_init_full(normalize_iter_t *it, const char *s, size_t len) {
+    normalize_iter_init(it, s, len);
+    it->limit = SIZE_MAX;
+}
 
-    size_t in_len = strlen(s);
-    char *out = malloc(in_len + 1); // worst-case buffer: same length + 1
-    if (!out) return NULL;
+int normalize_iter_next(normalize_iter_t *it) {
+    const unsigned char *s = it->s;
 
-    size_t i = 0;
-    size_t out_idx = 0;
-    
-    while (s[i] != '\0' && i <= KEY_PREFIX_LEN) {
-        unsigned char c1 = s[i];
+    while (it->i < it->len && s[it->i] != '\0' && it->i <= it->limit) {
+        unsigned char c1 = s[it->i];
 
         // Manejo de caracteres ASCII de 1 byte (los más comunes)
         if (c1 < 128) {
-            char lower = tolower(c1);
+            int lower = tolower(c1);
+            it->i++;
             if ((lower >= 'a' && lower <= 'z') || (lower >= '0' && lower <= '9')) {
-                out[out_idx++] = lower;
+                return lower;
             }
-            i++;
             continue;
         }
 
         // Manejo de caracteres UTF-8 de 2 bytes para español
         if (c1 == 0xc3) {
-            unsigned char c2 = s[i+1];
+            if (it->i + 1 >= it->len || s[it->i + 1] == '\0') {
+                /* truncated sequence at the end of the input */
+                it->i = it->len;
+                break;
+            }
+            unsigned char c2 = s[it->i + 1];
+            it->i += 2;
             switch (c2) {
                 case 0x81: // Á
                 case 0xa1: // á
-                    out[out_idx++] = 'a';
-                    break;
+                    return 'a';
                 case 0x89: // É
                 case 0xa9: // é
-                    out[out_idx++] = 'e';
-                    break;
+                    return 'e';
                 case 0x8d: // Í
                 case 0xad: // í
-                    out[out_idx++] = 'i';
-                    break;
+                    return 'i';
                 case 0x93: // Ó
                 case 0xb3: // ó
-                    out[out_idx++] = 'o';
-                    break;
+                    return 'o';
                 case 0x9a: // Ú
                 case 0xba: // ú
-                    out[out_idx++] = 'u';
-                    break;
+                    return 'u';
                 case 0x91: // Ñ
                 case 0xb1: // ñ
-                    out[out_idx++] = 'n';
-                    break;
+                    return 'n';
                 default:
                     // Si es un carácter UTF-8 que no manejamos, lo ignoramos
                     break;
             }
-            i += 2;
         } else {
-            i++;
+            it->i++;
         }
     }
-    
+    return -1;
+}
+
+/* normalized_strncmp: compares the normalized forms of two byte ranges
+ * character by character, without building them.
+ * returns same semantics as strcmp.
+ */
+int normalized_strncmp(const char *a, size_t a_len, const char *b, size_t b_len) {
+    normalize_iter_t ia, ib;
+    normalize_iter_init(&ia, a, a_len);
+    normalize_iter_init(&ib, b, b_len);
+    while (1) {
+        int ca = normalize_iter_next(&ia);
+        int cb = normalize_iter_next(&ib);
+        if (ca != cb) return (ca < 0 ? 0 : ca) - (cb < 0 ? 0 : cb);
+        if (ca < 0) return 0;
+    }
+}
+
+/* normalized_strcmp: compares normalized versions of a and b.
+ * returns same semantics as strcmp.
+ * handles NULL pointers (treat as empty).
+ */
+int normalized_strcmp(const char *a, const char *b) {
+    return normalized_strncmp(a, a ? strlen(a) : 0, b, b ? strlen(b) : 0);
+}
+
+size_t normalize_prefix(const char *s, size_t len, char *out) {
+    normalize_iter_t it;
+    normalize_iter_init(&it, s, len);
+    size_t out_idx = 0;
+    int c;
+    while ((c = normalize_iter_next(&it)) >= 0) {
+        out[out_idx++] = (char)c;
+    }
     out[out_idx] = '\0';
+    return out_idx;
+}
+
+size_t normalize_text(const char *s, size_t len, char *out, size_t cap) {
+    normalize_iter_t it;
+    normalize_iter_init_full(&it, s, len);
+    size_t out_idx = 0;
+    int c;
+    while (out_idx + 1 < cap && (c = normalize_iter_next(&it)) >= 0) {
+        out[out_idx++] = (char)c;
+    }
+    out[out_idx] = '\0';
+    return out_idx;
+}
+
+char *normalize_string(const char *s) {
+    char *out = malloc(NORMALIZED_MAX_LEN + 1);
+    if (!out) return NULL;
+    normalize_prefix(s, s ? strlen(s) : 0, out);
     return out;
 }
+
+int cmp_keys(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) return c;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+unsigned char *out_reserve(out_buf_t *o, size_t extra) {
+    if (o->len + extra > o->cap) {
+        size_t cap = o->cap ? o->cap : 65536;
+        while (cap < o->len + extra) cap *= 2;
+        unsigned char *tmp = realloc(o->buf, cap);
+        if (!tmp) return NULL;
+        o->buf = tmp;
+        o->cap = cap;
+    }
+    return o->buf + o->len;
+}
+
+int map_file(const char *path, size_t min_len, int *fd, const unsigned char **map, size_t *len) {
+    int f = open(path, O_RDONLY);
+    if (f < 0) return -1;
+    struct stat st;
+    if (fstat(f, &st) != 0 || st.st_size < 0 || (uint64_t)st.st_size < min_len) {
+        close(f);
+        return -1;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, f, 0);
+    if (m == MAP_FAILED) {
+        close(f);
+        return -1;
+    }
+    *fd = f;
+    *map = m;
+    *len = (size_t)st.st_size;
+    return 0;
+}
+
+void unmap_file(int fd, const unsigned char *map, size_t len) {
+    if (map) munmap((void *)map, len);
+    if (fd >= 0) close(fd);
+}
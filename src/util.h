@@ -4,8 +4,66 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "common.h"
+
+/* longest output of the normalization (input is cut after KEY_PREFIX_LEN + 1 bytes) */
+#define NORMALIZED_MAX_LEN (KEY_PREFIX_LEN + 1)
+
+/* Streaming normalizer: yields the normalized characters of s one at a time,
+ * without building the normalized string. Reads at most len bytes and stops
+ * at a NUL byte.
+ */
+typedef struct {
+    const unsigned char *s;
+    size_t len;
+    size_t i;
+    size_t limit;        // last input byte looked at (KEY_PREFIX_LEN)
+} normalize_iter_t;
+
+void normalize_iter_init(normalize_iter_t *it, const char *s, size_t len);
+
+/* same without the KEY_PREFIX_LEN cut: the whole input is normalized */
+void normalize_iter_init_full(normalize_iter_t *it, const char *s, size_t len);
+
+/* next normalized character, or -1 at the end */
+int normalize_iter_next(normalize_iter_t *it);
+
 uint64_t next_pow2(uint64_t v);
 
 int normalized_strcmp(const char *a, const char *b);
+
+/* same as normalized_strcmp on byte ranges that need not be NUL-terminated */
+int normalized_strncmp(const char *a, size_t a_len, const char *b, size_t b_len);
+
 char *normalize_string(const char *s);
+
+/* normalize into a caller buffer of at least NORMALIZED_MAX_LEN + 1 bytes,
+   returns the normalized length */
+size_t normalize_prefix(const char *s, size_t len, char *out);
+
+/* normalize all of s (not only its key prefix) into out, keeping at most
+   cap - 1 characters and a NUL. returns the normalized length */
+size_t normalize_text(const char *s, size_t len, char *out, size_t cap);
+
+/* byte order of two keys, a shorter key before the longer ones it starts */
+int cmp_keys(const char *a, size_t a_len, const char *b, size_t b_len);
+
+/* Growable output buffer of the index builders */
+typedef struct {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+} out_buf_t;
+
+/* room for extra more bytes at o->buf + o->len (the caller advances len),
+   NULL when out of memory */
+unsigned char *out_reserve(out_buf_t *o, size_t extra);
+
+/* map the whole of path read-only, failing when it is shorter than min_len.
+   the open fd, the mapping and its length go to fd, map and len. returns 0,
+   or -1 with nothing left open */
+int map_file(const char *path, size_t min_len, int *fd, const unsigned char **map, size_t *len);
+
+/* undo map_file (map may be NULL and fd negative) */
+void unmap_file(int fd, const unsigned char *map, size_t len);
 #endif // UTIL_H
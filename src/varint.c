@@ -0,0 +1,109 @@
+#include "varint.h"
+
+size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+size_t varint_put(unsigned char *buf, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    return n;
+}
+
+size_t varint_delta_size(const off_t *vals, uint32_t n) {
+    size_t bytes = 0;
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t v = (uint64_t)vals[i];
+        bytes += varint_size(v - prev);
+        prev = v;
+    }
+    return bytes;
+}
+
+size_t varint_delta_encode(unsigned char *buf, const off_t *vals, uint32_t n) {
+    size_t pos = 0;
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t v = (uint64_t)vals[i];
+        pos += varint_put(buf + pos, v - prev);
+        prev = v;
+    }
+    return pos;
+}
+
+size_t varint_get(const unsigned char *p, const unsigned char *end, uint64_t *v) {
+    uint64_t r = 0;
+    for (size_t i = 0; i < VARINT_MAX_BYTES && p + i < end; ++i) {
+        r |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+        if (p[i] < 0x80) {
+            *v = r;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t varint_delta_decode(const unsigned char **pp, const unsigned char *end,
+    uint64_t *prev, uint64_t *out, size_t n)
+{
+    const unsigned char *p = *pp;
+    uint64_t acc = *prev;
+    size_t i = 0;
+
+    /* fast loop: while a whole varint surely fits, no bounds checks per byte
+       and the common 1..3 byte gaps are decoded without a loop */
+    while (i < n && end - p >= VARINT_MAX_BYTES) {
+        uint64_t b = p[0];
+        uint64_t v = b & 0x7f;
+        if (b < 0x80) {
+            p += 1;
+        } else {
+            b = p[1];
+            v |= (b & 0x7f) << 7;
+            if (b < 0x80) {
+                p += 2;
+            } else {
+                b = p[2];
+                v |= (b & 0x7f) << 14;
+                if (b < 0x80) {
+                    p += 3;
+                } else {
+                    size_t k = 3;
+                    do {
+                        b = p[k];
+                        v |= (b & 0x7f) << (7 * k);
+                        k++;
+                    } while (b >= 0x80 && k < VARINT_MAX_BYTES);
+                    if (b >= 0x80) break; /* longer than any uint64 */
+                    p += k;
+                }
+            }
+        }
+        acc += v;
+        out[i++] = acc;
+    }
+
+    /* tail of the buffer */
+    while (i < n) {
+        uint64_t v;
+        size_t used = varint_get(p, end, &v);
+        if (used == 0) break;
+        p += used;
+        acc += v;
+        out[i++] = acc;
+    }
+
+    *pp = p;
+    *prev = acc;
+    return i;
+}
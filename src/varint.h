@@ -0,0 +1,42 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+
+/* varint.h
+ *
+ * LEB128 varints (7 bits per byte, low group first, high bit set on every
+ * byte but the last) and delta coded posting lists: a sorted list of offsets
+ * is stored as the first offset followed by the gaps between neighbours, each
+ * one as a varint. Record offsets of one key are usually a few KB apart, so
+ * most of them take 2 or 3 bytes instead of 8.
+ */
+
+/* longest varint of a uint64 */
+#define VARINT_MAX_BYTES 10
+
+/* bytes taken by v */
+size_t varint_size(uint64_t v);
+
+/* write v at buf, returns bytes written */
+size_t varint_put(unsigned char *buf, uint64_t v);
+
+/* one varint from [p, end) into *v, returns bytes used or 0 if truncated/too long */
+size_t varint_get(const unsigned char *p, const unsigned char *end, uint64_t *v);
+
+/* encoded size of a sorted list of n offsets */
+size_t varint_delta_size(const off_t *vals, uint32_t n);
+
+/* encode a sorted list of n offsets into buf, returns bytes written */
+size_t varint_delta_encode(unsigned char *buf, const off_t *vals, uint32_t n);
+
+/* decode up to n values of a delta coded list from [*p, end), continuing from
+   the last value *prev (0 at the start of a list). *p and *prev are advanced.
+   returns the number of values decoded, fewer than n only on truncated or
+   corrupt input */
+size_t varint_delta_decode(const unsigned char **p, const unsigned char *end,
+    uint64_t *prev, uint64_t *out, size_t n);
+
+#endif // VARINT_H
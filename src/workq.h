@@ -0,0 +1,41 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* workq.h
+ *
+ * Bounded FIFO of jobs shared by a producer (the thread reading requests)
+ * and a fixed pool of worker threads. A full queue blocks the producer, so
+ * requests wait in the FIFO instead of piling up in memory.
+ */
+
+typedef struct {
+    void **items;
+    size_t cap;
+    size_t head;         // next item to pop
+    size_t count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} workq_t;
+
+/* queue of at most cap items, returns 0 or -1 */
+int workq_init(workq_t *q, size_t cap);
+
+/* append item, waiting while the queue is full. returns -1 once closed */
+int workq_push(workq_t *q, void *item);
+
+/* take the oldest item, waiting while the queue is empty.
+   returns NULL once the queue is closed and drained */
+void *workq_pop(workq_t *q);
+
+/* wake every waiter: pushes fail, pops drain what is left then return NULL */
+void workq_close(workq_t *q);
+
+/* release the queue (items still in it are not freed) */
+void workq_free(workq_t *q);
+
+#endif // WORKQ_H